@@ -0,0 +1,52 @@
+/**
+ * @file checksum_bench.cpp
+ * @brief Benchmarks of the Internet checksum
+ */
+
+#include <benchmark/benchmark.h>
+#include <vector>
+#include "netutil.hpp"
+
+/**
+ * @brief Fill a buffer with a byte pattern
+ * @param len Length in bytes
+ * @return Buffer
+ */
+static std::vector<unsigned char> MakeBuffer(size_t len) {
+    std::vector<unsigned char> buf(len);
+    for (size_t i = 0; i < len; i++) {
+        buf[i] = static_cast<unsigned char>(i * 31 + 7);
+    }
+    return buf;
+}
+
+/**
+ * @brief NetworkUtil::Checksum() over one buffer
+ * @param state Benchmark state, range(0) is the length
+ */
+static void BM_Checksum(benchmark::State& state) {
+    int len = static_cast<int>(state.range(0));
+    std::vector<unsigned char> buf = MakeBuffer(len);
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(NetworkUtil::Checksum(buf.data(), len));
+    }
+    state.SetBytesProcessed(state.iterations() * len);
+}
+BENCHMARK(BM_Checksum)->Arg(20)->Arg(60)->Arg(64)->Arg(576)->Arg(1500)->Arg(9000);
+
+/**
+ * @brief NetworkUtil::Checksum2() over an IP header and its options
+ * @param state Benchmark state, range(0) is the length of the second buffer
+ */
+static void BM_Checksum2(benchmark::State& state) {
+    int len = static_cast<int>(state.range(0));
+    std::vector<unsigned char> header = MakeBuffer(20);
+    std::vector<unsigned char> rest = MakeBuffer(len);
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(NetworkUtil::Checksum2(header.data(), 20, rest.data(), len));
+    }
+    state.SetBytesProcessed(state.iterations() * (20 + len));
+}
+BENCHMARK(BM_Checksum2)->Arg(0)->Arg(3)->Arg(40)->Arg(1480);
@@ -0,0 +1,118 @@
+/**
+ * @file ip2mac_bench.cpp
+ * @brief Benchmarks of the neighbor table
+ */
+
+#include <benchmark/benchmark.h>
+#include <arpa/inet.h>
+#include <memory>
+#include "ip2mac.hpp"
+
+static const size_t TABLE_SIZE = 4096;   // Neighbor table capacity
+
+/**
+ * @brief Get the address of the i-th neighbor
+ * @param i Neighbor number
+ * @return Address in network byte order
+ */
+static in_addr_t NeighborAddr(uint32_t i) {
+    return htonl(0x0a000000 | (i & 0x00ffffff));
+}
+
+/**
+ * @brief Fill a table with resolved neighbors
+ * @param manager Table
+ * @param count Number of neighbors
+ */
+static void Fill(IP2MACManager& manager, size_t count) {
+    unsigned char mac[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x00};
+    for (size_t i = 0; i < count; i++) {
+        mac[4] = static_cast<unsigned char>(i >> 8);
+        mac[5] = static_cast<unsigned char>(i);
+        manager.GetIp2Mac(0, NeighborAddr(static_cast<uint32_t>(i)), mac);
+    }
+}
+
+/**
+ * @brief GetIp2Mac() of existing neighbors
+ * @param state Benchmark state, range(0) is the fill level in percent
+ */
+static void BM_GetIp2MacHit(benchmark::State& state) {
+    IP2MACManager manager(TABLE_SIZE);
+    size_t count = TABLE_SIZE * state.range(0) / 100;
+    Fill(manager, count);
+
+    uint32_t i = 0;
+    for (auto _ : state) {
+        // Stride through the table so consecutive lookups hit different lines
+        benchmark::DoNotOptimize(manager.GetIp2Mac(0, NeighborAddr(i), nullptr));
+        i = (i + 97) % count;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_GetIp2MacHit)->Arg(10)->Arg(50)->Arg(90)->Arg(100);
+
+/**
+ * @brief GetIp2Mac() of new neighbors into a partly filled table
+ * @param state Benchmark state, range(0) is the fill level in percent
+ *
+ * The table is rebuilt outside the timed region every INSERT_BATCH
+ * inserts, so the fill level stays close to the one requested.
+ */
+static void BM_GetIp2MacInsert(benchmark::State& state) {
+    static const size_t INSERT_BATCH = 256;
+    size_t count = TABLE_SIZE * state.range(0) / 100;
+    std::unique_ptr<IP2MACManager> manager;
+    size_t inserted = INSERT_BATCH;
+
+    for (auto _ : state) {
+        if (inserted == INSERT_BATCH) {
+            state.PauseTiming();
+            manager.reset(new IP2MACManager(TABLE_SIZE));
+            Fill(*manager, count);
+            inserted = 0;
+            state.ResumeTiming();
+        }
+        benchmark::DoNotOptimize(manager->GetIp2Mac(0, NeighborAddr(static_cast<uint32_t>(count + inserted)), nullptr));
+        inserted++;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_GetIp2MacInsert)->Arg(0)->Arg(50)->Arg(90);
+
+/**
+ * @brief GetIp2Mac() of new neighbors into a full table (LRU eviction)
+ * @param state Benchmark state
+ */
+static void BM_GetIp2MacEvict(benchmark::State& state) {
+    IP2MACManager manager(TABLE_SIZE);
+    Fill(manager, TABLE_SIZE);
+
+    uint32_t next = TABLE_SIZE;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(manager.GetIp2Mac(0, NeighborAddr(next++), nullptr));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_GetIp2MacEvict);
+
+/**
+ * @brief Lock-free Lookup() of resolved neighbors
+ * @param state Benchmark state, range(0) is the fill level in percent
+ */
+static void BM_Ip2MacLookup(benchmark::State& state) {
+    IP2MACManager manager(TABLE_SIZE);
+    unsigned char port_mac[6] = {0x02, 0xff, 0x00, 0x00, 0x00, 0x01};
+    manager.SetPortAddress(0, port_mac);
+    size_t count = TABLE_SIZE * state.range(0) / 100;
+    Fill(manager, count);
+
+    alignas(16) unsigned char header[IP2MAC_L2_SIZE];
+    uint32_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(manager.Lookup(0, NeighborAddr(i), header));
+        i = (i + 97) % count;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Ip2MacLookup)->Arg(10)->Arg(100);
@@ -0,0 +1,326 @@
+/**
+ * @file router_bench.cpp
+ * @brief Benchmarks of the forwarding path on in-memory frames
+ */
+
+#include <benchmark/benchmark.h>
+#include <arpa/inet.h>
+#include <netinet/udp.h>
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <vector>
+#include "router.hpp"
+
+/**
+ * @brief Packet I/O engine that discards what it is given
+ */
+class SinkPacketIO : public PacketIO {
+public:
+    int Fd() const override { return -1; }
+    int ControlFd() const override { return -1; }
+    int RxBurst(u_char** frames, int* sizes, int max) override { (void)frames; (void)sizes; (void)max; return 0; }
+    int Stage(u_char* data, int len) override { (void)data; staged_bytes += len; staged++; return 1; }
+    u_char* Reserve() override { return slot; }
+    int Commit(int len) override { return Stage(slot, len); }
+    int TxBurst(size_t* frames = nullptr, size_t* bytes = nullptr, size_t* rejected = nullptr) override {
+        int sent = static_cast<int>(staged);
+        if (rejected != nullptr) {
+            *rejected = 0;
+        }
+        if (frames != nullptr) {
+            *frames = staged;
+        }
+        if (bytes != nullptr) {
+            *bytes = staged_bytes;
+        }
+        staged = 0;
+        staged_bytes = 0;
+        return sent;
+    }
+    size_t Pending() const override { return staged; }
+    void Free() override {}
+    const char* Name() const override { return "sink"; }
+
+private:
+    size_t staged = 0;                           // Frames staged since TxBurst()
+    size_t staged_bytes = 0;                     // Bytes of staged
+    u_char slot[TxBatch::TX_SLOT_SIZE];          // Reserve() storage
+};
+
+/**
+ * @brief Two-port router without sockets
+ *
+ * Port 0 (10.0.1.1/24) receives; port 1 (10.0.2.1/24, plus 10.2.0.0/16 via
+ * the resolved neighbor 10.0.2.2) transmits. Every worker's engine is a
+ * SinkPacketIO, so only the forwarding work is measured.
+ */
+class RouterBench {
+public:
+    static const int PORT_NUM = 2;
+
+    /**
+     * @brief Constructor
+     * @param config Router configuration, see MakeConfig()
+     */
+    explicit RouterBench(const RouterConfig& config = MakeConfig()) : router(config) {
+        static const unsigned char port_mac[PORT_NUM][6] = {
+            {0x02, 0x00, 0x00, 0x00, 0x00, 0x01},
+            {0x02, 0x00, 0x00, 0x00, 0x00, 0x02},
+        };
+
+        router.interface_info.resize(PORT_NUM);
+        for (int i = 0; i < PORT_NUM; i++) {
+            InterfaceInfo& info = router.interface_info[i];
+            memset(&info, 0, sizeof(info));
+            info.socket_descriptor = -1;
+            memcpy(info.hw_addr, port_mac[i], 6);
+            info.ip_addr.s_addr = htonl(0x0a000001 | ((i + 1) << 8));
+            info.subnet.s_addr = htonl(0x0a000000 | ((i + 1) << 8));
+            info.netmask.s_addr = htonl(0xffffff00);
+            router.ip2mac_manager.SetPortAddress(i, info.hw_addr);
+            router.fib.load()->AddRoute(info.subnet.s_addr, 24, i, 0);
+            router.workers.emplace_back(new Router::Worker(i, 0, router.config.route_cache_size));
+            router.workers.back()->io.reset(new SinkPacketIO());
+        }
+        router.fib.load()->AddRoute(htonl(0x0a020000), 16, 1, inet_addr("10.0.2.2"));
+
+        for (auto& worker : router.workers) {
+            worker->inbound.resize(PORT_NUM);
+            worker->inbound_staged.assign(PORT_NUM, 0);
+            for (int src = 0; src < PORT_NUM; src++) {
+                if (src != worker->device_number) {
+                    worker->inbound[src].reset(new SpscRing<Router::PortFrame>(router.config.port_ring_size));
+                }
+            }
+        }
+
+        unsigned char gateway_mac[6] = {0x02, 0x00, 0x00, 0x00, 0x02, 0x02};
+        router.ip2mac_manager.GetIp2Mac(1, inet_addr("10.0.2.2"), gateway_mac);
+    }
+
+    /**
+     * @brief Build a UDP frame from 10.0.1.2 to a destination
+     * @param dst Destination address
+     * @param size Frame length
+     * @return Frame
+     */
+    std::vector<u_char> MakeFrame(in_addr_t dst, int size) {
+        std::vector<u_char> frame(size, 0);
+        struct ether_header* eth = (struct ether_header*)frame.data();
+        memcpy(eth->ether_dhost, router.interface_info[0].hw_addr, 6);
+        static const unsigned char host_mac[6] = {0x02, 0x00, 0x00, 0x00, 0x01, 0x02};
+        memcpy(eth->ether_shost, host_mac, 6);
+        eth->ether_type = htons(ETHERTYPE_IP);
+
+        struct iphdr* ip = (struct iphdr*)(frame.data() + sizeof(struct ether_header));
+        ip->version = 4;
+        ip->ihl = 5;
+        ip->tot_len = htons(size - sizeof(struct ether_header));
+        ip->ttl = 64;
+        ip->protocol = IPPROTO_UDP;
+        ip->saddr = inet_addr("10.0.1.2");
+        ip->daddr = dst;
+        ip->check = NetworkUtil::Checksum((unsigned char*)ip, sizeof(struct iphdr));
+
+        struct udphdr* udp = (struct udphdr*)(ip + 1);
+        udp->source = htons(4000);
+        udp->dest = htons(5000);
+        udp->len = htons(size - sizeof(struct ether_header) - sizeof(struct iphdr));
+        return frame;
+    }
+
+    /**
+     * @brief Analyze one frame received on port 0
+     * @param data Frame data
+     * @param size Frame length
+     * @return Result of Router::AnalyzePacket()
+     */
+    int Analyze(u_char* data, int size) { return router.AnalyzePacket(*router.workers[0], data, size); }
+
+    /**
+     * @brief Analyze a burst of frames received on port 0
+     * @param frames Frame pointers
+     * @param sizes Frame lengths
+     * @param n Number of frames
+     * @return Result of Router::AnalyzePacketBurst()
+     */
+    int AnalyzeBurst(u_char** frames, int* sizes, int n) {
+        return router.AnalyzePacketBurst(*router.workers[0], frames, sizes, n);
+    }
+
+    /**
+     * @brief Finish a worker loop iteration on every port
+     *
+     * Port 1 still drains its inbound ring, which is part of forwarding
+     * to another port; the staged frames are discarded by the engines.
+     */
+    void Sink() {
+        for (auto& worker : router.workers) {
+            router.DrainInbound(*worker);
+            router.FlushTx(*worker);
+        }
+    }
+
+    /**
+     * @brief Resolve neighbors 10.2.x.y on port 1 so that they bypass the gateway route
+     * @param count Number of neighbors
+     */
+    void AddHostRoutes(int count) {
+        unsigned char mac[6] = {0x02, 0x00, 0x00, 0x02, 0x00, 0x00};
+        for (int i = 0; i < count; i++) {
+            in_addr_t addr = htonl(0x0a020000 | (i + 1));
+            router.fib.load()->AddRoute(addr, 32, 1, 0);
+            mac[4] = static_cast<unsigned char>((i + 1) >> 8);
+            mac[5] = static_cast<unsigned char>(i + 1);
+            router.ip2mac_manager.GetIp2Mac(1, addr, mac);
+        }
+    }
+
+    /**
+     * @brief Resolve neighbors 10.3.x.y on port 1, reached through one directly connected route
+     * @param count Number of neighbors (at most the neighbor table size)
+     * @return Neighbor addresses
+     */
+    std::vector<in_addr_t> AddNeighbors(int count) {
+        router.fib.load()->AddRoute(htonl(0x0a030000), 16, 1, 0);
+        std::vector<in_addr_t> addrs;
+        unsigned char mac[6] = {0x02, 0x00, 0x00, 0x03, 0x00, 0x00};
+        for (int i = 0; i < count; i++) {
+            in_addr_t addr = htonl(0x0a030000 | (i + 1));
+            mac[4] = static_cast<unsigned char>((i + 1) >> 8);
+            mac[5] = static_cast<unsigned char>(i + 1);
+            router.ip2mac_manager.GetIp2Mac(1, addr, mac);
+            addrs.push_back(addr);
+        }
+        return addrs;
+    }
+
+    /**
+     * @brief Get the configuration of the benchmark router
+     * @return Configuration
+     */
+    static RouterConfig MakeConfig() {
+        RouterConfig config;
+        config.interfaces = {"bench0", "bench1"};
+        config.debug_out = false;
+        config.pin_workers = false;
+        return config;
+    }
+
+private:
+    Router router;   // Router under test
+};
+
+/**
+ * @brief AnalyzePacket() of frames forwarded to another port
+ * @param state Benchmark state, range(0) is the number of destinations, range(1) the frame size
+ *
+ * One destination always hits the route cache; many destinations spread
+ * over host routes and neighbors exercise the FIB and neighbor lookups.
+ */
+static void BM_AnalyzePacket(benchmark::State& state) {
+    int dests = static_cast<int>(state.range(0));
+    int size = static_cast<int>(state.range(1));
+    RouterBench bench;
+    bench.AddHostRoutes(dests);
+
+    std::vector<std::vector<u_char>> templates;
+    for (int i = 0; i < dests; i++) {
+        templates.push_back(bench.MakeFrame(htonl(0x0a020000 | (i + 1)), size));
+    }
+    std::vector<u_char> frame(size);
+
+    int i = 0;
+    int64_t forwarded = 0;
+    for (auto _ : state) {
+        // The router rewrites the frame in place; start from a fresh copy
+        memcpy(frame.data(), templates[i].data(), size);
+        forwarded += (bench.Analyze(frame.data(), size) == 0);
+        bench.Sink();
+        i = (i + 1 == dests) ? 0 : i + 1;
+    }
+    state.SetItemsProcessed(state.iterations());
+    // 1 when every frame took the forwarding path rather than a drop
+    state.counters["forwarded"] = benchmark::Counter(forwarded, benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_AnalyzePacket)->Args({1, 64})->Args({1, 1500})->Args({256, 64})->Args({2048, 64});
+
+/**
+ * @brief AnalyzePacketBurst() of bursts forwarded to another port
+ * @param state Benchmark state, range(0) is the burst size, range(1) the number of destinations
+ */
+static void BM_AnalyzePacketBurst(benchmark::State& state) {
+    int burst = static_cast<int>(state.range(0));
+    int dests = static_cast<int>(state.range(1));
+    RouterBench bench;
+    bench.AddHostRoutes(dests);
+
+    std::vector<std::vector<u_char>> templates;
+    std::vector<std::vector<u_char>> buffers(burst);
+    for (int i = 0; i < burst; i++) {
+        templates.push_back(bench.MakeFrame(htonl(0x0a020000 | ((i % dests) + 1)), 64));
+        buffers[i].resize(64);
+    }
+    u_char* frames[Router::MAX_BURST];
+    int sizes[Router::MAX_BURST];
+    int64_t forwarded = 0;
+
+    for (auto _ : state) {
+        for (int i = 0; i < burst; i++) {
+            memcpy(buffers[i].data(), templates[i].data(), 64);
+            frames[i] = buffers[i].data();
+            sizes[i] = 64;
+        }
+        forwarded += bench.AnalyzeBurst(frames, sizes, burst);
+        bench.Sink();
+    }
+    state.SetItemsProcessed(state.iterations() * burst);
+    state.counters["forwarded"] = benchmark::Counter(forwarded, benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_AnalyzePacketBurst)->Args({32, 1})->Args({32, 32});
+
+/**
+ * @brief AnalyzePacketBurst() of bursts to many neighbors, with and without prefetching
+ * @param state Benchmark state, range(0) is the prefetch depth, range(1) the number of neighbors
+ *
+ * Destinations are visited in a random order, so the route cache mostly
+ * misses and every frame needs a neighbor lookup. With 65536 neighbors the
+ * published part of the neighbor table alone is 2 MiB.
+ */
+static void BM_AnalyzePacketBurstPrefetch(benchmark::State& state) {
+    static const int BURST = 32;
+    int neighbors = static_cast<int>(state.range(1));
+    RouterConfig config = RouterBench::MakeConfig();
+    config.prefetch_depth = static_cast<int>(state.range(0));
+    config.neighbor_table_size = neighbors;
+    RouterBench bench(config);
+    std::vector<in_addr_t> dsts = bench.AddNeighbors(neighbors);
+
+    std::mt19937 rng(1);
+    std::shuffle(dsts.begin(), dsts.end(), rng);
+
+    std::vector<u_char> frame = bench.MakeFrame(dsts[0], 64);
+    std::vector<std::vector<u_char>> buffers(BURST, std::vector<u_char>(64));
+    u_char* frames[Router::MAX_BURST];
+    int sizes[Router::MAX_BURST];
+    size_t next = 0;
+    int64_t forwarded = 0;
+
+    for (auto _ : state) {
+        for (int i = 0; i < BURST; i++) {
+            memcpy(buffers[i].data(), frame.data(), 64);
+            ((struct iphdr*)(buffers[i].data() + sizeof(struct ether_header)))->daddr = dsts[next];
+            next = (next + 1) % dsts.size();
+            frames[i] = buffers[i].data();
+            sizes[i] = 64;
+        }
+        forwarded += bench.AnalyzeBurst(frames, sizes, BURST);
+        bench.Sink();
+    }
+    state.SetItemsProcessed(state.iterations() * BURST);
+    state.counters["forwarded"] = benchmark::Counter(forwarded, benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_AnalyzePacketBurstPrefetch)
+    ->Args({0, 1024})->Args({4, 1024})
+    ->Args({0, 65536})->Args({2, 65536})->Args({4, 65536})->Args({8, 65536});
@@ -0,0 +1,65 @@
+/**
+ * @file send_buf_bench.cpp
+ * @brief Benchmarks of the queues of packets waiting for ARP
+ */
+
+#include <benchmark/benchmark.h>
+#include <arpa/inet.h>
+#include <vector>
+#include "ip2mac.hpp"
+#include "packet_pool.hpp"
+#include "send_buf.hpp"
+
+/**
+ * @brief Queue packets for one neighbor and drain them again
+ * @param state Benchmark state, range(0) is the packets per round, range(1) the packet size
+ */
+static void BM_SendBufChurn(benchmark::State& state) {
+    int depth = static_cast<int>(state.range(0));
+    int size = static_cast<int>(state.range(1));
+    PacketPool pool(4096);
+    SendBuf send_buf(&pool);
+    IP2MACManager manager;
+    in_addr_t addr = inet_addr("10.0.0.1");
+    IP2MAC* neighbor = manager.GetIp2Mac(0, addr, nullptr);
+    std::vector<unsigned char> packet(size, 0x5a);
+
+    for (auto _ : state) {
+        for (int i = 0; i < depth; i++) {
+            send_buf.AppendSendData(neighbor, 0, addr, packet.data(), size);
+        }
+        int index;
+        while (send_buf.GetSendData(neighbor, &index) == 1) {
+            benchmark::DoNotOptimize(pool.Data(index));
+            pool.Free(index);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * depth);
+}
+BENCHMARK(BM_SendBufChurn)->Args({1, 64})->Args({16, 64})->Args({16, 1500});
+
+/**
+ * @brief Append to a full queue, dropping its oldest packet each time
+ * @param state Benchmark state, range(0) is the packet size
+ */
+static void BM_SendBufOverflow(benchmark::State& state) {
+    int size = static_cast<int>(state.range(0));
+    PacketPool pool(4096);
+    SendBuf send_buf(&pool);
+    send_buf.SetLimits(16, 16 * PacketPool::BUF_SIZE);
+    IP2MACManager manager;
+    in_addr_t addr = inet_addr("10.0.0.1");
+    IP2MAC* neighbor = manager.GetIp2Mac(0, addr, nullptr);
+    std::vector<unsigned char> packet(size, 0x5a);
+
+    for (int i = 0; i < 16; i++) {
+        send_buf.AppendSendData(neighbor, 0, addr, packet.data(), size);
+    }
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(send_buf.AppendSendData(neighbor, 0, addr, packet.data(), size));
+    }
+    state.SetItemsProcessed(state.iterations());
+
+    send_buf.FreeSendData(neighbor);
+}
+BENCHMARK(BM_SendBufOverflow)->Arg(64)->Arg(1500);
@@ -0,0 +1,207 @@
+/**
+ * @file arp_resolver.cpp
+ * @brief Implementation of the neighbor resolution state machine
+ */
+
+#include "arp_resolver.hpp"
+#include "netutil.hpp"
+#include "timer_wheel.hpp"
+
+// Delay before a request postponed by the rate limit is retried
+static const uint64_t THROTTLE_RETRY_MS = 100;
+
+/**
+ * @brief Constructor
+ * @param manager Neighbor table
+ * @param send_buffer Pending packet queues
+ * @param interfaces Interfaces requests are sent on
+ */
+ArpResolver::ArpResolver(IP2MACManager* manager, SendBuf* send_buffer,
+                         const std::vector<InterfaceInfo>* interfaces)
+    : manager(manager), send_buffer(send_buffer), interfaces(interfaces),
+      throttled(0), failed_packets(0), requests(0) {
+    Configure(1000, 3, 30000, 100, 10);
+}
+
+/**
+ * @brief Destructor
+ */
+ArpResolver::~ArpResolver() {
+}
+
+/**
+ * @brief Set the protocol parameters
+ * @param retrans_ms Time between requests
+ * @param max_probes Requests sent before resolution fails
+ * @param reachable_ms Time a confirmed address stays REACHABLE
+ * @param rate Global request rate limit in requests per second
+ * @param burst Requests that may be sent back to back
+ */
+void ArpResolver::Configure(uint64_t retrans_ms, int max_probes, uint64_t reachable_ms, int rate, int burst) {
+    this->retrans_ms = retrans_ms > 0 ? retrans_ms : 1;
+    this->max_probes = max_probes > 0 ? max_probes : 1;
+    this->reachable_ms = reachable_ms > 0 ? reachable_ms : 1;
+    token_rate = (rate > 0 ? rate : 1) / 1000.0;
+    token_burst = burst > 0 ? burst : 1;
+    tokens = token_burst;
+    token_time = TimerWheel::NowMs();
+}
+
+/**
+ * @brief Resolve a neighbor for a packet that missed the lock-free lookup
+ * @param ip2mac Neighbor
+ * @param data Frame, queued if the neighbor is not resolved
+ * @param size Frame length
+ * @param evicted Number of queued frames dropped to make room for this one (output)
+ * @return 1 if hw_addr may be used now, 0 if the frame was queued, -1 if it was dropped
+ */
+int ArpResolver::Resolve(IP2MAC* ip2mac, unsigned char* data, int size, int* evicted) {
+    *evicted = 0;
+    switch (ip2mac->state) {
+    case NEIGH_REACHABLE:
+    case NEIGH_STALE:
+    case NEIGH_PROBE:
+        // Resolved while we were waiting for the lock
+        manager->Touch(ip2mac);
+        return 1;
+    case NEIGH_INCOMPLETE:
+        // A request is already outstanding; just wait for it
+        return send_buffer->AppendSendData(ip2mac, ip2mac->device_number, ip2mac->ip_addr, data, size,
+                                           evicted) < 0 ? -1 : 0;
+    default:
+        break;
+    }
+
+    // Start resolving
+    if (send_buffer->AppendSendData(ip2mac, ip2mac->device_number, ip2mac->ip_addr, data, size, evicted) < 0) {
+        return -1;
+    }
+    ip2mac->probes = 0;
+    manager->SetState(ip2mac, NEIGH_INCOMPLETE);
+    Solicit(ip2mac, TimerWheel::NowMs(), false);
+    return 0;
+}
+
+/**
+ * @brief Note that the neighbor's address has just been confirmed by ARP
+ * @param ip2mac Neighbor, already NEIGH_REACHABLE
+ * @return true if packets are queued for the neighbor
+ */
+bool ArpResolver::Confirm(IP2MAC* ip2mac) {
+    ip2mac->probes = 0;
+    manager->ScheduleTimer(ip2mac, TimerWheel::NowMs() + reachable_ms);
+    return ip2mac->send_data.data_num > 0;
+}
+
+/**
+ * @brief Run the neighbors' expired timers
+ * @param now_ms Current TimerWheel::NowMs() time
+ * @param unreachable Receives the pool buffers of packets whose neighbor failed,
+ *                    to be answered and freed by the caller; nullptr frees them
+ * @return Number of timers run
+ */
+int ArpResolver::RunTimers(uint64_t now_ms, std::vector<int>* unreachable) {
+    expired.clear();
+    manager->ExpireTimers(now_ms, &expired);
+
+    for (IP2MAC* ip2mac : expired) {
+        // Used since the last timer? This is the LRU bit that Lookup() sets;
+        // clearing it here only makes eviction treat the entry as idle too
+        bool used = manager->ClearReferenced(ip2mac);
+
+        switch (ip2mac->state) {
+        case NEIGH_INCOMPLETE:
+            if (ip2mac->probes >= max_probes) {
+                Fail(ip2mac, unreachable);
+            } else {
+                Solicit(ip2mac, now_ms, false);
+            }
+            break;
+        case NEIGH_REACHABLE:
+        case NEIGH_STALE:
+            if (used) {
+                // Still in use: confirm the address without interrupting traffic
+                ip2mac->probes = 0;
+                manager->SetState(ip2mac, NEIGH_PROBE);
+                Solicit(ip2mac, now_ms, true);
+            } else {
+                manager->SetState(ip2mac, NEIGH_STALE);
+                manager->ScheduleTimer(ip2mac, now_ms + reachable_ms);
+            }
+            break;
+        case NEIGH_PROBE:
+            if (ip2mac->probes >= max_probes) {
+                Fail(ip2mac, unreachable);
+            } else {
+                Solicit(ip2mac, now_ms, true);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    return static_cast<int>(expired.size());
+}
+
+/**
+ * @brief Send a request and arm the retransmit timer
+ * @param ip2mac Neighbor
+ * @param now_ms Current time
+ * @param unicast Probe the cached address instead of broadcasting
+ */
+void ArpResolver::Solicit(IP2MAC* ip2mac, uint64_t now_ms, bool unicast) {
+    if (!TakeToken(now_ms)) {
+        // Postponed without counting as a probe
+        throttled.fetch_add(1, std::memory_order_relaxed);
+        manager->ScheduleTimer(ip2mac, now_ms + THROTTLE_RETRY_MS);
+        return;
+    }
+
+    const InterfaceInfo& info = (*interfaces)[ip2mac->device_number];
+    NetworkUtil::SendArpRequest(info.socket_descriptor, ip2mac->ip_addr,
+                                unicast ? ip2mac->hw_addr : nullptr,
+                                info.ip_addr.s_addr, const_cast<u_char*>(info.hw_addr));
+    requests.fetch_add(1, std::memory_order_relaxed);
+    ip2mac->probes++;
+    manager->ScheduleTimer(ip2mac, now_ms + retrans_ms);
+}
+
+/**
+ * @brief Give up resolving a neighbor
+ * @param ip2mac Neighbor
+ * @param unreachable Receives the queued pool buffers, nullptr to free them
+ */
+void ArpResolver::Fail(IP2MAC* ip2mac, std::vector<int>* unreachable) {
+    failed_packets.fetch_add(ip2mac->send_data.data_num, std::memory_order_relaxed);
+    if (unreachable != nullptr) {
+        int index;
+        while (send_buffer->GetSendData(ip2mac, &index) == 1) {
+            unreachable->push_back(index);
+        }
+    } else {
+        send_buffer->FreeSendData(ip2mac);
+    }
+    manager->SetState(ip2mac, NEIGH_FAILED);
+}
+
+/**
+ * @brief Take a token from the rate limit bucket
+ * @param now_ms Current time
+ * @return true if a request may be sent
+ */
+bool ArpResolver::TakeToken(uint64_t now_ms) {
+    if (now_ms > token_time) {
+        tokens += (now_ms - token_time) * token_rate;
+        if (tokens > token_burst) {
+            tokens = token_burst;
+        }
+        token_time = now_ms;
+    }
+
+    if (tokens < 1.0) {
+        return false;
+    }
+    tokens -= 1.0;
+    return true;
+}
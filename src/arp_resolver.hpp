@@ -0,0 +1,141 @@
+/**
+ * @file arp_resolver.hpp
+ * @brief Header file for the neighbor resolution state machine
+ */
+
+#ifndef ARP_RESOLVER_HPP
+#define ARP_RESOLVER_HPP
+
+#include <netinet/in.h>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+#include "base.hpp"
+#include "ip2mac.hpp"
+#include "send_buf.hpp"
+
+/**
+ * @brief Neighbor resolution (ARP) state machine
+ *
+ *   NONE/FAILED --packet--> INCOMPLETE --ARP--> REACHABLE --timeout--> STALE
+ *   INCOMPLETE --no answer after max_probes--> FAILED (queue dropped)
+ *   REACHABLE/STALE --used at timeout--> PROBE --ARP--> REACHABLE
+ *   PROBE --no answer after max_probes--> FAILED
+ *
+ * Packets to an INCOMPLETE neighbor only join its queue; requests are sent
+ * by the state machine, so a burst produces one request per retransmit
+ * interval. Every request, broadcast or unicast, also needs a token from a
+ * global bucket; without one it is postponed.
+ *
+ * All methods must be called with the neighbor lock held; the counters may
+ * be read at any time.
+ */
+class ArpResolver {
+public:
+    /**
+     * @brief Constructor
+     * @param manager Neighbor table
+     * @param send_buffer Pending packet queues
+     * @param interfaces Interfaces requests are sent on
+     */
+    ArpResolver(IP2MACManager* manager, SendBuf* send_buffer, const std::vector<InterfaceInfo>* interfaces);
+
+    /**
+     * @brief Destructor
+     */
+    ~ArpResolver();
+
+    /**
+     * @brief Set the protocol parameters
+     * @param retrans_ms Time between requests
+     * @param max_probes Requests sent before resolution fails
+     * @param reachable_ms Time a confirmed address stays REACHABLE
+     * @param rate Global request rate limit in requests per second
+     * @param burst Requests that may be sent back to back
+     */
+    void Configure(uint64_t retrans_ms, int max_probes, uint64_t reachable_ms, int rate, int burst);
+
+    /**
+     * @brief Resolve a neighbor for a packet that missed the lock-free lookup
+     * @param ip2mac Neighbor
+     * @param data Frame, queued if the neighbor is not resolved
+     * @param size Frame length
+     * @param evicted Number of queued frames dropped to make room for this one (output)
+     * @return 1 if hw_addr may be used now, 0 if the frame was queued, -1 if it was dropped
+     */
+    int Resolve(IP2MAC* ip2mac, unsigned char* data, int size, int* evicted);
+
+    /**
+     * @brief Note that the neighbor's address has just been confirmed by ARP
+     * @param ip2mac Neighbor, already NEIGH_REACHABLE
+     * @return true if packets are queued for the neighbor
+     */
+    bool Confirm(IP2MAC* ip2mac);
+
+    /**
+     * @brief Run the neighbors' expired timers
+     * @param now_ms Current TimerWheel::NowMs() time
+     * @param unreachable Receives the pool buffers of packets whose neighbor failed,
+     *                    to be answered and freed by the caller; nullptr frees them
+     * @return Number of timers run
+     */
+    int RunTimers(uint64_t now_ms, std::vector<int>* unreachable = nullptr);
+
+    /**
+     * @brief Get the number of requests postponed by the rate limit
+     * @return Number of postponed requests
+     */
+    unsigned long Throttled() const { return throttled.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Get the number of queued packets dropped because resolution failed
+     * @return Number of dropped packets
+     */
+    unsigned long FailedPackets() const { return failed_packets.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Get the number of requests sent
+     * @return Number of requests
+     */
+    unsigned long Requests() const { return requests.load(std::memory_order_relaxed); }
+
+private:
+    IP2MACManager* manager;                           // Neighbor table
+    SendBuf* send_buffer;                             // Pending packet queues
+    const std::vector<InterfaceInfo>* interfaces;     // Interfaces requests are sent on
+    uint64_t retrans_ms;                              // Time between requests
+    int max_probes;                                   // Requests before resolution fails
+    uint64_t reachable_ms;                            // Time a confirmed address stays REACHABLE
+    double tokens;                                    // Requests that may be sent now
+    double token_rate;                                // Tokens added per millisecond
+    double token_burst;                               // Bucket size
+    uint64_t token_time;                              // Last refill, NowMs() time
+    std::atomic<unsigned long> throttled;             // Requests postponed by the rate limit
+    std::atomic<unsigned long> failed_packets;        // Queued packets dropped by Fail()
+    std::atomic<unsigned long> requests;              // Requests sent
+    std::vector<IP2MAC*> expired;                     // Scratch list for RunTimers()
+
+    /**
+     * @brief Send a request and arm the retransmit timer
+     * @param ip2mac Neighbor
+     * @param now_ms Current time
+     * @param unicast Probe the cached address instead of broadcasting
+     */
+    void Solicit(IP2MAC* ip2mac, uint64_t now_ms, bool unicast);
+
+    /**
+     * @brief Give up resolving a neighbor
+     * @param ip2mac Neighbor
+     * @param unreachable Receives the queued pool buffers, nullptr to free them
+     */
+    void Fail(IP2MAC* ip2mac, std::vector<int>* unreachable);
+
+    /**
+     * @brief Take a token from the rate limit bucket
+     * @param now_ms Current time
+     * @return true if a request may be sent
+     */
+    bool TakeToken(uint64_t now_ms);
+};
+
+#endif // ARP_RESOLVER_HPP
@@ -0,0 +1,218 @@
+/**
+ * @file async_log.cpp
+ * @brief Implementation of the asynchronous binary logger
+ */
+
+#include "async_log.hpp"
+#include <cstdio>
+#include <ctime>
+#include <unistd.h>
+
+static const useconds_t DRAIN_INTERVAL_US = 5000;   // Drain thread sleep when every ring is empty
+
+std::atomic<bool> AsyncLog::enabled(true);
+std::atomic<bool> AsyncLog::running(false);
+std::thread AsyncLog::drain_thread;
+std::mutex AsyncLog::logs_mutex;
+std::vector<std::unique_ptr<AsyncLog::ThreadLog>> AsyncLog::logs;
+
+/**
+ * @brief Start the drain thread
+ */
+void AsyncLog::Start() {
+    if (running.exchange(true)) {
+        return;
+    }
+    drain_thread = std::thread(DrainLoop);
+}
+
+/**
+ * @brief Stop the drain thread after writing every buffered message
+ */
+void AsyncLog::Stop() {
+    if (running.exchange(false) && drain_thread.joinable()) {
+        drain_thread.join();
+    }
+    Drain();
+}
+
+/**
+ * @brief Write the buffered messages of every thread
+ * @return Number of messages written
+ */
+size_t AsyncLog::Drain() {
+    std::lock_guard<std::mutex> lock(logs_mutex);
+    size_t written = 0;
+
+    for (auto& log : logs) {
+        size_t n = log->ring.Available();
+        for (size_t i = 0; i < n; i++) {
+            Format(*log->ring.ConsumerSlot(i));
+        }
+        log->ring.ConsumerRelease(n);
+        written += n;
+
+        unsigned long dropped = log->dropped.exchange(0, std::memory_order_relaxed);
+        if (dropped > 0) {
+            fprintf(stderr, "(%lu log messages dropped, ring full)\n", dropped);
+        }
+    }
+
+    if (written > 0) {
+        fflush(stderr);
+    }
+    return written;
+}
+
+/**
+ * @brief Get the calling thread's ring, creating it on first use
+ * @return Ring
+ */
+AsyncLog::ThreadLog* AsyncLog::Local() {
+    // Rings stay registered after their thread exits, so that nothing it
+    // logged is lost
+    static thread_local ThreadLog* local = nullptr;
+    if (local == nullptr) {
+        std::unique_ptr<ThreadLog> log(new ThreadLog());
+        local = log.get();
+        std::lock_guard<std::mutex> lock(logs_mutex);
+        logs.push_back(std::move(log));
+    }
+    return local;
+}
+
+/**
+ * @brief Drain thread body
+ */
+void AsyncLog::DrainLoop() {
+    while (running.load(std::memory_order_relaxed)) {
+        if (Drain() == 0) {
+            usleep(DRAIN_INTERVAL_US);
+        }
+    }
+}
+
+/**
+ * @brief Format and write one message
+ * @param record Message
+ *
+ * Each conversion of the format is printed on its own with the recorded
+ * argument. Length modifiers are replaced to match the 64-bit storage.
+ */
+void AsyncLog::Format(const LogRecord& record) {
+    char line[512];
+    size_t pos = 0;
+    int arg = 0;
+
+    auto append = [&](const char* text, size_t len) {
+        if (pos + len >= sizeof(line)) {
+            len = sizeof(line) - 1 - pos;
+        }
+        memcpy(line + pos, text, len);
+        pos += len;
+    };
+
+    for (const char* p = record.fmt; *p != '\0';) {
+        if (*p != '%') {
+            const char* start = p;
+            while (*p != '\0' && *p != '%') {
+                p++;
+            }
+            append(start, p - start);
+            continue;
+        }
+        if (p[1] == '%') {
+            append("%", 1);
+            p += 2;
+            continue;
+        }
+
+        // Copy flags, width and precision; drop the length modifiers
+        char spec[32];
+        size_t spec_len = 0;
+        spec[spec_len++] = *p++;
+        while (*p != '\0' && strchr("-+ #0123456789.", *p) != nullptr && spec_len < sizeof(spec) - 4) {
+            spec[spec_len++] = *p++;
+        }
+        while (*p != '\0' && strchr("hljztL", *p) != nullptr) {
+            p++;
+        }
+        char conv = *p;
+        if (conv == '\0') {
+            break;
+        }
+        p++;
+
+        char text[128];
+        int n = 0;
+        if (arg >= record.argc) {
+            n = snprintf(text, sizeof(text), "<?>");
+        } else {
+            uint64_t value = record.args[arg];
+            LogRecord::ArgKind kind = record.kinds[arg];
+            arg++;
+            if (strchr("diouxXc", conv) != nullptr) {
+                if (conv != 'c') {
+                    spec[spec_len++] = 'l';
+                    spec[spec_len++] = 'l';
+                }
+                spec[spec_len++] = conv;
+                spec[spec_len] = '\0';
+                if (conv == 'c') {
+                    n = snprintf(text, sizeof(text), spec, static_cast<int>(value));
+                } else if (conv == 'd' || conv == 'i') {
+                    n = snprintf(text, sizeof(text), spec, static_cast<long long>(value));
+                } else {
+                    n = snprintf(text, sizeof(text), spec, static_cast<unsigned long long>(value));
+                }
+            } else if (strchr("eEfFgGaA", conv) != nullptr) {
+                double d;
+                memcpy(&d, &value, sizeof(d));
+                spec[spec_len++] = conv;
+                spec[spec_len] = '\0';
+                n = snprintf(text, sizeof(text), spec, d);
+            } else if (conv == 's' && kind == LogRecord::ARG_STRING) {
+                spec[spec_len++] = 's';
+                spec[spec_len] = '\0';
+                n = snprintf(text, sizeof(text), spec, record.strings + value);
+            } else if (conv == 'p') {
+                spec[spec_len++] = 'p';
+                spec[spec_len] = '\0';
+                n = snprintf(text, sizeof(text), spec, reinterpret_cast<void*>(static_cast<uintptr_t>(value)));
+            } else {
+                n = snprintf(text, sizeof(text), "<?>");
+            }
+        }
+        if (n > 0) {
+            append(text, static_cast<size_t>(n) < sizeof(text) ? n : sizeof(text) - 1);
+        }
+    }
+
+    line[pos] = '\0';
+    fputs(line, stderr);
+}
+
+/**
+ * @brief Check whether a message may be logged now
+ * @param skipped Messages suppressed since the last allowed one (output)
+ * @return true if the message may be logged
+ */
+bool LogLimiter::Allow(unsigned long* skipped) {
+    // The coarse clock is read from the vDSO without a syscall
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    uint64_t now = static_cast<uint64_t>(ts.tv_sec);
+
+    if (now != window) {
+        window = now;
+        count = 0;
+    }
+    if (count >= LOG_LIMIT_PER_SEC) {
+        suppressed++;
+        return false;
+    }
+    count++;
+    *skipped = suppressed;
+    suppressed = 0;
+    return true;
+}
@@ -0,0 +1,255 @@
+/**
+ * @file async_log.hpp
+ * @brief Header file for the asynchronous binary logger
+ */
+
+#ifndef ASYNC_LOG_HPP
+#define ASYNC_LOG_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include "spsc_ring.hpp"
+
+// Log levels
+#define LOG_LEVEL_ERROR 0
+#define LOG_LEVEL_WARN 1
+#define LOG_LEVEL_INFO 2
+#define LOG_LEVEL_DEBUG 3
+
+// Highest level compiled in; calls above it expand to nothing, arguments
+// included (make LOG_LEVEL=3 for per-packet debug messages)
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+#define LOG_MAX_ARGS 6          // Arguments per message
+#define LOG_STRING_BYTES 64     // Bytes for the %s arguments of one message
+#define LOG_RING_SIZE 4096      // Messages buffered per thread
+#define LOG_LIMIT_PER_SEC 10    // Messages per second of one rate-limited call site and thread
+
+/**
+ * @brief Log message in binary form, formatted by the drain thread
+ */
+class LogRecord {
+public:
+    enum ArgKind : uint8_t { ARG_INT, ARG_UINT, ARG_DOUBLE, ARG_STRING, ARG_POINTER };
+
+    const char* fmt;                     // Format string literal
+    uint8_t argc;                        // Number of arguments
+    uint8_t string_used;                 // Bytes of strings used
+    ArgKind kinds[LOG_MAX_ARGS];         // Kind of each argument
+    uint64_t args[LOG_MAX_ARGS];         // Arguments, or offsets into strings for ARG_STRING
+    char strings[LOG_STRING_BYTES];      // Copies of the string arguments
+};
+
+/**
+ * @brief Logger with one lock-free ring per thread and a drain thread
+ *
+ * Write() only stores the format string pointer and the raw argument
+ * values; formatting and the write to stderr happen on the drain thread.
+ * A message that finds its ring full is dropped and counted rather than
+ * blocking. Strings are copied (truncated to LOG_STRING_BYTES in total), so
+ * temporaries may be logged. The format must be a string literal.
+ */
+class AsyncLog {
+public:
+    /**
+     * @brief Enable or disable logging at runtime
+     * @param on true to record messages
+     */
+    static void SetEnabled(bool on) { enabled.store(on, std::memory_order_relaxed); }
+
+    /**
+     * @brief Start the drain thread
+     */
+    static void Start();
+
+    /**
+     * @brief Stop the drain thread after writing every buffered message
+     */
+    static void Stop();
+
+    /**
+     * @brief Write the buffered messages of every thread
+     * @return Number of messages written
+     */
+    static size_t Drain();
+
+    /**
+     * @brief Record a message
+     * @param fmt printf format string literal
+     * @param args Arguments (integers, floating point, strings, pointers)
+     */
+    template <typename... Args>
+    static void Write(const char* fmt, Args... args) {
+        static_assert(sizeof...(Args) <= LOG_MAX_ARGS, "too many log arguments");
+        if (!enabled.load(std::memory_order_relaxed)) {
+            return;
+        }
+
+        ThreadLog* log = Local();
+        LogRecord* record = log->ring.ProducerSlot();
+        if (record == nullptr) {
+            log->dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        record->fmt = fmt;
+        record->argc = 0;
+        record->string_used = 0;
+        int expand[] = {0, (Put(record, args), 0)...};
+        (void)expand;
+        log->ring.ProducerCommit();
+    }
+
+private:
+    /**
+     * @brief Ring of one thread
+     */
+    class ThreadLog {
+    public:
+        SpscRing<LogRecord> ring;              // Messages of the thread
+        std::atomic<unsigned long> dropped;    // Messages lost to a full ring
+
+        ThreadLog() : ring(LOG_RING_SIZE), dropped(0) {}
+    };
+
+    static std::atomic<bool> enabled;                        // Messages are recorded
+    static std::atomic<bool> running;                        // Drain thread keeps running
+    static std::thread drain_thread;                         // Drain thread
+    static std::mutex logs_mutex;                            // Guards logs
+    static std::vector<std::unique_ptr<ThreadLog>> logs;     // Rings of every thread that logged
+
+    /**
+     * @brief Get the calling thread's ring, creating it on first use
+     * @return Ring
+     */
+    static ThreadLog* Local();
+
+    /**
+     * @brief Drain thread body
+     */
+    static void DrainLoop();
+
+    /**
+     * @brief Format and write one message
+     * @param record Message
+     */
+    static void Format(const LogRecord& record);
+
+    template <typename T>
+    static typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type
+    Put(LogRecord* record, T value) {
+        if (std::is_signed<T>::value) {
+            record->kinds[record->argc] = LogRecord::ARG_INT;
+            record->args[record->argc++] = static_cast<uint64_t>(static_cast<int64_t>(value));
+        } else {
+            record->kinds[record->argc] = LogRecord::ARG_UINT;
+            record->args[record->argc++] = static_cast<uint64_t>(value);
+        }
+    }
+
+    template <typename T>
+    static typename std::enable_if<std::is_floating_point<T>::value>::type
+    Put(LogRecord* record, T value) {
+        double d = value;
+        record->kinds[record->argc] = LogRecord::ARG_DOUBLE;
+        memcpy(&record->args[record->argc++], &d, sizeof(d));
+    }
+
+    static void Put(LogRecord* record, const char* value) {
+        // string_used never passes the last byte, which therefore always
+        // has room for a terminator
+        size_t used = record->string_used;
+        size_t len = value != nullptr ? strlen(value) : 0;
+        if (len > LOG_STRING_BYTES - 1 - used) {
+            len = LOG_STRING_BYTES - 1 - used;
+        }
+        memcpy(record->strings + used, value, len);
+        record->strings[used + len] = '\0';
+        record->kinds[record->argc] = LogRecord::ARG_STRING;
+        record->args[record->argc++] = used;
+        used += len + 1;
+        record->string_used = static_cast<uint8_t>(used < LOG_STRING_BYTES - 1 ? used : LOG_STRING_BYTES - 1);
+    }
+
+    static void Put(LogRecord* record, char* value) { Put(record, static_cast<const char*>(value)); }
+
+    static void Put(LogRecord* record, const void* value) {
+        record->kinds[record->argc] = LogRecord::ARG_POINTER;
+        record->args[record->argc++] = reinterpret_cast<uintptr_t>(value);
+    }
+};
+
+/**
+ * @brief Per call site rate limit for log messages
+ */
+class LogLimiter {
+public:
+    LogLimiter() : window(0), count(0), suppressed(0) {}
+
+    /**
+     * @brief Check whether a message may be logged now
+     * @param skipped Messages suppressed since the last allowed one (output)
+     * @return true if the message may be logged
+     */
+    bool Allow(unsigned long* skipped);
+
+private:
+    uint64_t window;            // Second the count applies to
+    unsigned int count;         // Messages logged in the window
+    unsigned long suppressed;   // Messages suppressed since the last one logged
+};
+
+#define LOG_WRITE_LIMITED_(...)                                                           \
+    do {                                                                                  \
+        static thread_local LogLimiter log_limiter_;                                      \
+        unsigned long log_skipped_;                                                       \
+        if (log_limiter_.Allow(&log_skipped_)) {                                          \
+            if (log_skipped_ > 0) {                                                       \
+                AsyncLog::Write("(%lu similar messages suppressed)\n", log_skipped_);     \
+            }                                                                             \
+            AsyncLog::Write(__VA_ARGS__);                                                 \
+        }                                                                                 \
+    } while (0)
+
+// Never defined: a disabled call is only an unevaluated operand of sizeof,
+// so its arguments count as used but no code is generated
+template <typename... Args>
+int LogDiscard(const char* fmt, const Args&... args);
+#define LOG_NOTHING_(...) ((void)sizeof(LogDiscard(__VA_ARGS__)))
+
+#define LOG_ERROR(...) AsyncLog::Write(__VA_ARGS__)
+#define LOG_ERROR_LIMITED(...) LOG_WRITE_LIMITED_(__VA_ARGS__)
+
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(...) AsyncLog::Write(__VA_ARGS__)
+#define LOG_WARN_LIMITED(...) LOG_WRITE_LIMITED_(__VA_ARGS__)
+#else
+#define LOG_WARN(...) LOG_NOTHING_(__VA_ARGS__)
+#define LOG_WARN_LIMITED(...) LOG_NOTHING_(__VA_ARGS__)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(...) AsyncLog::Write(__VA_ARGS__)
+#define LOG_INFO_LIMITED(...) LOG_WRITE_LIMITED_(__VA_ARGS__)
+#else
+#define LOG_INFO(...) LOG_NOTHING_(__VA_ARGS__)
+#define LOG_INFO_LIMITED(...) LOG_NOTHING_(__VA_ARGS__)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) AsyncLog::Write(__VA_ARGS__)
+#define LOG_DEBUG_LIMITED(...) LOG_WRITE_LIMITED_(__VA_ARGS__)
+#else
+#define LOG_DEBUG(...) LOG_NOTHING_(__VA_ARGS__)
+#define LOG_DEBUG_LIMITED(...) LOG_NOTHING_(__VA_ARGS__)
+#endif
+
+#endif // ASYNC_LOG_HPP
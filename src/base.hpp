@@ -12,6 +12,9 @@
 #include <vector>
 #include <memory>
 #include <mutex>
+#include <atomic>
+#include <cstdint>
+#include "packet_pool.hpp"
 
 /**
  * @brief Network interface information
@@ -29,44 +32,53 @@ public:
 #define FLAG_OK 1
 #define FLAG_NG -1
 
-/**
- * @brief Class to hold data buffer
- */
-class DataBuf {
-public:
-    DataBuf* next;           // Pointer to the next data
-    DataBuf* before;         // Pointer to the previous data
-    time_t time;             // Creation time
-    int size;                // Data size
-    unsigned char* data;     // Data
-
-    DataBuf();
-    ~DataBuf();
-};
+#define SEND_DATA_QUEUE_SIZE 64    // Maximum packets queued per neighbor while it is resolved
 
 /**
  * @brief Class to manage send data
+ *
+ * A bounded ring of PacketPool buffers. Queued buffers are owned by the
+ * ring and go back to their pool when the ring is cleared or destroyed,
+ * so a ring is neither copied nor moved. Rings are only touched under the
+ * neighbor table's lock.
  */
 class SendData {
 public:
-    DataBuf* top;                   // Pointer to the first data
-    DataBuf* bottom;                // Pointer to the last data
-    unsigned long data_num;         // Number of data entries
-    unsigned long in_bucket_size;   // Total data size
+    PacketPool* pool;                        // Pool of the queued buffers, nullptr if none yet
+    uint32_t slots[SEND_DATA_QUEUE_SIZE];    // Queued buffer indexes
+    unsigned int head;                       // Slot of the oldest buffer
+    unsigned long data_num;                  // Number of data entries
+    unsigned long in_bucket_size;            // Total data size
 
     SendData();
-    SendData(const SendData& other);
-    SendData& operator=(const SendData& other);
-    SendData(SendData&& other) noexcept;
-    SendData& operator=(SendData&& other) noexcept;
+    SendData(const SendData&) = delete;
+    SendData& operator=(const SendData&) = delete;
     ~SendData();
 
-private:
-    std::mutex mutex;              // Mutex for thread safety
+    /**
+     * @brief Return every queued buffer to the pool
+     */
+    void Clear();
 };
+#define IP2MAC_KEY_NONE (~0ULL)             // Published key of an entry that is not in use
+#define IP2MAC_L2_SIZE 16                   // Bytes of a published header: Ethernet header, pad, flag
+#define IP2MAC_L2_RESOLVED 15               // Header byte that is non-zero when the header may be used
+
+// Neighbor resolution states (IP2MAC::state)
+#define NEIGH_NONE 0          // Not solicited yet
+#define NEIGH_INCOMPLETE 1    // Broadcast request outstanding, packets queued
+#define NEIGH_REACHABLE 2     // Address confirmed recently
+#define NEIGH_STALE 3         // Address not confirmed recently, still used
+#define NEIGH_PROBE 4         // Unicast request outstanding, address still used
+#define NEIGH_FAILED 5        // Resolution failed, address unusable
 
 /**
  * @brief Class to manage IP to MAC address relation
+ *
+ * This is the cold part of a neighbor, used under the neighbor table's
+ * lock by resolution and by packets that missed the lock-free lookup. What
+ * forwarding reads on every packet, the key and the Ethernet header, is
+ * published separately by IP2MACManager.
  */
 class IP2MAC {
 public:
@@ -74,15 +86,16 @@ public:
     int device_number;           // Device number
     in_addr_t ip_addr;           // IP address
     unsigned char hw_addr[6];    // MAC address
+    int state;                   // Resolution state (NEIGH_*)
+    int probes;                  // Requests sent in the current state
+    int lru_prev;                // Previous (more recently used) entry, -1 if none
+    int lru_next;                // Next (less recently used) entry, -1 if none
     time_t lastTime;             // Last data creation time
     SendData send_data;          // Send data
 
     IP2MAC();
-    IP2MAC(const IP2MAC& other);
-    IP2MAC& operator=(const IP2MAC& other);
-    IP2MAC(IP2MAC&& other) noexcept;
-    IP2MAC& operator=(IP2MAC&& other) noexcept;
-    ~IP2MAC();
+    IP2MAC(const IP2MAC&) = delete;
+    IP2MAC& operator=(const IP2MAC&) = delete;
 };
 
 #endif // BASE_HPP
\ No newline at end of file
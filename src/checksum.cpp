@@ -0,0 +1,285 @@
+/**
+ * @file checksum.cpp
+ * @brief Implementation of Internet checksum kernels
+ */
+
+#include "checksum.hpp"
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Kernels are usable before SelectKernel() runs
+InetChecksum::Kernel InetChecksum::kernel = InetChecksum::Kernel64;
+const char* InetChecksum::kernel_name = "64";
+
+// Vector iterations before the 32-bit lanes are spilled; each iteration adds
+// at most 2 * 0xffff to a lane
+static const size_t LANE_SPILL_INTERVAL = 16384;
+
+/**
+ * @brief Sum the last 0-7 bytes of a buffer
+ * @param data Data
+ * @param len Length of data (less than 8)
+ * @return Unfolded sum
+ */
+static inline uint64_t TailSum(const unsigned char* data, size_t len) {
+    uint64_t sum = 0;
+    if (len >= 4) {
+        uint32_t w;
+        memcpy(&w, data, sizeof(w));
+        sum += w;
+        data += 4;
+        len -= 4;
+    }
+    if (len >= 2) {
+        uint16_t w;
+        memcpy(&w, data, sizeof(w));
+        sum += w;
+        data += 2;
+        len -= 2;
+    }
+    if (len > 0) {
+        // An odd byte is the first byte of a zero-padded word
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        sum += static_cast<uint64_t>(data[0]) << 8;
+#else
+        sum += data[0];
+#endif
+    }
+    return sum;
+}
+
+/**
+ * @brief Compute the checksum of the concatenation of several buffers
+ * @param iov Buffers
+ * @param iovcnt Number of buffers
+ * @return Checksum, ready to be stored in a header
+ */
+uint16_t InetChecksum::Compute(const struct iovec* iov, int iovcnt) {
+    uint64_t sum = 0;
+    bool odd = false;
+
+    for (int i = 0; i < iovcnt; i++) {
+        uint16_t part = Fold(Partial(static_cast<const unsigned char*>(iov[i].iov_base), iov[i].iov_len));
+        // A buffer starting at an odd offset has its bytes swapped within
+        // every word, and so has its sum (RFC 1071, byte order independence)
+        if (odd) {
+            part = static_cast<uint16_t>((part >> 8) | (part << 8));
+        }
+        sum += part;
+        odd ^= (iov[i].iov_len & 1) != 0;
+    }
+
+    return static_cast<uint16_t>(~Fold(sum));
+}
+
+/**
+ * @brief Sum 16 bits at a time (reference implementation)
+ * @param data Data
+ * @param len Length of data
+ * @return Unfolded sum
+ */
+uint64_t InetChecksum::Kernel16(const unsigned char* data, size_t len) {
+    uint64_t sum = 0;
+
+    while (len >= 2) {
+        uint16_t w;
+        memcpy(&w, data, sizeof(w));
+        sum += w;
+        data += 2;
+        len -= 2;
+    }
+
+    return sum + TailSum(data, len);
+}
+
+/**
+ * @brief Sum 64 bits at a time
+ * @param data Data
+ * @param len Length of data
+ * @return Unfolded sum
+ *
+ * Each 64-bit load is split into two 32-bit halves, so the 64-bit
+ * accumulator cannot overflow for any realistic length.
+ */
+uint64_t InetChecksum::Kernel64(const unsigned char* data, size_t len) {
+    uint64_t sum0 = 0;
+    uint64_t sum1 = 0;
+
+    while (len >= 16) {
+        uint64_t w0, w1;
+        memcpy(&w0, data, sizeof(w0));
+        memcpy(&w1, data + 8, sizeof(w1));
+        sum0 += (w0 & 0xffffffff) + (w0 >> 32);
+        sum1 += (w1 & 0xffffffff) + (w1 >> 32);
+        data += 16;
+        len -= 16;
+    }
+    if (len >= 8) {
+        uint64_t w;
+        memcpy(&w, data, sizeof(w));
+        sum0 += (w & 0xffffffff) + (w >> 32);
+        data += 8;
+        len -= 8;
+    }
+
+    return sum0 + sum1 + TailSum(data, len);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/**
+ * @brief Sum 128 bits at a time with SSE2
+ * @param data Data
+ * @param len Length of data
+ * @return Unfolded sum
+ */
+__attribute__((target("sse2")))
+uint64_t InetChecksum::KernelSse2(const unsigned char* data, size_t len) {
+    const __m128i zero = _mm_setzero_si128();
+    uint64_t sum = 0;
+
+    while (len >= 16) {
+        size_t iterations = len / 16;
+        if (iterations > LANE_SPILL_INTERVAL) {
+            iterations = LANE_SPILL_INTERVAL;
+        }
+
+        // Widen the eight 16-bit words to 32-bit lanes and accumulate
+        __m128i acc = zero;
+        for (size_t i = 0; i < iterations; i++) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+            acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(v, zero));
+            acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(v, zero));
+            data += 16;
+        }
+        len -= iterations * 16;
+
+        uint32_t lanes[4];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), acc);
+        sum += static_cast<uint64_t>(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+    }
+
+    return sum + Kernel64(data, len);
+}
+
+/**
+ * @brief Sum 256 bits at a time with AVX2
+ * @param data Data
+ * @param len Length of data
+ * @return Unfolded sum
+ */
+__attribute__((target("avx2")))
+uint64_t InetChecksum::KernelAvx2(const unsigned char* data, size_t len) {
+    const __m256i zero = _mm256_setzero_si256();
+    uint64_t sum = 0;
+
+    while (len >= 32) {
+        size_t iterations = len / 32;
+        if (iterations > LANE_SPILL_INTERVAL) {
+            iterations = LANE_SPILL_INTERVAL;
+        }
+
+        // Unpacking works within 128-bit halves, which does not matter for a sum
+        __m256i acc = zero;
+        for (size_t i = 0; i < iterations; i++) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data));
+            acc = _mm256_add_epi32(acc, _mm256_unpacklo_epi16(v, zero));
+            acc = _mm256_add_epi32(acc, _mm256_unpackhi_epi16(v, zero));
+            data += 32;
+        }
+        len -= iterations * 32;
+
+        uint32_t lanes[8];
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), acc);
+        for (int i = 0; i < 8; i++) {
+            sum += lanes[i];
+        }
+    }
+
+    return sum + Kernel64(data, len);
+}
+#endif
+
+#if defined(__ARM_NEON)
+/**
+ * @brief Sum 128 bits at a time with NEON
+ * @param data Data
+ * @param len Length of data
+ * @return Unfolded sum
+ */
+uint64_t InetChecksum::KernelNeon(const unsigned char* data, size_t len) {
+    uint64_t sum = 0;
+
+    while (len >= 16) {
+        size_t iterations = len / 16;
+        if (iterations > LANE_SPILL_INTERVAL) {
+            iterations = LANE_SPILL_INTERVAL;
+        }
+
+        // Pairwise add the eight 16-bit words into four 32-bit lanes
+        uint32x4_t acc = vdupq_n_u32(0);
+        for (size_t i = 0; i < iterations; i++) {
+            acc = vpadalq_u16(acc, vreinterpretq_u16_u8(vld1q_u8(data)));
+            data += 16;
+        }
+        len -= iterations * 16;
+
+        uint32_t lanes[4];
+        vst1q_u32(lanes, acc);
+        sum += static_cast<uint64_t>(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+    }
+
+    return sum + Kernel64(data, len);
+}
+#endif
+
+/**
+ * @brief Select a kernel by name
+ * @param name "16", "64", "sse2", "avx2", "neon", or "auto" for the fastest supported one
+ * @return Success or failure code (-1 if unknown or unsupported by the CPU)
+ */
+int InetChecksum::SelectKernel(const char* name) {
+    bool automatic = strcmp(name, "auto") == 0;
+
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if ((automatic || strcmp(name, "avx2") == 0) && __builtin_cpu_supports("avx2")) {
+        kernel = KernelAvx2;
+        kernel_name = "avx2";
+        return 0;
+    }
+    if ((automatic || strcmp(name, "sse2") == 0) && __builtin_cpu_supports("sse2")) {
+        kernel = KernelSse2;
+        kernel_name = "sse2";
+        return 0;
+    }
+#endif
+#if defined(__ARM_NEON)
+    if (automatic || strcmp(name, "neon") == 0) {
+        kernel = KernelNeon;
+        kernel_name = "neon";
+        return 0;
+    }
+#endif
+
+    if (automatic || strcmp(name, "64") == 0) {
+        kernel = Kernel64;
+        kernel_name = "64";
+        return 0;
+    }
+    if (strcmp(name, "16") == 0) {
+        kernel = Kernel16;
+        kernel_name = "16";
+        return 0;
+    }
+
+    return -1;
+}
+
+// Pick the fastest kernel once at startup
+static const int kernel_selected = InetChecksum::SelectKernel("auto");
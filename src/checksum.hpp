@@ -0,0 +1,138 @@
+/**
+ * @file checksum.hpp
+ * @brief Header file for Internet checksum kernels
+ */
+
+#ifndef CHECKSUM_HPP
+#define CHECKSUM_HPP
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief Internet checksum (RFC 1071) with CPU-specific kernels
+ *
+ * A kernel returns the plain integer sum of a buffer's 16-bit words in host
+ * byte order, which Fold() reduces with end-around carry. Wider kernels sum
+ * wider words; the folded result is the same. The fastest kernel the CPU
+ * supports is selected once at startup.
+ */
+class InetChecksum {
+public:
+    /**
+     * @brief Kernel computing the unfolded sum of a buffer
+     * @param data Data
+     * @param len Length of data
+     * @return Unfolded sum
+     */
+    typedef uint64_t (*Kernel)(const unsigned char* data, size_t len);
+
+    /**
+     * @brief Sum a buffer with the selected kernel
+     * @param data Data
+     * @param len Length of data
+     * @return Unfolded sum, to be passed to Fold()
+     */
+    static uint64_t Partial(const unsigned char* data, size_t len) {
+        return kernel(data, len);
+    }
+
+    /**
+     * @brief Fold an unfolded sum into 16 bits
+     * @param sum Unfolded sum
+     * @return Ones' complement sum (not inverted)
+     */
+    static uint16_t Fold(uint64_t sum) {
+        sum = (sum & 0xffffffff) + (sum >> 32);
+        sum = (sum & 0xffffffff) + (sum >> 32);
+        sum = (sum & 0xffff) + (sum >> 16);
+        sum = (sum & 0xffff) + (sum >> 16);
+        return static_cast<uint16_t>(sum);
+    }
+
+    /**
+     * @brief Compute the checksum of one buffer
+     * @param data Data
+     * @param len Length of data
+     * @return Checksum, ready to be stored in a header
+     */
+    static uint16_t Compute(const unsigned char* data, size_t len) {
+        return static_cast<uint16_t>(~Fold(Partial(data, len)));
+    }
+
+    /**
+     * @brief Compute the checksum of the concatenation of several buffers
+     * @param iov Buffers
+     * @param iovcnt Number of buffers
+     * @return Checksum, ready to be stored in a header
+     *
+     * Buffers may have odd lengths; later buffers are summed as if they
+     * followed the earlier ones without a gap.
+     */
+    static uint16_t Compute(const struct iovec* iov, int iovcnt);
+
+    /**
+     * @brief Sum 16 bits at a time (reference implementation)
+     * @param data Data
+     * @param len Length of data
+     * @return Unfolded sum
+     */
+    static uint64_t Kernel16(const unsigned char* data, size_t len);
+
+    /**
+     * @brief Sum 64 bits at a time
+     * @param data Data
+     * @param len Length of data
+     * @return Unfolded sum
+     */
+    static uint64_t Kernel64(const unsigned char* data, size_t len);
+
+#if defined(__x86_64__) || defined(__i386__)
+    /**
+     * @brief Sum 128 bits at a time with SSE2
+     * @param data Data
+     * @param len Length of data
+     * @return Unfolded sum
+     */
+    static uint64_t KernelSse2(const unsigned char* data, size_t len);
+
+    /**
+     * @brief Sum 256 bits at a time with AVX2
+     * @param data Data
+     * @param len Length of data
+     * @return Unfolded sum
+     */
+    static uint64_t KernelAvx2(const unsigned char* data, size_t len);
+#endif
+
+#if defined(__ARM_NEON)
+    /**
+     * @brief Sum 128 bits at a time with NEON
+     * @param data Data
+     * @param len Length of data
+     * @return Unfolded sum
+     */
+    static uint64_t KernelNeon(const unsigned char* data, size_t len);
+#endif
+
+    /**
+     * @brief Select a kernel by name
+     * @param name "16", "64", "sse2", "avx2", "neon", or "auto" for the fastest supported one
+     * @return Success or failure code (-1 if unknown or unsupported by the CPU)
+     */
+    static int SelectKernel(const char* name);
+
+    /**
+     * @brief Get the name of the selected kernel
+     * @return Kernel name
+     */
+    static const char* KernelName() { return kernel_name; }
+
+private:
+    static Kernel kernel;              // Selected kernel
+    static const char* kernel_name;    // Name of the selected kernel
+};
+
+#endif // CHECKSUM_HPP
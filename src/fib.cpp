@@ -0,0 +1,275 @@
+/**
+ * @file fib.cpp
+ * @brief Implementation of the longest-prefix-match forwarding table
+ */
+
+#include "fib.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+/**
+ * @brief Get the netmask of a prefix length in host byte order
+ * @param prefix_len Prefix length (0-32)
+ * @return Netmask
+ */
+static uint32_t PrefixMask(int prefix_len) {
+    return prefix_len == 0 ? 0 : ~0U << (32 - prefix_len);
+}
+
+/**
+ * @brief Constructor
+ * @param generation Generation the empty table starts at
+ */
+Fib::Fib(uint32_t generation)
+    : tbl24(TBL24_SIZE, "fib tbl24"), tbl8_groups(0), default_nh(-1), generation(generation) {
+}
+
+/**
+ * @brief Destructor
+ */
+Fib::~Fib() {
+}
+
+/**
+ * @brief Add or replace a route
+ * @param prefix Prefix in network byte order
+ * @param prefix_len Prefix length (0-32)
+ * @param device_number Egress device
+ * @param gateway Gateway in network byte order, 0 if directly connected
+ * @return Success or failure code
+ */
+int Fib::AddRoute(in_addr_t prefix, int prefix_len, int device_number, in_addr_t gateway) {
+    if (tbl24.Data() == nullptr || prefix_len < 0 || prefix_len > 32) {
+        return -1;
+    }
+
+    int nh = InternNextHop(device_number, gateway);
+    if (nh < 0) {
+        return -1;
+    }
+
+    uint32_t addr = ntohl(prefix) & PrefixMask(prefix_len);
+    uint64_t key = (static_cast<uint64_t>(prefix_len) << 32) | addr;
+
+    if (prefix_len == 0) {
+        default_nh = nh;
+        routes[key] = nh;
+        generation.fetch_add(1, std::memory_order_release);
+        return 1;
+    }
+
+    uint32_t value = ENTRY_VALID | (static_cast<uint32_t>(prefix_len) << ENTRY_DEPTH_SHIFT) | nh;
+
+    if (prefix_len <= 24) {
+        FillRange(&tbl24[addr >> 8], static_cast<size_t>(1) << (24 - prefix_len), -1, value);
+    } else {
+        uint32_t idx = addr >> 8;
+        if ((tbl24[idx] & ENTRY_EXTENDED) == 0) {
+            int group = AllocTbl8(tbl24[idx]);
+            if (group < 0) {
+                return -1;
+            }
+            tbl24[idx] = ENTRY_EXTENDED | static_cast<uint32_t>(group);
+        }
+        uint32_t* group_entries = &tbl8[static_cast<size_t>(tbl24[idx] & ENTRY_VALUE_MASK) << 8];
+        FillRange(&group_entries[addr & 0xff], static_cast<size_t>(1) << (32 - prefix_len), -1, value);
+    }
+
+    routes[key] = nh;
+    generation.fetch_add(1, std::memory_order_release);
+    return 1;
+}
+
+/**
+ * @brief Delete a route
+ * @param prefix Prefix in network byte order
+ * @param prefix_len Prefix length (0-32)
+ * @return Success or failure code
+ */
+int Fib::DeleteRoute(in_addr_t prefix, int prefix_len) {
+    if (tbl24.Data() == nullptr || prefix_len < 0 || prefix_len > 32) {
+        return -1;
+    }
+
+    uint32_t addr = ntohl(prefix) & PrefixMask(prefix_len);
+    auto it = routes.find((static_cast<uint64_t>(prefix_len) << 32) | addr);
+    if (it == routes.end()) {
+        return -1;
+    }
+    routes.erase(it);
+
+    if (prefix_len == 0) {
+        default_nh = -1;
+        generation.fetch_add(1, std::memory_order_release);
+        return 1;
+    }
+
+    // Entries owned by the deleted route fall back to the next shorter match
+    uint32_t replacement;
+    FindCovering(addr, prefix_len, &replacement);
+
+    if (prefix_len <= 24) {
+        FillRange(&tbl24[addr >> 8], static_cast<size_t>(1) << (24 - prefix_len), prefix_len, replacement);
+    } else {
+        uint32_t idx = addr >> 8;
+        if ((tbl24[idx] & ENTRY_EXTENDED) != 0) {
+            uint32_t* group_entries = &tbl8[static_cast<size_t>(tbl24[idx] & ENTRY_VALUE_MASK) << 8];
+            FillRange(&group_entries[addr & 0xff], static_cast<size_t>(1) << (32 - prefix_len),
+                      prefix_len, replacement);
+            TryCollapseTbl8(idx);
+        }
+    }
+
+    generation.fetch_add(1, std::memory_order_release);
+    return 1;
+}
+
+/**
+ * @brief Look up a burst of destinations
+ * @param dst Destination addresses in network byte order
+ * @param nh Next hop indexes (output, -1 if there is no route)
+ * @param n Number of destinations
+ *
+ * All first-level loads are issued before any of their results is used, so
+ * the cache misses of a burst overlap instead of being taken one by one.
+ */
+void Fib::LookupBurst(const in_addr_t* dst, int* nh, int n) const {
+    uint32_t entries[64];
+
+    for (int base = 0; base < n; base += 64) {
+        int count = n - base < 64 ? n - base : 64;
+
+        for (int i = 0; i < count; i++) {
+            entries[i] = tbl24[ntohl(dst[base + i]) >> 8];
+        }
+
+        for (int i = 0; i < count; i++) {
+            uint32_t entry = entries[i];
+            if (entry & ENTRY_EXTENDED) {
+                entry = tbl8[((entry & ENTRY_VALUE_MASK) << 8) | (ntohl(dst[base + i]) & 0xff)];
+            }
+            nh[base + i] = (entry & ENTRY_VALID) ? static_cast<int>(entry & ENTRY_VALUE_MASK) : default_nh;
+        }
+    }
+}
+
+/**
+ * @brief Get or create the next hop index for a device and gateway
+ * @param device_number Egress device
+ * @param gateway Gateway in network byte order
+ * @return Next hop index or -1 if the table is full
+ */
+int Fib::InternNextHop(int device_number, in_addr_t gateway) {
+    for (size_t i = 0; i < next_hops.size(); i++) {
+        if (next_hops[i].device_number == device_number && next_hops[i].gateway == gateway) {
+            return static_cast<int>(i);
+        }
+    }
+
+    if (next_hops.size() > ENTRY_VALUE_MASK) {
+        return -1;
+    }
+
+    NextHop hop;
+    hop.device_number = device_number;
+    hop.gateway = gateway;
+    next_hops.push_back(hop);
+
+    return static_cast<int>(next_hops.size() - 1);
+}
+
+/**
+ * @brief Find the route that covers a prefix once it is deleted
+ * @param addr Prefix in host byte order
+ * @param prefix_len Prefix length
+ * @param entry Table entry of the covering route (output, 0 if none)
+ */
+void Fib::FindCovering(uint32_t addr, int prefix_len, uint32_t* entry) const {
+    for (int len = prefix_len - 1; len > 0; len--) {
+        auto it = routes.find((static_cast<uint64_t>(len) << 32) | (addr & PrefixMask(len)));
+        if (it != routes.end()) {
+            *entry = ENTRY_VALID | (static_cast<uint32_t>(len) << ENTRY_DEPTH_SHIFT) | it->second;
+            return;
+        }
+    }
+    *entry = 0;
+}
+
+/**
+ * @brief Write a route into a range of entries
+ * @param entries First entry
+ * @param count Number of entries
+ * @param match_len Overwrite only entries of exactly this depth, or -1 to
+ *                  overwrite every entry that is empty or not deeper than value
+ * @param value New entry value
+ */
+void Fib::FillRange(uint32_t* entries, size_t count, int match_len, uint32_t value) {
+    uint32_t depth = (value & ENTRY_DEPTH_MASK) >> ENTRY_DEPTH_SHIFT;
+
+    for (size_t i = 0; i < count; i++) {
+        uint32_t entry = entries[i];
+
+        if (entry & ENTRY_EXTENDED) {
+            FillRange(&tbl8[static_cast<size_t>(entry & ENTRY_VALUE_MASK) << 8], 256, match_len, value);
+            continue;
+        }
+
+        uint32_t entry_depth = (entry & ENTRY_DEPTH_MASK) >> ENTRY_DEPTH_SHIFT;
+        if (match_len < 0) {
+            if ((entry & ENTRY_VALID) == 0 || entry_depth <= depth) {
+                entries[i] = value;
+            }
+        } else if ((entry & ENTRY_VALID) != 0 && entry_depth == static_cast<uint32_t>(match_len)) {
+            entries[i] = value;
+        }
+    }
+}
+
+/**
+ * @brief Allocate a second-level group initialized from a first-level entry
+ * @param entry First-level entry being expanded
+ * @return Group index or -1 if there are no groups left
+ */
+int Fib::AllocTbl8(uint32_t entry) {
+    uint32_t group;
+    if (!tbl8_free.empty()) {
+        group = tbl8_free.back();
+        tbl8_free.pop_back();
+    } else {
+        if (tbl8_groups == MAX_TBL8_GROUPS) {
+            return -1;
+        }
+        group = static_cast<uint32_t>(tbl8_groups++);
+        tbl8.resize(tbl8_groups << 8);
+    }
+
+    uint32_t* group_entries = &tbl8[static_cast<size_t>(group) << 8];
+    for (int i = 0; i < 256; i++) {
+        group_entries[i] = entry;
+    }
+
+    return static_cast<int>(group);
+}
+
+/**
+ * @brief Collapse a group back into its first-level entry if it holds no long prefix
+ * @param idx First-level index
+ */
+void Fib::TryCollapseTbl8(uint32_t idx) {
+    uint32_t group = tbl24[idx] & ENTRY_VALUE_MASK;
+    const uint32_t* group_entries = &tbl8[static_cast<size_t>(group) << 8];
+
+    uint32_t first = group_entries[0];
+    if ((first & ENTRY_VALID) != 0 && ((first & ENTRY_DEPTH_MASK) >> ENTRY_DEPTH_SHIFT) > 24) {
+        return;
+    }
+    for (int i = 1; i < 256; i++) {
+        if (group_entries[i] != first) {
+            return;
+        }
+    }
+
+    tbl24[idx] = first;
+    tbl8_free.push_back(group);
+}
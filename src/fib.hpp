@@ -0,0 +1,180 @@
+/**
+ * @file fib.hpp
+ * @brief Header file for the longest-prefix-match forwarding table
+ */
+
+#ifndef FIB_HPP
+#define FIB_HPP
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <vector>
+#include "memory_arena.hpp"
+
+/**
+ * @brief Next hop of a route
+ */
+class NextHop {
+public:
+    int device_number;    // Egress device
+    in_addr_t gateway;    // Gateway address, 0 if the destination is directly connected
+};
+
+/**
+ * @brief IPv4 forwarding table using DIR-24-8
+ *
+ * The first level is a flat table with one entry per /24. Prefixes longer
+ * than 24 bits expand their /24 into a 256-entry second-level group, so a
+ * lookup takes one memory access, or two for long prefixes. The default
+ * route is kept outside the tables, which therefore only hold what is
+ * actually routed.
+ *
+ * Tables are modified in place; a Fib must not be changed while other
+ * threads look it up. The router replaces its table whole instead, and
+ * starts the replacement's generation past the old one's.
+ */
+class Fib {
+public:
+    /**
+     * @brief Constructor
+     * @param generation Generation the empty table starts at
+     */
+    explicit Fib(uint32_t generation = 0);
+
+    /**
+     * @brief Destructor
+     */
+    ~Fib();
+
+    Fib(const Fib&) = delete;
+    Fib& operator=(const Fib&) = delete;
+
+    /**
+     * @brief Add or replace a route
+     * @param prefix Prefix in network byte order
+     * @param prefix_len Prefix length (0-32)
+     * @param device_number Egress device
+     * @param gateway Gateway in network byte order, 0 if directly connected
+     * @return Success or failure code
+     */
+    int AddRoute(in_addr_t prefix, int prefix_len, int device_number, in_addr_t gateway);
+
+    /**
+     * @brief Delete a route
+     * @param prefix Prefix in network byte order
+     * @param prefix_len Prefix length (0-32)
+     * @return Success or failure code
+     */
+    int DeleteRoute(in_addr_t prefix, int prefix_len);
+
+    /**
+     * @brief Look up the longest matching route
+     * @param dst Destination address in network byte order
+     * @return Next hop index or -1 if there is no route
+     */
+    int Lookup(in_addr_t dst) const {
+        uint32_t addr = ntohl(dst);
+        uint32_t entry = tbl24[addr >> 8];
+        if (entry & ENTRY_EXTENDED) {
+            entry = tbl8[((entry & ENTRY_VALUE_MASK) << 8) | (addr & 0xff)];
+        }
+        return (entry & ENTRY_VALID) ? static_cast<int>(entry & ENTRY_VALUE_MASK) : default_nh;
+    }
+
+    /**
+     * @brief Look up a burst of destinations
+     * @param dst Destination addresses in network byte order
+     * @param nh Next hop indexes (output, -1 if there is no route)
+     * @param n Number of destinations
+     */
+    void LookupBurst(const in_addr_t* dst, int* nh, int n) const;
+
+    /**
+     * @brief Get a next hop
+     * @param nh Next hop index returned by Lookup()
+     * @return Next hop
+     */
+    const NextHop& GetNextHop(int nh) const { return next_hops[nh]; }
+
+    /**
+     * @brief Get the number of routes
+     * @return Number of routes
+     */
+    size_t RouteCount() const { return routes.size(); }
+
+    /**
+     * @brief Get the number of second-level groups in use
+     * @return Number of groups
+     */
+    size_t Tbl8GroupCount() const { return tbl8_groups - tbl8_free.size(); }
+
+    /**
+     * @brief Get the number of changes made to the table
+     * @return Generation, incremented by every successful AddRoute()/DeleteRoute()
+     */
+    uint32_t Generation() const { return generation.load(std::memory_order_acquire); }
+
+private:
+    static const uint32_t ENTRY_VALID = 1U << 31;        // Entry holds a route
+    static const uint32_t ENTRY_EXTENDED = 1U << 30;     // Entry points to a tbl8 group
+    static const int ENTRY_DEPTH_SHIFT = 24;             // Prefix length of the route
+    static const uint32_t ENTRY_DEPTH_MASK = 0x3fU << 24;
+    static const uint32_t ENTRY_VALUE_MASK = 0xffffffU;  // Next hop or group index
+    static const size_t TBL24_SIZE = 1U << 24;
+    static const size_t MAX_TBL8_GROUPS = 1U << 16;
+
+    ArenaArray<uint32_t> tbl24;             // First level, one entry per /24, on huge pages
+    std::vector<uint32_t> tbl8;             // Second level groups of 256 entries
+    size_t tbl8_groups;                     // Number of allocated groups
+    std::vector<uint32_t> tbl8_free;        // Groups available for reuse
+    int default_nh;                         // Next hop of 0.0.0.0/0, -1 if none
+    std::vector<NextHop> next_hops;         // Next hop table
+    std::map<uint64_t, int> routes;         // (prefix_len << 32 | prefix) -> next hop
+    std::atomic<uint32_t> generation;       // Number of changes, for caches of lookup results
+
+    /**
+     * @brief Get or create the next hop index for a device and gateway
+     * @param device_number Egress device
+     * @param gateway Gateway in network byte order
+     * @return Next hop index or -1 if the table is full
+     */
+    int InternNextHop(int device_number, in_addr_t gateway);
+
+    /**
+     * @brief Find the route that covers a prefix once it is deleted
+     * @param addr Prefix in host byte order
+     * @param prefix_len Prefix length
+     * @param entry Table entry of the covering route (output, 0 if none)
+     */
+    void FindCovering(uint32_t addr, int prefix_len, uint32_t* entry) const;
+
+    /**
+     * @brief Write a route into a range of entries
+     * @param entries First entry
+     * @param count Number of entries
+     * @param match_len Overwrite only entries of exactly this depth, or -1 to
+     *                  overwrite every entry that is empty or not deeper than value
+     * @param value New entry value
+     *
+     * First-level entries that point to a group are descended into.
+     */
+    void FillRange(uint32_t* entries, size_t count, int match_len, uint32_t value);
+
+    /**
+     * @brief Allocate a second-level group initialized from a first-level entry
+     * @param entry First-level entry being expanded
+     * @return Group index or -1 if there are no groups left
+     */
+    int AllocTbl8(uint32_t entry);
+
+    /**
+     * @brief Collapse a group back into its first-level entry if it holds no long prefix
+     * @param idx First-level index
+     */
+    void TryCollapseTbl8(uint32_t idx);
+};
+
+#endif // FIB_HPP
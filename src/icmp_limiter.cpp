@@ -0,0 +1,96 @@
+/**
+ * @file icmp_limiter.cpp
+ * @brief Implementation of the rate limit of generated ICMP errors
+ */
+
+#include "icmp_limiter.hpp"
+
+/**
+ * @brief Constructor
+ * @param sources Number of source buckets, rounded up to a power of two
+ *
+ * The default rates are Linux's: 1000 errors per second with a burst of
+ * 50 over all addresses, one per second with a burst of 6 to each.
+ */
+IcmpLimiter::IcmpLimiter(size_t sources) {
+    size_t n = 1;
+    bits = 0;
+    while (n < sources) {
+        n <<= 1;
+        bits++;
+    }
+    this->sources.resize(n);
+    Configure(1000, 50, 1, 6);
+}
+
+/**
+ * @brief Destructor
+ */
+IcmpLimiter::~IcmpLimiter() {
+}
+
+/**
+ * @brief Set the rates; every bucket starts full
+ * @param global_rate Errors per second over all addresses
+ * @param global_burst Errors that may be sent back to back over all addresses
+ * @param source_rate Errors per second to one address
+ * @param source_burst Errors that may be sent back to back to one address
+ */
+void IcmpLimiter::Configure(int global_rate, int global_burst, int source_rate, int source_burst) {
+    this->global_rate = global_rate > 0 ? global_rate : 1;
+    global_size = (global_burst > 0 ? global_burst : 1) * TOKEN;
+    this->source_rate = source_rate > 0 ? source_rate : 1;
+    source_size = (source_burst > 0 ? source_burst : 1) * TOKEN;
+
+    global.addr = INADDR_ANY;
+    global.units = global_size;
+    global.time_ms = 0;
+    for (Bucket& bucket : sources) {
+        bucket.addr = INADDR_ANY;
+        bucket.units = source_size;
+        bucket.time_ms = 0;
+    }
+}
+
+/**
+ * @brief Add the tokens earned since the last refill
+ * @param bucket Bucket
+ * @param rate Units per millisecond
+ * @param size Bucket size in units
+ * @param now_ms Current time
+ */
+void IcmpLimiter::Refill(Bucket& bucket, uint64_t rate, uint64_t size, uint64_t now_ms) {
+    if (now_ms > bucket.time_ms) {
+        uint64_t elapsed = now_ms - bucket.time_ms;
+        // Past this point the bucket is full anyway; avoids overflowing the product
+        uint64_t units = elapsed < size ? elapsed * rate : size;
+        bucket.units = (size - bucket.units > units) ? bucket.units + units : size;
+        bucket.time_ms = now_ms;
+    }
+}
+
+/**
+ * @brief Take the tokens for one error
+ * @param addr Address the error is sent to
+ * @param now_ms Current TimerWheel::NowMs() time
+ * @return true if the error may be sent
+ *
+ * No token is taken unless both buckets have one.
+ */
+bool IcmpLimiter::Allow(in_addr_t addr, uint64_t now_ms) {
+    Bucket& source = sources[Slot(addr)];
+    if (source.addr != addr) {
+        source.addr = addr;
+        source.units = source_size;
+        source.time_ms = now_ms;
+    }
+
+    Refill(global, global_rate, global_size, now_ms);
+    Refill(source, source_rate, source_size, now_ms);
+    if (global.units < TOKEN || source.units < TOKEN) {
+        return false;
+    }
+    global.units -= TOKEN;
+    source.units -= TOKEN;
+    return true;
+}
@@ -0,0 +1,97 @@
+/**
+ * @file icmp_limiter.hpp
+ * @brief Header file for the rate limit of generated ICMP errors
+ */
+
+#ifndef ICMP_LIMITER_HPP
+#define ICMP_LIMITER_HPP
+
+#include <netinet/in.h>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "netutil.hpp"
+
+/**
+ * @brief Token buckets limiting the ICMP errors a worker generates
+ *
+ * Like Linux's icmp_msgs_per_sec and icmp_ratelimit, an error needs a
+ * token from a global bucket and one from the bucket of the address it is
+ * sent to. Source buckets live in a direct-mapped table; an address that
+ * takes over a slot starts with a full bucket, so a flood from many
+ * (possibly spoofed) sources is held back by the global bucket alone.
+ *
+ * Each worker owns its limiter, so it is neither locked nor shared; the
+ * router splits the global rate over the workers.
+ */
+class IcmpLimiter {
+public:
+    /**
+     * @brief Constructor
+     * @param sources Number of source buckets, rounded up to a power of two
+     */
+    IcmpLimiter(size_t sources = 256);
+
+    /**
+     * @brief Destructor
+     */
+    ~IcmpLimiter();
+
+    /**
+     * @brief Set the rates; every bucket starts full
+     * @param global_rate Errors per second over all addresses
+     * @param global_burst Errors that may be sent back to back over all addresses
+     * @param source_rate Errors per second to one address
+     * @param source_burst Errors that may be sent back to back to one address
+     */
+    void Configure(int global_rate, int global_burst, int source_rate, int source_burst);
+
+    /**
+     * @brief Take the tokens for one error
+     * @param addr Address the error is sent to
+     * @param now_ms Current TimerWheel::NowMs() time
+     * @return true if the error may be sent
+     */
+    bool Allow(in_addr_t addr, uint64_t now_ms);
+
+private:
+    static const uint64_t TOKEN = 1000;   // Bucket units per token: a rate per second is units per millisecond
+
+    /**
+     * @brief Token bucket
+     */
+    class Bucket {
+    public:
+        in_addr_t addr;                   // Address owning the bucket (source buckets only)
+        uint64_t units;                   // Tokens left, in TOKEN units
+        uint64_t time_ms;                 // Last refill
+    };
+
+    Bucket global;                        // Bucket shared by all addresses
+    std::vector<Bucket> sources;          // Direct-mapped source buckets
+    int bits;                             // log2 of the number of source buckets
+    uint64_t global_rate;                 // Units added to the global bucket per millisecond
+    uint64_t global_size;                 // Global bucket size in units
+    uint64_t source_rate;                 // Units added to a source bucket per millisecond
+    uint64_t source_size;                 // Source bucket size in units
+
+    /**
+     * @brief Add the tokens earned since the last refill
+     * @param bucket Bucket
+     * @param rate Units per millisecond
+     * @param size Bucket size in units
+     * @param now_ms Current time
+     */
+    static void Refill(Bucket& bucket, uint64_t rate, uint64_t size, uint64_t now_ms);
+
+    /**
+     * @brief Get the source bucket slot of an address
+     * @param addr Address
+     * @return Slot number
+     */
+    size_t Slot(in_addr_t addr) const {
+        return NetworkUtil::AddrHash(addr, bits);
+    }
+};
+
+#endif // ICMP_LIMITER_HPP
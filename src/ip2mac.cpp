@@ -4,176 +4,434 @@
  */
 
 #include "ip2mac.hpp"
+#include <net/ethernet.h>
+#include <arpa/inet.h>
 #include <cstring>
 #include <ctime>
-#include <algorithm>
 
 /**
  * @brief Constructor
  * @param capacity Initial capacity of the IP2MAC table
  */
-IP2MACManager::IP2MACManager(size_t capacity) {
-    ip2mac_table.resize(capacity);
-    for (auto& entry : ip2mac_table) {
-        entry.flag = FLAG_FREE;
+IP2MACManager::IP2MACManager(size_t capacity)
+    : ip2mac_table(capacity, "neighbor table"), published(capacity, "neighbor published"), table_size(capacity),
+      lru_head(-1), lru_tail(-1), free_head(-1), timers(capacity), generation(0) {
+    static_assert(sizeof(Published) == 32, "two published entries per cache line");
+    for (size_t i = 0; i < capacity; i++) {
+        ip2mac_table[i].lru_next = (i + 1 < capacity) ? static_cast<int>(i + 1) : -1;
+        published[i].seq.store(0, std::memory_order_relaxed);
+        published[i].referenced.store(false, std::memory_order_relaxed);
+        published[i].key_word.store(IP2MAC_KEY_NONE, std::memory_order_relaxed);
+        published[i].l2_word[0].store(0, std::memory_order_relaxed);
+        published[i].l2_word[1].store(0, std::memory_order_relaxed);
     }
+    free_head = capacity > 0 ? 0 : -1;
+
+    // Keep the load factor at or below 50%
+    size_t index_size = 1;
+    int bits = 0;
+    while (index_size < capacity * 2) {
+        index_size <<= 1;
+        bits++;
+    }
+    if (bits == 0) {
+        index_size = 2;
+        bits = 1;
+    }
+    index.Allocate(index_size, "neighbor index");
+    for (size_t i = 0; i < index_size; i++) {
+        index[i].store(-1, std::memory_order_relaxed);
+    }
+    index_mask = index_size - 1;
+    index_shift = 64 - bits;
 }
 
 /**
  * @brief Destructor
  */
 IP2MACManager::~IP2MACManager() {
-    // Vectors will automatically clean up
+    // Tables will automatically clean up
 }
 
 /**
- * @brief Search for an IP2MAC entry
+ * @brief Find the table entry for a key
  * @param deviceNo Device number
  * @param addr IP address
- * @param hwaddr MAC address (will be filled if found)
- * @return Pointer to IP2MAC entry or nullptr if not found
+ * @return Table index or -1 if not found
  */
-IP2MAC* IP2MACManager::Search(int deviceNo, in_addr_t addr, unsigned char* hwaddr) {
-    std::lock_guard<std::mutex> lock(mutex);
-
-    for (auto& entry : ip2mac_table) {
-        if (entry.flag != FLAG_FREE && entry.device_number == deviceNo && entry.ip_addr == addr) {
-            if (hwaddr != nullptr) {
-                memcpy(hwaddr, entry.hw_addr, 6);
-            }
-            return &entry;
+int IP2MACManager::Find(int deviceNo, in_addr_t addr) const {
+    // Indexed entries are published, so probing stays in the published part
+    uint64_t key = Key(deviceNo, addr);
+    for (size_t slot = HashSlot(key); ; slot = (slot + 1) & index_mask) {
+        int entry = index[slot].load(std::memory_order_relaxed);
+        if (entry < 0) {
+            return -1;
+        }
+        if (published[entry].key_word.load(std::memory_order_relaxed) == key) {
+            return entry;
         }
     }
+}
 
-    return nullptr;
+/**
+ * @brief Add a table entry to the hash index
+ * @param entry Table index
+ */
+void IP2MACManager::IndexInsert(int entry) {
+    size_t slot = HashSlot(published[entry].key_word.load(std::memory_order_relaxed));
+    while (index[slot].load(std::memory_order_relaxed) >= 0) {
+        slot = (slot + 1) & index_mask;
+    }
+    // Release: readers that find the slot also see the published entry
+    index[slot].store(entry, std::memory_order_release);
 }
 
 /**
- * @brief Get or create an IP2MAC entry
- * @param deviceNo Device number
- * @param addr IP address
- * @param hwaddr MAC address
- * @return Pointer to IP2MAC entry
+ * @brief Remove a table entry from the hash index
+ * @param entry Table index
+ *
+ * Uses backward-shift deletion so that no tombstones are left behind and
+ * probe sequences stay short. Each moved entry is written to its new slot
+ * before its old slot is reused, so a concurrent reader can at worst miss
+ * an entry, never get a wrong one.
  */
-IP2MAC* IP2MACManager::GetIp2Mac(int deviceNo, in_addr_t addr, unsigned char* hwaddr) {
-    std::lock_guard<std::mutex> lock(mutex);
+void IP2MACManager::IndexRemove(int entry) {
+    size_t hole = HashSlot(published[entry].key_word.load(std::memory_order_relaxed));
+    while (index[hole].load(std::memory_order_relaxed) != entry) {
+        if (index[hole].load(std::memory_order_relaxed) < 0) {
+            return;
+        }
+        hole = (hole + 1) & index_mask;
+    }
 
-    // Look for existing entry
-    for (auto& entry : ip2mac_table) {
-        if (entry.flag != FLAG_FREE && entry.device_number == deviceNo && entry.ip_addr == addr) {
-            entry.lastTime = time(nullptr);
-            if (hwaddr != nullptr) {
-                memcpy(entry.hw_addr, hwaddr, 6);
-            }
-            return &entry;
+    for (size_t slot = (hole + 1) & index_mask; ; slot = (slot + 1) & index_mask) {
+        int moved_entry = index[slot].load(std::memory_order_relaxed);
+        if (moved_entry < 0) {
+            break;
+        }
+        size_t home = HashSlot(published[moved_entry].key_word.load(std::memory_order_relaxed));
+        // Shift the entry back unless its home lies cyclically in (hole, slot]
+        if (((slot - home) & index_mask) >= ((slot - hole) & index_mask)) {
+            index[hole].store(moved_entry, std::memory_order_release);
+            hole = slot;
         }
     }
+    index[hole].store(-1, std::memory_order_release);
+}
 
-    // Find free entry
-    for (auto& entry : ip2mac_table) {
-        if (entry.flag == FLAG_FREE) {
-            entry.flag = FLAG_OK;
-            entry.device_number = deviceNo;
-            entry.ip_addr = addr;
-            entry.lastTime = time(nullptr);
-            if (hwaddr != nullptr) {
-                memcpy(entry.hw_addr, hwaddr, 6);
+/**
+ * @brief Publish an entry's key and Ethernet header to lock-free readers
+ * @param entry Table index
+ */
+void IP2MACManager::Publish(int entry) {
+    const IP2MAC& e = ip2mac_table[entry];
+    Published& p = published[entry];
+    uint64_t key = IP2MAC_KEY_NONE;
+    unsigned char header[IP2MAC_L2_SIZE] = {};
+
+    if (e.flag != FLAG_FREE) {
+        key = Key(e.device_number, e.ip_addr);
+
+        // Only confirmed or still trusted addresses are used for forwarding
+        static const unsigned char zero_mac[6] = {};
+        bool usable = e.state == NEIGH_REACHABLE || e.state == NEIGH_STALE || e.state == NEIGH_PROBE;
+        if (e.flag == FLAG_OK && usable && memcmp(e.hw_addr, zero_mac, 6) != 0) {
+            struct ether_header* eh = reinterpret_cast<struct ether_header*>(header);
+            memcpy(eh->ether_dhost, e.hw_addr, 6);
+            if (e.device_number >= 0 && static_cast<size_t>(e.device_number) < port_hw_addr.size()) {
+                memcpy(eh->ether_shost, port_hw_addr[e.device_number].data(), 6);
             }
-            return &entry;
+            eh->ether_type = htons(ETHERTYPE_IP);
+            header[IP2MAC_L2_RESOLVED] = 1;
         }
     }
 
-    // Table is full, replace oldest entry
-    auto oldest = std::min_element(ip2mac_table.begin(), ip2mac_table.end(),
-        [](const IP2MAC& a, const IP2MAC& b) { return a.lastTime < b.lastTime; });
+    uint64_t words[2];
+    memcpy(words, header, sizeof(words));
 
-    if (oldest != ip2mac_table.end()) {
-        oldest->flag = FLAG_OK;
-        oldest->device_number = deviceNo;
-        oldest->ip_addr = addr;
-        oldest->lastTime = time(nullptr);
-        if (hwaddr != nullptr) {
-            memcpy(oldest->hw_addr, hwaddr, 6);
+    // Caches of lookup results only need to hear about real changes
+    bool changed = p.key_word.load(std::memory_order_relaxed) != key ||
+                   p.l2_word[0].load(std::memory_order_relaxed) != words[0] ||
+                   p.l2_word[1].load(std::memory_order_relaxed) != words[1];
+
+    uint32_t seq = p.seq.load(std::memory_order_relaxed);
+    p.seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    p.key_word.store(key, std::memory_order_relaxed);
+    p.l2_word[0].store(words[0], std::memory_order_relaxed);
+    p.l2_word[1].store(words[1], std::memory_order_relaxed);
+    p.seq.store(seq + 2, std::memory_order_release);
+    if (changed) {
+        generation.fetch_add(1, std::memory_order_release);
+    }
+}
+
+/**
+ * @brief Pick the entry to evict when the table is full
+ * @return Table index
+ *
+ * Lock-free readers do not reorder the LRU list; they only mark entries as
+ * referenced. An entry at the tail that was referenced gets a second chance
+ * at the head, so the scan is amortized O(1).
+ */
+int IP2MACManager::EvictCandidate() {
+    for (size_t n = 0; n < table_size; n++) {
+        int entry = lru_tail;
+        std::atomic<bool>& referenced = published[entry].referenced;
+        if (!referenced.load(std::memory_order_relaxed)) {
+            return entry;
         }
-        return &(*oldest);
+        referenced.store(false, std::memory_order_relaxed);
+        LruUnlink(entry);
+        LruPushFront(entry);
+    }
+    return lru_tail;
+}
+
+/**
+ * @brief Unlink an entry from the LRU list
+ * @param entry Table index
+ */
+void IP2MACManager::LruUnlink(int entry) {
+    IP2MAC& e = ip2mac_table[entry];
+    if (e.lru_prev >= 0) {
+        ip2mac_table[e.lru_prev].lru_next = e.lru_next;
+    } else {
+        lru_head = e.lru_next;
+    }
+    if (e.lru_next >= 0) {
+        ip2mac_table[e.lru_next].lru_prev = e.lru_prev;
+    } else {
+        lru_tail = e.lru_prev;
     }
+    e.lru_prev = -1;
+    e.lru_next = -1;
+}
 
-    return nullptr;
+/**
+ * @brief Link an entry at the most recently used end of the LRU list
+ * @param entry Table index
+ */
+void IP2MACManager::LruPushFront(int entry) {
+    IP2MAC& e = ip2mac_table[entry];
+    e.lru_prev = -1;
+    e.lru_next = lru_head;
+    if (lru_head >= 0) {
+        ip2mac_table[lru_head].lru_prev = entry;
+    } else {
+        lru_tail = entry;
+    }
+    lru_head = entry;
 }
 
 /**
- * @brief Send one buffered packet for a specific IP2MAC entry
+ * @brief Search for an IP2MAC entry
  * @param deviceNo Device number
- * @param ip2mac Pointer to IP2MAC entry
- * @return Success or failure code
+ * @param addr IP address
+ * @param hwaddr MAC address (will be filled if found)
+ * @return Pointer to IP2MAC entry or nullptr if not found
  */
-int IP2MACManager::BufferSendOne(int deviceNo, IP2MAC* ip2mac) {
-    (void)deviceNo;  // Suppress unused parameter warning
+IP2MAC* IP2MACManager::Search(int deviceNo, in_addr_t addr, unsigned char* hwaddr) {
+    std::lock_guard<std::mutex> lock(mutex);
 
-    if (ip2mac == nullptr) {
-        return -1;
+    int entry = Find(deviceNo, addr);
+    if (entry < 0) {
+        return nullptr;
     }
 
-    // This method would need access to socket and network functions
-    // Actual implementation depends on the router's network interface
-
-    return 1;
+    if (hwaddr != nullptr) {
+        memcpy(hwaddr, ip2mac_table[entry].hw_addr, 6);
+    }
+    return &ip2mac_table[entry];
 }
 
 /**
- * @brief Append send request data
+ * @brief Look up a resolved neighbor's Ethernet header without taking the lock
  * @param deviceNo Device number
- * @param ip2macNo IP2MAC entry number
- * @return Success or failure code
+ * @param addr IP address
+ * @param header IP2MAC_L2_SIZE byte buffer, filled with the header on success
+ * @param entry Entry found (output, optional)
+ * @return 1 if resolved, 0 if the entry exists but is unresolved, -1 if not found
  */
-int IP2MACManager::AppendSendReqData(int deviceNo, int ip2macNo) {
-    std::lock_guard<std::mutex> lock(send_req_mutex);
+int IP2MACManager::Lookup(int deviceNo, in_addr_t addr, unsigned char header[IP2MAC_L2_SIZE], IP2MAC** entry) {
+    uint64_t want = Key(deviceNo, addr);
+
+    for (size_t slot = HashSlot(want), n = 0; n <= index_mask; slot = (slot + 1) & index_mask, n++) {
+        int found = index[slot].load(std::memory_order_acquire);
+        if (found < 0) {
+            return -1;
+        }
 
-    SendReqData req;
-    req.deviceNo = deviceNo;
-    req.ip2macNo = ip2macNo;
+        Published& p = published[found];
+        uint64_t key;
+        uint64_t words[2];
+        uint32_t seq;
+        do {
+            seq = p.seq.load(std::memory_order_acquire);
+            key = p.key_word.load(std::memory_order_relaxed);
+            words[0] = p.l2_word[0].load(std::memory_order_relaxed);
+            words[1] = p.l2_word[1].load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+        } while ((seq & 1) != 0 || p.seq.load(std::memory_order_relaxed) != seq);
 
-    send_req_data.push_back(req);
+        if (key != want) {
+            continue;
+        }
 
-    return 1;
+        if (!p.referenced.load(std::memory_order_relaxed)) {
+            p.referenced.store(true, std::memory_order_relaxed);
+        }
+        memcpy(header, words, IP2MAC_L2_SIZE);
+        if (entry != nullptr) {
+            *entry = &ip2mac_table[found];
+        }
+        return header[IP2MAC_L2_RESOLVED] != 0 ? 1 : 0;
+    }
+
+    return -1;
 }
 
 /**
- * @brief Get send request data
- * @param deviceNo Pointer to store device number
- * @param ip2macNo Pointer to store IP2MAC entry number
- * @return Success or failure code
+ * @brief Set the MAC address of a port, used as the cached headers' source
+ * @param deviceNo Device number
+ * @param hwaddr MAC address
  */
-int IP2MACManager::GetSendReqData(int* deviceNo, int* ip2macNo) {
-    std::lock_guard<std::mutex> lock(send_req_mutex);
+void IP2MACManager::SetPortAddress(int deviceNo, const unsigned char hwaddr[6]) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (deviceNo < 0) {
+        return;
+    }
+    if (static_cast<size_t>(deviceNo) >= port_hw_addr.size()) {
+        port_hw_addr.resize(deviceNo + 1);
+    }
+    memcpy(port_hw_addr[deviceNo].data(), hwaddr, 6);
 
-    if (send_req_data.empty()) {
-        return -1;
+    // Rebuild the headers already cached for the port
+    for (size_t i = 0; i < table_size; i++) {
+        const IP2MAC& e = ip2mac_table[i];
+        if (e.flag != FLAG_FREE && e.device_number == deviceNo) {
+            Publish(static_cast<int>(i));
+        }
     }
+}
 
-    SendReqData req = send_req_data.front();
-    send_req_data.erase(send_req_data.begin());
+/**
+ * @brief Get or create an IP2MAC entry
+ * @param deviceNo Device number
+ * @param addr IP address
+ * @param hwaddr MAC address
+ * @param discarded Packets queued for a neighbor evicted to make room (output), or nullptr
+ * @return Pointer to IP2MAC entry
+ */
+IP2MAC* IP2MACManager::GetIp2Mac(int deviceNo, in_addr_t addr, unsigned char* hwaddr, int* discarded) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (discarded != nullptr) {
+        *discarded = 0;
+    }
 
-    *deviceNo = req.deviceNo;
-    *ip2macNo = req.ip2macNo;
+    // Look for existing entry
+    int entry = Find(deviceNo, addr);
+    if (entry >= 0) {
+        IP2MAC& e = ip2mac_table[entry];
+        e.lastTime = time(nullptr);
+        if (hwaddr != nullptr) {
+            // Any ARP from the neighbor confirms its address
+            memcpy(e.hw_addr, hwaddr, 6);
+            e.state = NEIGH_REACHABLE;
+            e.probes = 0;
+            Publish(entry);
+        }
+        if (entry != lru_head) {
+            LruUnlink(entry);
+            LruPushFront(entry);
+        }
+        return &e;
+    }
+
+    if (free_head >= 0) {
+        // Take a free entry
+        entry = free_head;
+        free_head = ip2mac_table[entry].lru_next;
+    } else if (lru_tail >= 0) {
+        // Table is full, replace least recently used entry
+        entry = EvictCandidate();
+        LruUnlink(entry);
+        IndexRemove(entry);
+        // Packets queued for the old neighbor must not go to the new one
+        if (discarded != nullptr) {
+            *discarded = static_cast<int>(ip2mac_table[entry].send_data.data_num);
+        }
+        ip2mac_table[entry].send_data.Clear();
+        timers.Cancel(entry);
+    } else {
+        return nullptr;
+    }
+
+    IP2MAC& e = ip2mac_table[entry];
+    e.flag = FLAG_OK;
+    e.device_number = deviceNo;
+    e.ip_addr = addr;
+    e.lastTime = time(nullptr);
+    if (hwaddr != nullptr) {
+        memcpy(e.hw_addr, hwaddr, 6);
+        e.state = NEIGH_REACHABLE;
+    } else {
+        memset(e.hw_addr, 0, 6);
+        e.state = NEIGH_NONE;
+    }
+    e.probes = 0;
+    published[entry].referenced.store(false, std::memory_order_relaxed);
+    Publish(entry);
+    IndexInsert(entry);
+    LruPushFront(entry);
+
+    return &e;
+}
 
-    return 1;
+/**
+ * @brief Change an entry's resolution state
+ * @param ip2mac Pointer to IP2MAC entry
+ * @param state New state (NEIGH_*)
+ */
+void IP2MACManager::SetState(IP2MAC* ip2mac, int state) {
+    std::lock_guard<std::mutex> lock(mutex);
+    ip2mac->state = state;
+    Publish(static_cast<int>(ip2mac - ip2mac_table.Data()));
 }
 
 /**
- * @brief Send all buffered data
- * @return Success or failure code
+ * @brief Arm an entry's timer, replacing any pending one
+ * @param ip2mac Pointer to IP2MAC entry
+ * @param expires_ms Expiry in TimerWheel::NowMs() time
  */
-int IP2MACManager::BufferSend() {
-    // Process all pending send requests
-    int deviceNo, ip2macNo;
-    while (GetSendReqData(&deviceNo, &ip2macNo) == 1) {
-        // Calculate index in the table
-        size_t index = ip2macNo;
-        if (index < ip2mac_table.size()) {
-            BufferSendOne(deviceNo, &ip2mac_table[index]);
-        }
+void IP2MACManager::ScheduleTimer(IP2MAC* ip2mac, uint64_t expires_ms) {
+    std::lock_guard<std::mutex> lock(mutex);
+    timers.Schedule(static_cast<int>(ip2mac - ip2mac_table.Data()), expires_ms);
+}
+
+/**
+ * @brief Cancel an entry's timer
+ * @param ip2mac Pointer to IP2MAC entry
+ */
+void IP2MACManager::CancelTimer(IP2MAC* ip2mac) {
+    std::lock_guard<std::mutex> lock(mutex);
+    timers.Cancel(static_cast<int>(ip2mac - ip2mac_table.Data()));
+}
+
+/**
+ * @brief Collect the entries whose timer expired
+ * @param now_ms Current TimerWheel::NowMs() time
+ * @param expired Expired entries (appended; their timers are no longer pending)
+ * @return Number of expired entries
+ */
+int IP2MACManager::ExpireTimers(uint64_t now_ms, std::vector<IP2MAC*>* expired) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    expired_ids.clear();
+    int count = timers.Advance(now_ms, &expired_ids);
+    for (int id : expired_ids) {
+        expired->push_back(&ip2mac_table[id]);
     }
 
-    return 1;
-}
\ No newline at end of file
+    return count;
+}
@@ -7,12 +7,38 @@
 #define IP2MAC_HPP
 
 #include <netinet/in.h>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
 #include <vector>
 #include <mutex>
 #include "base.hpp"
+#include "timer_wheel.hpp"
+#include "memory_arena.hpp"
 
 /**
  * @brief Class for managing IP to MAC address mapping
+ *
+ * Entries live in a fixed table so that IP2MAC pointers stay valid. They are
+ * found through an open-addressing hash index keyed on (device, IP address)
+ * and kept on an intrusive LRU list, so lookup, insertion and eviction of
+ * the least recently used entry are all O(1).
+ *
+ * Every entry owns one timer on a timer wheel, which drives its
+ * resolution state machine (see ArpResolver).
+ *
+ * Writers (Search, GetIp2Mac, timers) are serialized by a mutex. Lookup() is a
+ * lock-free reader: index slots are atomics and every entry publishes its
+ * key and a ready-to-write Ethernet header under a per-entry seqlock. The
+ * header is rebuilt on every publish, so a learned MAC address or a state
+ * change replaces it atomically for readers.
+ *
+ * The table is split in two. The published part of each entry is packed
+ * into a 32-byte record, two to a cache line, in an array of its own; a
+ * lookup or an index probe touches only that array. The IP2MAC entries,
+ * with the pending packet queues, timestamps and LRU links, are only
+ * touched when resolving.
  */
 class IP2MACManager {
 public:
@@ -37,55 +63,212 @@ public:
     IP2MAC* Search(int deviceNo, in_addr_t addr, unsigned char* hwaddr);
 
     /**
-     * @brief Get or create an IP2MAC entry
+     * @brief Look up a resolved neighbor's Ethernet header without taking the lock
+     * @param deviceNo Device number
+     * @param addr IP address
+     * @param header IP2MAC_L2_SIZE byte buffer; on success its first
+     *               sizeof(ether_header) bytes are the neighbor's dhost, the
+     *               port's shost and ETHERTYPE_IP
+     * @param entry Entry found (output, optional)
+     * @return 1 if resolved, 0 if the entry exists but is unresolved, -1 if not found
+     *
+     * A lookup racing with an insertion or eviction may report -1 for an
+     * existing entry; callers then fall back to GetIp2Mac().
+     */
+    int Lookup(int deviceNo, in_addr_t addr, unsigned char header[IP2MAC_L2_SIZE], IP2MAC** entry = nullptr);
+
+    /**
+     * @brief Start loading the hash index slot of a neighbor, first step of a pipelined Lookup()
+     * @param deviceNo Device number
+     * @param addr IP address
+     */
+    void PrefetchSlot(int deviceNo, in_addr_t addr) const {
+        __builtin_prefetch(&index[HashSlot(Key(deviceNo, addr))]);
+    }
+
+    /**
+     * @brief Start loading the published entry of a neighbor, second step of a pipelined Lookup()
      * @param deviceNo Device number
      * @param addr IP address
+     *
+     * Only the entry in the neighbor's home slot is prefetched; the slot
+     * itself should be in the cache already, see PrefetchSlot().
+     */
+    void PrefetchEntry(int deviceNo, in_addr_t addr) const {
+        int entry = index[HashSlot(Key(deviceNo, addr))].load(std::memory_order_relaxed);
+        if (entry >= 0) {
+            __builtin_prefetch(&published[entry]);
+        }
+    }
+
+    /**
+     * @brief Set the MAC address of a port, used as the cached headers' source
+     * @param deviceNo Device number
      * @param hwaddr MAC address
-     * @return Pointer to IP2MAC entry
      */
-    IP2MAC* GetIp2Mac(int deviceNo, in_addr_t addr, unsigned char* hwaddr);
+    void SetPortAddress(int deviceNo, const unsigned char hwaddr[6]);
+
+    /**
+     * @brief Get the number of changes published to lock-free readers
+     * @return Generation, incremented whenever an entry's key or header changes
+     */
+    uint32_t Generation() const { return generation.load(std::memory_order_acquire); }
 
     /**
-     * @brief Send one buffered packet for a specific IP2MAC entry
+     * @brief Get or create an IP2MAC entry
      * @param deviceNo Device number
+     * @param addr IP address
+     * @param hwaddr MAC address learned from the neighbor (entry becomes
+     *               NEIGH_REACHABLE), or nullptr
+     * @param discarded Packets queued for a neighbor evicted to make room (output), or nullptr
+     * @return Pointer to IP2MAC entry
+     */
+    IP2MAC* GetIp2Mac(int deviceNo, in_addr_t addr, unsigned char* hwaddr, int* discarded = nullptr);
+
+    /**
+     * @brief Change an entry's resolution state
      * @param ip2mac Pointer to IP2MAC entry
-     * @return Success or failure code
+     * @param state New state (NEIGH_*)
+     *
+     * Readers see the address only in NEIGH_REACHABLE, NEIGH_STALE and
+     * NEIGH_PROBE.
      */
-    int BufferSendOne(int deviceNo, IP2MAC* ip2mac);
+    void SetState(IP2MAC* ip2mac, int state);
 
     /**
-     * @brief Append send request data
-     * @param deviceNo Device number
-     * @param ip2macNo IP2MAC entry number
-     * @return Success or failure code
+     * @brief Arm an entry's timer, replacing any pending one
+     * @param ip2mac Pointer to IP2MAC entry
+     * @param expires_ms Expiry in TimerWheel::NowMs() time
      */
-    int AppendSendReqData(int deviceNo, int ip2macNo);
+    void ScheduleTimer(IP2MAC* ip2mac, uint64_t expires_ms);
 
     /**
-     * @brief Get send request data
-     * @param deviceNo Pointer to store device number
-     * @param ip2macNo Pointer to store IP2MAC entry number
-     * @return Success or failure code
+     * @brief Cancel an entry's timer
+     * @param ip2mac Pointer to IP2MAC entry
      */
-    int GetSendReqData(int* deviceNo, int* ip2macNo);
+    void CancelTimer(IP2MAC* ip2mac);
 
     /**
-     * @brief Send all buffered data
-     * @return Success or failure code
+     * @brief Collect the entries whose timer expired
+     * @param now_ms Current TimerWheel::NowMs() time
+     * @param expired Expired entries (appended; their timers are no longer pending)
+     * @return Number of expired entries
+     */
+    int ExpireTimers(uint64_t now_ms, std::vector<IP2MAC*>* expired);
+
+    /**
+     * @brief Mark an entry as used, giving it a second chance at eviction
+     * @param ip2mac Pointer to IP2MAC entry
+     *
+     * Lock-free; Lookup() marks the entries it finds itself.
+     */
+    void Touch(const IP2MAC* ip2mac) {
+        std::atomic<bool>& referenced = published[ip2mac - ip2mac_table.Data()].referenced;
+        if (!referenced.load(std::memory_order_relaxed)) {
+            referenced.store(true, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @brief Clear an entry's used mark
+     * @param ip2mac Pointer to IP2MAC entry
+     * @return true if the entry was used since the mark was last cleared
      */
-    int BufferSend();
+    bool ClearReferenced(const IP2MAC* ip2mac) {
+        return published[ip2mac - ip2mac_table.Data()].referenced.exchange(false, std::memory_order_relaxed);
+    }
 
 private:
-    std::vector<IP2MAC> ip2mac_table;    // Table of IP2MAC entries
+    /**
+     * @brief Published part of an entry, read by Lookup() under its seqlock
+     */
+    struct alignas(32) Published {
+        std::atomic<uint32_t> seq;          // Odd while an update is in progress
+        std::atomic<bool> referenced;       // Set by readers, cleared by eviction
+        std::atomic<uint64_t> key_word;     // device_number << 32 | ip_addr, or IP2MAC_KEY_NONE
+        std::atomic<uint64_t> l2_word[2];   // Ready-to-write ether_header to the neighbor, see IP2MAC_L2_*
+    };
+
+    ArenaArray<IP2MAC> ip2mac_table;     // Table of IP2MAC entries
+    ArenaArray<Published> published;     // Published part of each entry, by table index
+    size_t table_size;                   // Number of entries
     std::mutex mutex;                    // Mutex for thread safety
 
-    struct SendReqData {
-        int deviceNo;
-        int ip2macNo;
-    };
+    ArenaArray<std::atomic<int32_t>> index;  // Hash index of table entries, -1 if empty
+    size_t index_mask;                   // Index size - 1
+    int index_shift;                     // 64 - log2(index size)
+    int lru_head;                        // Most recently used entry
+    int lru_tail;                        // Least recently used entry
+    int free_head;                       // First free entry (chained through lru_next)
+
+    /**
+     * @brief Get the published key of a neighbor
+     * @param deviceNo Device number
+     * @param addr IP address
+     * @return Key
+     */
+    static uint64_t Key(int deviceNo, in_addr_t addr) {
+        return (static_cast<uint64_t>(static_cast<uint32_t>(deviceNo)) << 32) | addr;
+    }
+
+    /**
+     * @brief Get the home slot of a key in the hash index
+     * @param key Key
+     * @return Slot number
+     */
+    size_t HashSlot(uint64_t key) const {
+        // Fibonacci hashing: the high bits of the product are well mixed
+        return static_cast<size_t>((key * 0x9E3779B97F4A7C15ULL) >> index_shift);
+    }
+
+    /**
+     * @brief Find the table entry for a key
+     * @param deviceNo Device number
+     * @param addr IP address
+     * @return Table index or -1 if not found
+     */
+    int Find(int deviceNo, in_addr_t addr) const;
+
+    /**
+     * @brief Add a table entry to the hash index
+     * @param entry Table index
+     */
+    void IndexInsert(int entry);
+
+    /**
+     * @brief Remove a table entry from the hash index
+     * @param entry Table index
+     */
+    void IndexRemove(int entry);
+
+    /**
+     * @brief Publish an entry's key and Ethernet header to lock-free readers
+     * @param entry Table index
+     */
+    void Publish(int entry);
+
+    /**
+     * @brief Pick the entry to evict when the table is full
+     * @return Table index
+     */
+    int EvictCandidate();
+
+    /**
+     * @brief Unlink an entry from the LRU list
+     * @param entry Table index
+     */
+    void LruUnlink(int entry);
+
+    /**
+     * @brief Link an entry at the most recently used end of the LRU list
+     * @param entry Table index
+     */
+    void LruPushFront(int entry);
 
-    std::vector<SendReqData> send_req_data;  // Send request queue
-    std::mutex send_req_mutex;              // Mutex for send request queue
+    TimerWheel timers;                   // Per-entry timers, by table index
+    std::vector<std::array<unsigned char, 6>> port_hw_addr;  // Source address of each port's headers
+    std::atomic<uint32_t> generation;    // Published changes, for caches of lookup results
+    std::vector<int> expired_ids;        // Scratch list for ExpireTimers()
 };
 
 #endif // IP2MAC_HPP
\ No newline at end of file
@@ -0,0 +1,132 @@
+/**
+ * @file latency.cpp
+ * @brief Implementation of TSC timestamps and per-stage latency histograms
+ */
+
+#include "latency.hpp"
+#include <ctime>
+
+double Tsc::ns_per_tick = 1.0;
+
+// Names of the stages, by LatencyStage
+static const char* const STAGE_NAMES[LAT_STAGE_NUM] = {
+    "classify",
+    "forward",
+    "handoff",
+    "pending",
+    "tx",
+};
+
+/**
+ * @brief Measure the counter frequency against CLOCK_MONOTONIC
+ *
+ * Takes about 20 ms; called once at startup.
+ */
+void Tsc::Calibrate() {
+    uint64_t ns0 = MonotonicNs();
+    uint64_t t0 = Now();
+    struct timespec delay = {0, 20 * 1000 * 1000};
+    nanosleep(&delay, nullptr);
+    uint64_t ns1 = MonotonicNs();
+    uint64_t t1 = Now();
+
+    if (t1 > t0) {
+        ns_per_tick = static_cast<double>(ns1 - ns0) / static_cast<double>(t1 - t0);
+    }
+}
+
+/**
+ * @brief Read CLOCK_MONOTONIC
+ * @return Nanoseconds since an arbitrary point
+ */
+uint64_t Tsc::MonotonicNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * @brief Constructor
+ */
+LatencyHistogram::LatencyHistogram() {
+    for (int i = 0; i < BUCKET_NUM; i++) {
+        buckets[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief Add another histogram to this one
+ * @param other Histogram to add
+ */
+void LatencyHistogram::Accumulate(const LatencyHistogram& other) {
+    for (int i = 0; i < BUCKET_NUM; i++) {
+        uint64_t n = other.buckets[i].load(std::memory_order_relaxed);
+        buckets[i].store(buckets[i].load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief Count the samples
+ * @return Number of samples
+ */
+uint64_t LatencyHistogram::Count() const {
+    uint64_t total = 0;
+    for (int i = 0; i < BUCKET_NUM; i++) {
+        total += buckets[i].load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+/**
+ * @brief Get a quantile
+ * @param q Quantile in [0, 1]
+ * @return Upper bound of the bucket holding the quantile, in ticks (0 if empty)
+ */
+uint64_t LatencyHistogram::Quantile(double q) const {
+    uint64_t total = Count();
+    if (total == 0) {
+        return 0;
+    }
+
+    // Rank of the sample, 1-based
+    uint64_t rank = static_cast<uint64_t>(q * static_cast<double>(total) + 0.5);
+    if (rank < 1) {
+        rank = 1;
+    }
+    if (rank > total) {
+        rank = total;
+    }
+
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKET_NUM; i++) {
+        seen += buckets[i].load(std::memory_order_relaxed);
+        if (seen >= rank) {
+            return BucketMax(i);
+        }
+    }
+    return BucketMax(BUCKET_NUM - 1);
+}
+
+/**
+ * @brief Get the name of a stage
+ * @param stage Stage
+ * @return Name used in reports
+ */
+const char* LatencyHistogram::StageName(int stage) {
+    return (stage >= 0 && stage < LAT_STAGE_NUM) ? STAGE_NAMES[stage] : "unknown";
+}
+
+/**
+ * @brief Get the largest value of a bucket
+ * @param bucket Bucket index
+ * @return Value
+ */
+uint64_t LatencyHistogram::BucketMax(int bucket) {
+    if (bucket < SUB_BUCKETS) {
+        return static_cast<uint64_t>(bucket);
+    }
+    int msb = bucket / SUB_BUCKETS + SUB_BITS - 1;
+    uint64_t sub = static_cast<uint64_t>(bucket % SUB_BUCKETS);
+    uint64_t low = (1ULL << msb) | (sub << (msb - SUB_BITS));
+    return low + (1ULL << (msb - SUB_BITS)) - 1;
+}
@@ -0,0 +1,182 @@
+/**
+ * @file latency.hpp
+ * @brief Header file for TSC timestamps and per-stage latency histograms
+ */
+
+#ifndef LATENCY_HPP
+#define LATENCY_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Latency instrumentation, off unless built with make LATENCY=1. When off,
+// the LATENCY_* macros expand to nothing, so neither their arguments nor
+// the timestamp fields they touch need to exist.
+#ifndef ROUTER_LATENCY
+#define ROUTER_LATENCY 0
+#endif
+
+/**
+ * @brief Stages a packet's latency is recorded for
+ */
+enum LatencyStage {
+    LAT_CLASSIFY,    // Receive to classified
+    LAT_FORWARD,     // Receive to staged for TX or handed to another port
+    LAT_HANDOFF,     // Receive on another port to staged here
+    LAT_PENDING,     // Queued for ARP to drained
+    LAT_TX,          // Receive to accepted by sendmmsg()
+    LAT_STAGE_NUM
+};
+
+/**
+ * @brief Cycle counter used for timestamps
+ */
+class Tsc {
+public:
+    /**
+     * @brief Read the counter
+     * @return Ticks since an arbitrary point
+     */
+    static uint64_t Now() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return MonotonicNs();
+#endif
+    }
+
+    /**
+     * @brief Measure the counter frequency against CLOCK_MONOTONIC
+     *
+     * Takes about 20 ms; called once at startup.
+     */
+    static void Calibrate();
+
+    /**
+     * @brief Convert ticks to nanoseconds
+     * @param ticks Tick count
+     * @return Nanoseconds
+     */
+    static uint64_t ToNs(uint64_t ticks) { return static_cast<uint64_t>(ticks * ns_per_tick); }
+
+private:
+    static double ns_per_tick;   // Set by Calibrate()
+
+    /**
+     * @brief Read CLOCK_MONOTONIC
+     * @return Nanoseconds since an arbitrary point
+     */
+    static uint64_t MonotonicNs();
+};
+
+/**
+ * @brief Log-bucketed histogram of tick counts (HDR style)
+ *
+ * Values below SUB_BUCKETS have a bucket each; above that every power of
+ * two is split into SUB_BUCKETS linear buckets, so the relative error is
+ * at most 1/SUB_BUCKETS over the whole 64-bit range. One thread writes a
+ * histogram; any thread may read it.
+ */
+class LatencyHistogram {
+public:
+    static const int SUB_BITS = 4;
+    static const int SUB_BUCKETS = 1 << SUB_BITS;
+    static const int BUCKET_NUM = (64 - SUB_BITS + 1) * SUB_BUCKETS;
+
+    /**
+     * @brief Constructor
+     */
+    LatencyHistogram();
+
+    /**
+     * @brief Record samples of the same value
+     * @param ticks Value
+     * @param count Number of samples
+     */
+    void Record(uint64_t ticks, uint64_t count = 1) {
+        std::atomic<uint64_t>& bucket = buckets[BucketOf(ticks)];
+        bucket.store(bucket.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Add another histogram to this one
+     * @param other Histogram to add
+     */
+    void Accumulate(const LatencyHistogram& other);
+
+    /**
+     * @brief Count the samples
+     * @return Number of samples
+     */
+    uint64_t Count() const;
+
+    /**
+     * @brief Get a quantile
+     * @param q Quantile in [0, 1]
+     * @return Upper bound of the bucket holding the quantile, in ticks (0 if empty)
+     */
+    uint64_t Quantile(double q) const;
+
+    /**
+     * @brief Get the name of a stage
+     * @param stage Stage
+     * @return Name used in reports
+     */
+    static const char* StageName(int stage);
+
+private:
+    std::atomic<uint64_t> buckets[BUCKET_NUM];   // Sample count per bucket
+
+    /**
+     * @brief Get the bucket of a value
+     * @param v Value
+     * @return Bucket index
+     */
+    static int BucketOf(uint64_t v) {
+        if (v < static_cast<uint64_t>(SUB_BUCKETS)) {
+            return static_cast<int>(v);
+        }
+        int msb = 63 - __builtin_clzll(v);
+        int sub = static_cast<int>((v >> (msb - SUB_BITS)) & (SUB_BUCKETS - 1));
+        return (msb - SUB_BITS + 1) * SUB_BUCKETS + sub;
+    }
+
+    /**
+     * @brief Get the largest value of a bucket
+     * @param bucket Bucket index
+     * @return Value
+     */
+    static uint64_t BucketMax(int bucket);
+};
+
+/**
+ * @brief Histograms of every stage, owned by one worker
+ */
+class alignas(64) LatencyStats {
+public:
+    LatencyHistogram stages[LAT_STAGE_NUM];   // Histogram per LatencyStage
+
+    /**
+     * @brief Record samples for a stage
+     * @param stage Stage
+     * @param since Timestamp the stage started at
+     * @param count Number of samples
+     */
+    void Record(LatencyStage stage, uint64_t since, uint64_t count = 1) {
+        stages[stage].Record(Tsc::Now() - since, count);
+    }
+};
+
+#if ROUTER_LATENCY
+#define LATENCY_ONLY(...) __VA_ARGS__
+#define LATENCY_RECORD(stats, stage, since, count) (stats).Record((stage), (since), (count))
+#else
+#define LATENCY_ONLY(...)
+#define LATENCY_RECORD(stats, stage, since, count) ((void)0)
+#endif
+
+#endif // LATENCY_HPP
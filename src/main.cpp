@@ -4,23 +4,69 @@
  */
 
 #include <csignal>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
-#include <unistd.h> // Include for pause() function
+#include <unistd.h> // Include for read() and getopt() functions
+#include <pthread.h>
+#include <sys/signalfd.h>
+#include <arpa/inet.h>
 #include "router.hpp"
 
-// Global router instance for signal handler
-Router* g_router = nullptr;
+/**
+ * @brief Block the termination signals and open a descriptor that receives them
+ * @return signalfd or -1 on error
+ *
+ * Must run before any thread is created, so that every thread inherits
+ * the mask and the signals are only ever received through the descriptor.
+ * Nothing then runs in signal context.
+ */
+int open_signal_fd() {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGQUIT);
+    int err = pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+    if (err != 0) {
+        std::cerr << "pthread_sigmask: " << strerror(err) << std::endl;
+        return -1;
+    }
+    int fd = signalfd(-1, &signals, SFD_CLOEXEC);
+    if (fd < 0) {
+        perror("signalfd");
+    }
+    return fd;
+}
 
 /**
- * @brief Signal handler function
- * @param sig Signal number
+ * @brief Wait for a termination signal
+ * @param fd signalfd
+ * @return Signal number or -1 on error
  */
-void signal_handler(int sig) {
-    std::cout << "Received signal " << sig << ", stopping router..." << std::endl;
-    if (g_router != nullptr) {
-        g_router->Stop();
+int wait_signal(int fd) {
+    struct signalfd_siginfo info;
+    for (;;) {
+        ssize_t n = read(fd, &info, sizeof(info));
+        if (n == static_cast<ssize_t>(sizeof(info))) {
+            return static_cast<int>(info.ssi_signo);
+        }
+        if (n < 0 && errno != EINTR) {
+            perror("read:signalfd");
+            return -1;
+        }
     }
-    exit(0);
+}
+
+/**
+ * @brief Print usage
+ * @param prog Program name
+ */
+void usage(const char* prog) {
+    std::cerr << "Usage: " << prog
+              << " [-e raw|xdp] [-m read|ring|batch] [-p block|busy|adaptive] [-b burst_size] [-d prefetch_depth] [-r route_file] [-q queues] [-f hash|cpu|ebpf] [-c] [-s stats_socket] [interface interface... [next_router_ip]]" << std::endl;
 }
 
 /**
@@ -30,27 +76,108 @@ void signal_handler(int sig) {
  * @return Exit code
  */
 int main(int argc, char* argv[]) {
-    // Set signal handlers
-    signal(SIGINT, signal_handler);
-    signal(SIGTERM, signal_handler);
-    signal(SIGQUIT, signal_handler);
+    // Termination signals are read from signal_fd by the main thread
+    int signal_fd = open_signal_fd();
+    if (signal_fd < 0) {
+        return 1;
+    }
 
     // Create router configuration
     RouterConfig config;
 
-    // Override default configuration if arguments provided
-    if (argc >= 3) {
-        config.receiving_interface = argv[1];
-        config.sending_interface = argv[2];
+    // Parse options
+    int opt;
+    while ((opt = getopt(argc, argv, "e:m:p:b:d:r:q:f:cs:")) != -1) {
+        switch (opt) {
+        case 'e':
+            if (strcmp(optarg, "raw") == 0) {
+                config.io_engine = IoEngine::Raw;
+            } else if (strcmp(optarg, "xdp") == 0) {
+                config.io_engine = IoEngine::Xdp;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'm':
+            if (strcmp(optarg, "read") == 0) {
+                config.rx_mode = RxMode::Read;
+            } else if (strcmp(optarg, "ring") == 0) {
+                config.rx_mode = RxMode::Ring;
+            } else if (strcmp(optarg, "batch") == 0) {
+                config.rx_mode = RxMode::Batch;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'p':
+            if (strcmp(optarg, "block") == 0) {
+                config.poll_mode = PollMode::Block;
+            } else if (strcmp(optarg, "busy") == 0) {
+                config.poll_mode = PollMode::Busy;
+            } else if (strcmp(optarg, "adaptive") == 0) {
+                config.poll_mode = PollMode::Adaptive;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'b':
+            config.burst_size = atoi(optarg);
+            break;
+        case 'd':
+            config.prefetch_depth = atoi(optarg);
+            break;
+        case 'r':
+            config.route_file = optarg;
+            break;
+        case 'q':
+            config.queues_per_port = atoi(optarg);
+            break;
+        case 'c':
+            config.verify_checksum = true;
+            break;
+        case 's':
+            config.stats_socket = optarg;
+            break;
+        case 'f':
+            if (strcmp(optarg, "hash") == 0) {
+                config.fanout_mode = FANOUT_HASH;
+            } else if (strcmp(optarg, "cpu") == 0) {
+                config.fanout_mode = FANOUT_CPU;
+            } else if (strcmp(optarg, "ebpf") == 0) {
+                config.fanout_mode = FANOUT_EBPF;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
     }
 
-    if (argc >= 4) {
-        config.next_router = argv[3];
+    // Override default configuration if arguments provided: interfaces,
+    // optionally followed by the next router's IP address
+    int nargs = argc - optind;
+    struct in_addr addr;
+    if (nargs >= 1 && inet_aton(argv[argc - 1], &addr) != 0) {
+        config.next_router = argv[argc - 1];
+        nargs--;
+    }
+
+    if (nargs == 1) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (nargs >= 2) {
+        config.interfaces.assign(argv + optind, argv + optind + nargs);
     }
 
     // Create router instance
     Router router(config);
-    g_router = &router;
 
     // Initialize router
     std::cout << "Initializing router..." << std::endl;
@@ -68,10 +195,14 @@ int main(int argc, char* argv[]) {
 
     std::cout << "Router running. Press Ctrl+C to stop." << std::endl;
 
-    // Wait for termination signal
-    while (true) {
-        pause();
+    // Wait for termination signal, then let the workers send what is queued
+    int sig = wait_signal(signal_fd);
+    if (sig > 0) {
+        std::cout << "Received signal " << sig << ", stopping router..." << std::endl;
     }
+    router.Stop();
+    close(signal_fd);
+    std::cout << "Router stopped." << std::endl;
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,238 @@
+/**
+ * @file memory_arena.cpp
+ * @brief Implementation of the huge page backed memory of tables, pools and rings
+ */
+
+#include "memory_arena.hpp"
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <tuple>
+
+static const size_t SMALL_PAGE_SIZE = 4096;
+static const size_t HUGE_2M_SIZE = 2UL << 20;
+static const size_t HUGE_1G_SIZE = 1UL << 30;
+
+static const char* BACKING_NAMES[] = {
+    "1G hugetlb",
+    "2M hugetlb",
+    "thp",
+    "4K",
+};
+
+/**
+ * @brief Live mapping
+ */
+class ArenaMapping {
+public:
+    const char* name;     // Name given to Map()
+    size_t bytes;         // Size mapped
+    int backing;          // MemoryArena::Backing
+    int node;             // Preferred NUMA node, -1 for none
+};
+
+static std::mutex mappings_mutex;                       // Guards mappings
+static std::map<void*, ArenaMapping> mappings;          // Live mappings by address
+
+/**
+ * @brief Round a size up to a multiple of a power of two
+ * @param bytes Size
+ * @param align Power of two
+ * @return Rounded size
+ */
+static size_t RoundUp(size_t bytes, size_t align) {
+    return (bytes + align - 1) & ~(align - 1);
+}
+
+/**
+ * @brief Map anonymous memory
+ * @param len Length, a multiple of the page size of flags
+ * @param flags Extra mmap() flags
+ * @return Memory or nullptr if the mapping failed
+ */
+static void* MapAnonymous(size_t len, int flags) {
+    void* data = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+    return data == MAP_FAILED ? nullptr : data;
+}
+
+/**
+ * @brief Map 2 MB aligned anonymous memory and ask for transparent huge pages
+ * @param len Length, a multiple of 2 MB
+ * @return Memory or nullptr if the mapping failed
+ *
+ * The kernel only backs whole aligned 2 MB ranges with huge pages, so the
+ * mapping is made 2 MB larger and trimmed to an aligned range.
+ */
+static void* MapTransparent(size_t len) {
+    unsigned char* raw = static_cast<unsigned char*>(MapAnonymous(len + HUGE_2M_SIZE, 0));
+    if (raw == nullptr) {
+        return nullptr;
+    }
+    unsigned char* data = reinterpret_cast<unsigned char*>(RoundUp(reinterpret_cast<uintptr_t>(raw), HUGE_2M_SIZE));
+    size_t head = data - raw;
+    if (head > 0) {
+        munmap(raw, head);
+    }
+    if (HUGE_2M_SIZE - head > 0) {
+        munmap(data + len, HUGE_2M_SIZE - head);
+    }
+    // Only a hint: without THP the memory is still usable
+    madvise(data, len, MADV_HUGEPAGE);
+    return data;
+}
+
+/**
+ * @brief Map zeroed memory
+ * @param bytes Size in bytes
+ * @param name Name the mapping is reported under (a string literal)
+ * @param node Preferred NUMA node, -1 for the default policy
+ * @param mapped Size actually mapped (output), to be passed to Unmap()
+ * @return Page-aligned memory or nullptr on error
+ *
+ * Huge pages reserved with hugetlb are committed when the mapping is made,
+ * so a failure falls back to the next backing rather than to a fault when
+ * the memory is first touched.
+ */
+void* MemoryArena::Map(size_t bytes, const char* name, int node, size_t* mapped) {
+    void* data = nullptr;
+    size_t len = 0;
+    int backing = BACKING_SMALL;
+
+    if (bytes >= HUGE_1G_SIZE) {
+        len = RoundUp(bytes, HUGE_1G_SIZE);
+        data = MapAnonymous(len, MAP_HUGETLB | (30 << MAP_HUGE_SHIFT));
+        backing = BACKING_HUGE_1G;
+    }
+    if (data == nullptr && bytes >= HUGE_2M_SIZE) {
+        len = RoundUp(bytes, HUGE_2M_SIZE);
+        data = MapAnonymous(len, MAP_HUGETLB | (21 << MAP_HUGE_SHIFT));
+        backing = BACKING_HUGE_2M;
+    }
+    if (data == nullptr && bytes >= HUGE_2M_SIZE) {
+        len = RoundUp(bytes, HUGE_2M_SIZE);
+        data = MapTransparent(len);
+        backing = BACKING_THP;
+    }
+    if (data == nullptr) {
+        len = RoundUp(bytes > 0 ? bytes : 1, SMALL_PAGE_SIZE);
+        data = MapAnonymous(len, 0);
+        backing = BACKING_SMALL;
+    }
+    if (data == nullptr) {
+        fprintf(stderr, "mmap:%s: %zu bytes: %s\n", name, bytes, strerror(errno));
+        return nullptr;
+    }
+
+    // Before the first touch, which is when the pages are placed
+    if (node >= 0 && node < static_cast<int>(sizeof(unsigned long) * 8)) {
+        unsigned long mask = 1UL << node;
+        if (syscall(SYS_mbind, data, len, MPOL_PREFERRED, &mask, sizeof(mask) * 8 + 1, 0) < 0) {
+            perror("mbind");
+            node = -1;
+        }
+    } else {
+        node = -1;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mappings_mutex);
+        mappings[data] = ArenaMapping{name, len, backing, node};
+    }
+    *mapped = len;
+    return data;
+}
+
+/**
+ * @brief Release memory returned by Map()
+ * @param data Memory
+ * @param mapped Size returned by Map()
+ */
+void MemoryArena::Unmap(void* data, size_t mapped) {
+    if (data == nullptr) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mappings_mutex);
+        mappings.erase(data);
+    }
+    munmap(data, mapped);
+}
+
+/**
+ * @brief Get the NUMA node of a CPU
+ * @param cpu CPU number
+ * @return Node, or -1 if the CPU is unknown or the system has a single node
+ */
+int MemoryArena::CpuNode(int cpu) {
+    // "0" on a single-node system, a list such as "0-1" otherwise
+    std::ifstream online("/sys/devices/system/node/online");
+    std::string nodes;
+    if (!(online >> nodes) || nodes == "0") {
+        return -1;
+    }
+
+    std::string path = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+    DIR* dir = opendir(path.c_str());
+    if (dir == nullptr) {
+        return -1;
+    }
+    int node = -1;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        if (sscanf(entry->d_name, "node%d", &node) == 1) {
+            break;
+        }
+        node = -1;
+    }
+    closedir(dir);
+    return node;
+}
+
+/**
+ * @brief Describe every live mapping, summed by name, backing and node
+ * @return One line per group and a total, each starting with "memory: "
+ */
+std::string MemoryArena::Report() {
+    std::map<std::tuple<std::string, int, int>, std::pair<size_t, size_t>> groups;  // -> (mappings, bytes)
+    size_t total = 0;
+    size_t count;
+    {
+        std::lock_guard<std::mutex> lock(mappings_mutex);
+        count = mappings.size();
+        for (const auto& m : mappings) {
+            auto& group = groups[std::make_tuple(std::string(m.second.name), m.second.backing, m.second.node)];
+            group.first++;
+            group.second += m.second.bytes;
+            total += m.second.bytes;
+        }
+    }
+
+    char line[160];
+    snprintf(line, sizeof(line), "memory: %.1f MB in %zu mappings\n", total / 1048576.0, count);
+    std::string text = line;
+    for (const auto& g : groups) {
+        int node = std::get<2>(g.first);
+        snprintf(line, sizeof(line), "memory: %9.1f MB  %s x%zu, %s pages%s%s\n", g.second.second / 1048576.0,
+                 std::get<0>(g.first).c_str(), g.second.first, BackingName(std::get<1>(g.first)),
+                 node >= 0 ? ", node " : "", node >= 0 ? std::to_string(node).c_str() : "");
+        text += line;
+    }
+    return text;
+}
+
+/**
+ * @brief Get the name of a backing
+ * @param backing Backing
+ * @return Name used in Report()
+ */
+const char* MemoryArena::BackingName(int backing) {
+    return (backing >= 0 && backing < BACKING_NUM) ? BACKING_NAMES[backing] : "unknown";
+}
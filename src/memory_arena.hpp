@@ -0,0 +1,187 @@
+/**
+ * @file memory_arena.hpp
+ * @brief Header file for the huge page backed memory of tables, pools and rings
+ */
+
+#ifndef MEMORY_ARENA_HPP
+#define MEMORY_ARENA_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <string>
+#include <type_traits>
+
+/**
+ * @brief Source of the large, randomly accessed allocations of the router
+ *
+ * The FIB, the neighbor table, the packet pools and the port rings together
+ * span tens to hundreds of MB that are read at random, so on 4 KB pages a
+ * lookup costs a TLB miss as well as a cache miss. The arena maps every
+ * such allocation on its own, preferring, in this order:
+ *
+ *  - 1 GB hugetlb pages, for allocations of at least 1 GB
+ *  - 2 MB hugetlb pages (vm.nr_hugepages), for allocations of at least 2 MB
+ *  - 2 MB aligned anonymous memory with transparent huge pages requested
+ *  - plain anonymous memory, for small allocations
+ *
+ * A mapping given a NUMA node prefers that node's memory. Every live
+ * mapping is recorded under its name, so that the footprint can be
+ * reported. Mappings are made and released while the router is configured,
+ * never on the forwarding path.
+ */
+class MemoryArena {
+public:
+    /**
+     * @brief How a mapping is backed
+     */
+    enum Backing {
+        BACKING_HUGE_1G,      // 1 GB hugetlb pages
+        BACKING_HUGE_2M,      // 2 MB hugetlb pages
+        BACKING_THP,          // Transparent huge pages, where the kernel grants them
+        BACKING_SMALL,        // 4 KB pages
+        BACKING_NUM
+    };
+
+    /**
+     * @brief Map zeroed memory
+     * @param bytes Size in bytes
+     * @param name Name the mapping is reported under (a string literal)
+     * @param node Preferred NUMA node, -1 for the default policy
+     * @param mapped Size actually mapped (output), to be passed to Unmap()
+     * @return Page-aligned memory or nullptr on error
+     */
+    static void* Map(size_t bytes, const char* name, int node, size_t* mapped);
+
+    /**
+     * @brief Release memory returned by Map()
+     * @param data Memory
+     * @param mapped Size returned by Map()
+     */
+    static void Unmap(void* data, size_t mapped);
+
+    /**
+     * @brief Get the NUMA node of a CPU
+     * @param cpu CPU number
+     * @return Node, or -1 if the CPU is unknown or the system has a single node
+     */
+    static int CpuNode(int cpu);
+
+    /**
+     * @brief Describe every live mapping, summed by name, backing and node
+     * @return One line per group and a total, each starting with "memory: "
+     */
+    static std::string Report();
+
+    /**
+     * @brief Get the name of a backing
+     * @param backing Backing
+     * @return Name used in Report()
+     */
+    static const char* BackingName(int backing);
+};
+
+/**
+ * @brief Fixed-size array in its own MemoryArena mapping
+ *
+ * Elements are constructed in place and destroyed with the array. Trivial
+ * elements are left as the mapping provides them, zeroed, so the pages of
+ * a sparse table stay untouched until they are written.
+ *
+ * @tparam T Element type
+ */
+template <typename T>
+class ArenaArray {
+public:
+    /**
+     * @brief Constructor of an empty array
+     */
+    ArenaArray() : items(nullptr), count(0), mapped(0) {}
+
+    /**
+     * @brief Constructor
+     * @param count Number of elements
+     * @param name Name the mapping is reported under (a string literal)
+     * @param node Preferred NUMA node, -1 for the default policy
+     */
+    ArenaArray(size_t count, const char* name, int node = -1) : ArenaArray() {
+        Allocate(count, name, node);
+    }
+
+    /**
+     * @brief Destructor
+     */
+    ~ArenaArray() { Release(); }
+
+    ArenaArray(const ArenaArray&) = delete;
+    ArenaArray& operator=(const ArenaArray&) = delete;
+
+    /**
+     * @brief Replace the elements with new ones
+     * @param count Number of elements
+     * @param name Name the mapping is reported under (a string literal)
+     * @param node Preferred NUMA node, -1 for the default policy
+     * @return Success or failure code; on failure the array is empty
+     */
+    int Allocate(size_t count, const char* name, int node = -1) {
+        Release();
+        if (count == 0) {
+            return 0;
+        }
+        void* data = MemoryArena::Map(count * sizeof(T), name, node, &mapped);
+        if (data == nullptr) {
+            return -1;
+        }
+        items = static_cast<T*>(data);
+        if (!std::is_trivially_default_constructible<T>::value) {
+            for (size_t i = 0; i < count; i++) {
+                new (&items[i]) T();
+            }
+        }
+        this->count = count;
+        return 0;
+    }
+
+    T& operator[](size_t i) { return items[i]; }
+    const T& operator[](size_t i) const { return items[i]; }
+
+    /**
+     * @brief Get the first element
+     * @return Elements, nullptr if the array is empty
+     */
+    T* Data() const { return items; }
+
+    /**
+     * @brief Get the number of elements
+     * @return Number of elements
+     */
+    size_t Size() const { return count; }
+
+    T* begin() const { return items; }
+    T* end() const { return items + count; }
+
+private:
+    T* items;          // Elements
+    size_t count;      // Number of elements
+    size_t mapped;     // Size of the mapping
+
+    /**
+     * @brief Destroy the elements and unmap them
+     */
+    void Release() {
+        if (items == nullptr) {
+            return;
+        }
+        if (!std::is_trivially_destructible<T>::value) {
+            for (size_t i = 0; i < count; i++) {
+                items[i].~T();
+            }
+        }
+        MemoryArena::Unmap(items, mapped);
+        items = nullptr;
+        count = 0;
+        mapped = 0;
+    }
+};
+
+#endif // MEMORY_ARENA_HPP
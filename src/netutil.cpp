@@ -4,14 +4,26 @@
  */
 
 #include "netutil.hpp"
+#include "checksum.hpp"
 #include <arpa/inet.h>
 #include <cstring>
 #include <net/if.h>
 #include <sys/ioctl.h>
 #include <unistd.h>
-#include <netpacket/packet.h>
+#include <linux/if_packet.h>
+#include <linux/bpf.h>
+#include <sys/syscall.h>
+#include <cerrno>
 #include <iostream>
 
+// Busy poll options of Linux 5.11, missing from older headers
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69
+#endif
+#ifndef SO_BUSY_POLL_BUDGET
+#define SO_BUSY_POLL_BUDGET 70
+#endif
+
 /**
  * @brief Constructor
  */
@@ -129,9 +141,13 @@ int NetworkUtil::PrintEtherHeader(struct ether_header* eh) {
  * @param device Device name
  * @param promiscFlag Whether to enable promiscuous mode
  * @param ipOnly Whether to only capture IP packets
+ * @param fanoutMode Fanout mode, FANOUT_NONE for a standalone socket
+ * @param fanoutGroup Fanout group id, shared by all sockets of the device
+ * @param fanoutQueues Number of sockets in the group (FANOUT_EBPF only)
  * @return Socket descriptor or -1 on error
  */
-int NetworkUtil::InitRawSocket(const std::string& device, int promiscFlag, int ipOnly) {
+int NetworkUtil::InitRawSocket(const std::string& device, int promiscFlag, int ipOnly,
+                               FanoutMode fanoutMode, int fanoutGroup, int fanoutQueues) {
     struct ifreq ifr;
     struct sockaddr_ll sa;
     int soc;
@@ -185,30 +201,143 @@ int NetworkUtil::InitRawSocket(const std::string& device, int promiscFlag, int i
         }
     }
 
+    if (fanoutMode != FANOUT_NONE) {
+        if (JoinFanout(soc, fanoutMode, fanoutGroup, fanoutQueues) < 0) {
+            close(soc);
+            return -1;
+        }
+    }
+
     return soc;
 }
 
 /**
- * @brief Calculate checksum
- * @param data Data to calculate checksum for
- * @param len Length of data
- * @return Checksum value
+ * @brief Join a raw socket to a fanout group
+ * @param soc Bound socket descriptor
+ * @param fanoutMode Fanout mode
+ * @param fanoutGroup Fanout group id
+ * @param fanoutQueues Number of sockets in the group (FANOUT_EBPF only)
+ * @return Success or failure code
  */
-u_int16_t NetworkUtil::Checksum(unsigned char* data, int len) {
-    u_int32_t sum = 0;
+int NetworkUtil::JoinFanout(int soc, FanoutMode fanoutMode, int fanoutGroup, int fanoutQueues) {
+    int type;
+    switch (fanoutMode) {
+    case FANOUT_HASH:
+        type = PACKET_FANOUT_HASH;
+        break;
+    case FANOUT_CPU:
+        type = PACKET_FANOUT_CPU;
+        break;
+    case FANOUT_EBPF:
+        type = PACKET_FANOUT_EBPF;
+        break;
+    default:
+        return 0;
+    }
+
+    int arg = (fanoutGroup & 0xffff) | (type << 16);
+    if (setsockopt(soc, SOL_PACKET, PACKET_FANOUT, &arg, sizeof(arg)) < 0) {
+        perror("setsockopt:PACKET_FANOUT");
+        return -1;
+    }
 
-    for (int i = 0; i < len; i += 2) {
-        if (i + 1 < len) {
-            sum += data[i] + (data[i + 1] << 8);
-        } else {
-            sum += data[i];
+    if (fanoutMode == FANOUT_EBPF) {
+        int prog = LoadFanoutProgram(fanoutQueues);
+        if (prog < 0) {
+            return -1;
+        }
+        // The group keeps its own reference to the program
+        int ret = setsockopt(soc, SOL_PACKET, PACKET_FANOUT_DATA, &prog, sizeof(prog));
+        if (ret < 0) {
+            perror("setsockopt:PACKET_FANOUT_DATA");
+        }
+        close(prog);
+        if (ret < 0) {
+            return -1;
         }
     }
 
-    sum = (sum & 0xffff) + (sum >> 16);
-    sum = (sum & 0xffff) + (sum >> 16);
+    return 0;
+}
 
-    return ~sum;
+/**
+ * @brief Make blocking and non-blocking receives poll the device queue
+ * @param soc Socket descriptor
+ * @param usecs Time to busy poll for per call (SO_BUSY_POLL)
+ * @param budget Packets per busy poll pass (SO_BUSY_POLL_BUDGET), 0 for the default
+ * @return Success or failure code
+ */
+int NetworkUtil::SetBusyPoll(int soc, int usecs, int budget) {
+    if (setsockopt(soc, SOL_SOCKET, SO_BUSY_POLL, &usecs, sizeof(usecs)) < 0) {
+        perror("setsockopt:SO_BUSY_POLL");
+        return -1;
+    }
+
+    // Both are 5.11 additions; without them busy polling still works
+    int prefer = 1;
+    if (setsockopt(soc, SOL_SOCKET, SO_PREFER_BUSY_POLL, &prefer, sizeof(prefer)) < 0) {
+        perror("setsockopt:SO_PREFER_BUSY_POLL");
+    }
+    if (budget > 0 && setsockopt(soc, SOL_SOCKET, SO_BUSY_POLL_BUDGET, &budget, sizeof(budget)) < 0) {
+        perror("setsockopt:SO_BUSY_POLL_BUDGET");
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Load the eBPF program selecting a fanout socket by flow
+ * @param fanoutQueues Number of sockets in the group
+ * @return Program file descriptor or -1 on error
+ */
+int NetworkUtil::LoadFanoutProgram(int fanoutQueues) {
+    if (fanoutQueues < 1) {
+        fanoutQueues = 1;
+    }
+
+    // The fanout program sees the skb at its network header
+    struct bpf_insn insns[] = {
+        // r6 = ctx (required by LD_ABS); r0 = skb->hash
+        {BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_6, BPF_REG_1, 0, 0},
+        {BPF_LDX | BPF_MEM | BPF_W, BPF_REG_0, BPF_REG_1,
+         static_cast<int16_t>(offsetof(struct __sk_buff, hash)), 0},
+        {BPF_JMP | BPF_JNE | BPF_K, BPF_REG_0, 0, 5, 0},
+        // No hash yet: r0 = saddr ^ daddr (LD_ABS exits with 0 past the end)
+        {BPF_LD | BPF_ABS | BPF_W, 0, 0, 0, 12},
+        {BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_7, BPF_REG_0, 0, 0},
+        {BPF_LD | BPF_ABS | BPF_W, 0, 0, 0, 16},
+        {BPF_ALU | BPF_XOR | BPF_X, BPF_REG_0, BPF_REG_7, 0, 0},
+        {BPF_ALU | BPF_MUL | BPF_K, BPF_REG_0, 0, 0, static_cast<int32_t>(0x9e3779b1)},
+        // return r0 % fanoutQueues
+        {BPF_ALU | BPF_RSH | BPF_K, BPF_REG_0, 0, 0, 8},
+        {BPF_ALU | BPF_MOD | BPF_K, BPF_REG_0, 0, 0, fanoutQueues},
+        {BPF_JMP | BPF_EXIT, 0, 0, 0, 0},
+    };
+
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_SOCKET_FILTER;
+    attr.insns = reinterpret_cast<uint64_t>(insns);
+    attr.insn_cnt = sizeof(insns) / sizeof(insns[0]);
+    attr.license = reinterpret_cast<uint64_t>("GPL");
+
+    int prog = syscall(__NR_bpf, BPF_PROG_LOAD, &attr, sizeof(attr));
+    if (prog < 0) {
+        perror("bpf:BPF_PROG_LOAD");
+        return -1;
+    }
+
+    return prog;
+}
+
+/**
+ * @brief Calculate checksum
+ * @param data Data to calculate checksum for
+ * @param len Length of data
+ * @return Checksum value
+ */
+u_int16_t NetworkUtil::Checksum(unsigned char* data, int len) {
+    return InetChecksum::Compute(data, len);
 }
 
 /**
@@ -220,28 +349,12 @@ u_int16_t NetworkUtil::Checksum(unsigned char* data, int len) {
  * @return Checksum value
  */
 u_int16_t NetworkUtil::Checksum2(unsigned char* data1, int len1, unsigned char* data2, int len2) {
-    u_int32_t sum = 0;
-
-    for (int i = 0; i < len1; i += 2) {
-        if (i + 1 < len1) {
-            sum += data1[i] + (data1[i + 1] << 8);
-        } else {
-            sum += data1[i];
-        }
-    }
-
-    for (int i = 0; i < len2; i += 2) {
-        if (i + 1 < len2) {
-            sum += data2[i] + (data2[i + 1] << 8);
-        } else {
-            sum += data2[i];
-        }
-    }
-
-    sum = (sum & 0xffff) + (sum >> 16);
-    sum = (sum & 0xffff) + (sum >> 16);
-
-    return ~sum;
+    struct iovec iov[2];
+    iov[0].iov_base = data1;
+    iov[0].iov_len = len1;
+    iov[1].iov_base = data2;
+    iov[1].iov_len = len2;
+    return InetChecksum::Compute(iov, 2);
 }
 
 /**
@@ -252,19 +365,8 @@ u_int16_t NetworkUtil::Checksum2(unsigned char* data1, int len1, unsigned char*
  * @return 1 if checksum is valid, 0 otherwise
  */
 int NetworkUtil::CheckIPChecksum(struct iphdr* iphdr, unsigned char* option, int optionLen) {
-    unsigned char buf[BUFSIZ];
-    u_int16_t sum;
-
-    memset(buf, 0, sizeof(buf));
-    memcpy(buf, iphdr, sizeof(struct iphdr));
-    buf[10] = 0;
-    buf[11] = 0;
-
-    if (optionLen > 0) {
-        memcpy(buf + sizeof(struct iphdr), option, optionLen);
-    }
-
-    sum = Checksum(buf, sizeof(struct iphdr) + optionLen);
+    // A header that includes its own checksum sums to 0xffff
+    u_int16_t sum = Checksum2((unsigned char*)iphdr, sizeof(struct iphdr), option, optionLen);
     if (sum == 0 || sum == 0xFFFF) {
         return 1;
     } else {
@@ -276,22 +378,24 @@ int NetworkUtil::CheckIPChecksum(struct iphdr* iphdr, unsigned char* option, int
  * @brief Send ARP request
  * @param soc Socket descriptor
  * @param target_ip Target IP address
- * @param target_mac Target MAC address buffer
+ * @param target_mac Target MAC address for a unicast probe, nullptr to broadcast
  * @param my_ip My IP address
  * @param my_mac My MAC address
  * @return Success or failure code
  */
 int NetworkUtil::SendArpRequest(int soc, in_addr_t target_ip, unsigned char target_mac[6],
                                in_addr_t my_ip, unsigned char my_mac[6]) {
-    (void)target_mac;  // Suppress unused parameter warning
-
     struct ether_header eh;
     struct ether_arp arp;
     u_char buf[sizeof(struct ether_header) + sizeof(struct ether_arp)];
     u_char *p = buf;
 
-    // Set broadcast address
-    memset(eh.ether_dhost, 0xff, 6);
+    // Set broadcast address, or the cached address for a unicast probe
+    if (target_mac != nullptr) {
+        memcpy(eh.ether_dhost, target_mac, 6);
+    } else {
+        memset(eh.ether_dhost, 0xff, 6);
+    }
     memcpy(eh.ether_shost, my_mac, 6);
     eh.ether_type = htons(ETHERTYPE_ARP);
 
@@ -304,7 +408,11 @@ int NetworkUtil::SendArpRequest(int soc, in_addr_t target_ip, unsigned char targ
 
     memcpy(arp.arp_sha, my_mac, 6);
     memcpy(arp.arp_spa, &my_ip, 4);
-    memset(arp.arp_tha, 0, 6);
+    if (target_mac != nullptr) {
+        memcpy(arp.arp_tha, target_mac, 6);
+    } else {
+        memset(arp.arp_tha, 0, 6);
+    }
     memcpy(arp.arp_tpa, &target_ip, 4);
 
     // Combine Ethernet and ARP headers
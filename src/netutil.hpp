@@ -10,9 +10,20 @@
 #include <sys/socket.h>
 #include <netinet/ip.h>  // For iphdr
 #include <netinet/if_ether.h>
+#include <cstring>
 #include <string>
 #include "base.hpp"
 
+/**
+ * @brief How packets of one interface are spread over a group of raw sockets
+ */
+enum FanoutMode {
+    FANOUT_NONE,    // Single socket, no fanout group
+    FANOUT_HASH,    // Kernel flow hash
+    FANOUT_CPU,     // CPU the packet was received on
+    FANOUT_EBPF     // Flow hash computed by a small eBPF program
+};
+
 /**
  * @brief Class for network utility functions
  */
@@ -74,9 +85,48 @@ public:
      * @param device Device name
      * @param promiscFlag Whether to enable promiscuous mode
      * @param ipOnly Whether to only capture IP packets
+     * @param fanoutMode Fanout mode, FANOUT_NONE for a standalone socket
+     * @param fanoutGroup Fanout group id, shared by all sockets of the device
+     * @param fanoutQueues Number of sockets in the group (FANOUT_EBPF only)
      * @return Socket descriptor or -1 on error
      */
-    static int InitRawSocket(const std::string& device, int promiscFlag, int ipOnly);
+    static int InitRawSocket(const std::string& device, int promiscFlag, int ipOnly,
+                             FanoutMode fanoutMode = FANOUT_NONE, int fanoutGroup = 0,
+                             int fanoutQueues = 1);
+
+    /**
+     * @brief Join a raw socket to a fanout group
+     * @param soc Bound socket descriptor
+     * @param fanoutMode Fanout mode
+     * @param fanoutGroup Fanout group id
+     * @param fanoutQueues Number of sockets in the group (FANOUT_EBPF only)
+     * @return Success or failure code
+     */
+    static int JoinFanout(int soc, FanoutMode fanoutMode, int fanoutGroup, int fanoutQueues);
+
+    /**
+     * @brief Make blocking and non-blocking receives poll the device queue
+     * @param soc Socket descriptor
+     * @param usecs Time to busy poll for per call (SO_BUSY_POLL)
+     * @param budget Packets per busy poll pass (SO_BUSY_POLL_BUDGET), 0 for the default
+     * @return Success or failure code
+     *
+     * SO_PREFER_BUSY_POLL is set too where the kernel has it, so that the
+     * queue is left to the busy poller instead of interrupts while it is
+     * active.
+     */
+    static int SetBusyPoll(int soc, int usecs, int budget);
+
+    /**
+     * @brief Load the eBPF program selecting a fanout socket by flow
+     * @param fanoutQueues Number of sockets in the group
+     * @return Program file descriptor or -1 on error
+     *
+     * The program uses the skb's flow hash when the kernel has one and
+     * otherwise hashes the IPv4 addresses, so both directions of a flow land
+     * on the same socket. Non-IPv4 frames go to socket 0.
+     */
+    static int LoadFanoutProgram(int fanoutQueues);
 
     /**
      * @brief Calculate checksum
@@ -96,6 +146,51 @@ public:
      */
     static u_int16_t Checksum2(unsigned char* data1, int len1, unsigned char* data2, int len2);
 
+    /**
+     * @brief Update a checksum for one changed 16-bit word (RFC 1624)
+     * @param check Current checksum
+     * @param oldWord Word before the change
+     * @param newWord Word after the change
+     * @return Updated checksum
+     *
+     * All three values must be in the same byte order as the data.
+     */
+    static u_int16_t ChecksumAdjust(u_int16_t check, u_int16_t oldWord, u_int16_t newWord) {
+        // HC' = ~(~HC + ~m + m')
+        u_int32_t sum = static_cast<u_int16_t>(~check) + static_cast<u_int16_t>(~oldWord) + newWord;
+        sum = (sum & 0xffff) + (sum >> 16);
+        sum = (sum & 0xffff) + (sum >> 16);
+        return static_cast<u_int16_t>(~sum);
+    }
+
+    /**
+     * @brief Hash an IPv4 address to a slot of a power-of-two table
+     * @param addr Address in network byte order
+     * @param bits log2 of the table size
+     * @return Slot number, less than 1 << bits
+     *
+     * Fibonacci hashing of the address in host order: neighboring hosts
+     * differ in the low bits, which the product carries into the high bits
+     * kept here.
+     */
+    static size_t AddrHash(in_addr_t addr, int bits) {
+        uint32_t product = ntohl(addr) * 0x9E3779B9U;
+        return static_cast<size_t>(static_cast<uint64_t>(product) >> (32 - bits));
+    }
+
+    /**
+     * @brief Decrement the TTL of an IP header and update its checksum
+     * @param iphdr IP header (TTL must be at least 1)
+     */
+    static void DecrementTtl(struct iphdr* iphdr) {
+        // TTL shares its 16-bit word with the protocol field
+        u_int16_t old_word, new_word;
+        memcpy(&old_word, &iphdr->ttl, sizeof(old_word));
+        iphdr->ttl--;
+        memcpy(&new_word, &iphdr->ttl, sizeof(new_word));
+        iphdr->check = ChecksumAdjust(iphdr->check, old_word, new_word);
+    }
+
     /**
      * @brief Check IP header checksum
      * @param iphdr IP header
@@ -109,7 +204,7 @@ public:
      * @brief Send ARP request
      * @param soc Socket descriptor
      * @param target_ip Target IP address
-     * @param target_mac Target MAC address buffer
+     * @param target_mac Target MAC address for a unicast probe, nullptr to broadcast
      * @param my_ip My IP address
      * @param my_mac My MAC address
      * @return Success or failure code
@@ -0,0 +1,228 @@
+/**
+ * @file packet_io.cpp
+ * @brief Implementation of the raw socket packet I/O engine
+ */
+
+#include "packet_io.hpp"
+#include "async_log.hpp"
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Frame slot size of the RX ring
+static const unsigned int RX_RING_FRAME_SIZE = 2048;
+
+// Blocks walked per loop iteration before the inbound rings are serviced
+static const int RX_RING_BLOCKS_PER_POLL = 8;
+
+/**
+ * @brief Constructor
+ * @param mode Receive mode
+ * @param burst_size Frames received per recvmmsg() call
+ * @param stats Counters of the worker using the engine (drops)
+ */
+RawPacketIO::RawPacketIO(RxMode mode, int burst_size, WorkerStats* stats)
+    : mode(mode), burst_size(burst_size), stats(stats), soc(-1),
+      rx_batch(mode == RxMode::Batch ? burst_size : 1), rx_done(false), ring_blocks(0),
+      ring_pkt(nullptr), ring_left(0) {
+}
+
+/**
+ * @brief Destructor
+ */
+RawPacketIO::~RawPacketIO() {
+    rx_ring.Teardown();
+    if (soc >= 0) {
+        close(soc);
+    }
+}
+
+/**
+ * @brief Open the socket and set up the receive mode
+ * @param device Device name
+ * @param ring_block_size RX ring block size in bytes (RxMode::Ring only)
+ * @param ring_block_num RX ring block count (RxMode::Ring only)
+ * @param fanout Fanout mode, FANOUT_NONE for a standalone socket
+ * @param fanout_group Fanout group id, shared by all sockets of the device
+ * @param fanout_queues Number of sockets in the group
+ * @return Success or failure code
+ */
+int RawPacketIO::Open(const std::string& device, unsigned int ring_block_size, unsigned int ring_block_num,
+                      FanoutMode fanout, int fanout_group, int fanout_queues) {
+    soc = NetworkUtil::InitRawSocket(device.c_str(), 1, 0);
+    if (soc < 0) {
+        perror("InitRawSocket");
+        return -1;
+    }
+
+    // Attach transmit batch
+    tx_batch.Attach(soc);
+
+    // Attach receive ring
+    if (mode == RxMode::Ring &&
+        rx_ring.Setup(soc, ring_block_size, ring_block_num, RX_RING_FRAME_SIZE) < 0) {
+        fprintf(stderr, "RxRing::Setup:%s failed\n", device.c_str());
+        return -1;
+    }
+
+    // Join the fanout group once the ring is in place
+    if (fanout != FANOUT_NONE && NetworkUtil::JoinFanout(soc, fanout, fanout_group, fanout_queues) < 0) {
+        fprintf(stderr, "JoinFanout:%s failed\n", device.c_str());
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Receive frames
+ * @param frames Frame pointers (output)
+ * @param sizes Frame lengths (output)
+ * @param max Maximum number of frames
+ * @return Number of frames received, 0 when none are left for this loop
+ *         iteration, or -1 on error
+ *
+ * Between two Free() calls a read() engine hands out one frame, a batch
+ * engine one recvmmsg() and a ring engine up to RX_RING_BLOCKS_PER_POLL
+ * blocks.
+ */
+int RawPacketIO::RxBurst(u_char** frames, int* sizes, int max) {
+    if (rx_done || max <= 0) {
+        return 0;
+    }
+
+    switch (mode) {
+    case RxMode::Ring:
+        return ReceiveRing(frames, sizes, max);
+    case RxMode::Batch:
+        rx_done = true;
+        return ReceiveBatch(frames, sizes, max);
+    default:
+        rx_done = true;
+        return ReceiveRead(frames, sizes);
+    }
+}
+
+/**
+ * @brief Receive one frame with recv()
+ * @param frames Frame pointer (output)
+ * @param sizes Frame length (output)
+ * @return Number of frames received or -1 on error
+ */
+int RawPacketIO::ReceiveRead(u_char** frames, int* sizes) {
+    // MSG_TRUNC makes a packet socket return the full frame length, so that a
+    // frame larger than the buffer is dropped instead of forwarded cut short
+    int size = recv(soc, rx_buf, sizeof(rx_buf), MSG_TRUNC | MSG_DONTWAIT);
+    if (size < 0) {
+        if (errno == EAGAIN || errno == EINTR) {
+            return 0;
+        }
+        LOG_ERROR_LIMITED("recv: %s\n", strerror(errno));
+        return -1;
+    }
+    if (size > static_cast<int>(sizeof(rx_buf))) {
+        LOG_DEBUG_LIMITED("frame(%d) truncated, dropped\n", size);
+        stats->Drop(DROP_TRUNCATED);
+        return 0;
+    }
+    if (size == 0) {
+        return 0;
+    }
+
+    frames[0] = rx_buf;
+    sizes[0] = size;
+    return 1;
+}
+
+/**
+ * @brief Take frames from the RX ring
+ * @param frames Frame pointers (output)
+ * @param sizes Frame lengths (output)
+ * @param max Maximum number of frames
+ * @return Number of frames taken
+ *
+ * Frames are read in place in the mapping, so there is neither a syscall
+ * nor a copy per packet. A block may be split over several calls; the
+ * blocks go back to the kernel in Free().
+ */
+int RawPacketIO::ReceiveRing(u_char** frames, int* sizes, int max) {
+    int n = 0;
+
+    while (n < max) {
+        if (ring_left == 0) {
+            if (ring_blocks == RX_RING_BLOCKS_PER_POLL) {
+                rx_done = true;
+                break;
+            }
+            struct tpacket_block_desc* block = rx_ring.NextBlock();
+            if (block == nullptr) {
+                rx_done = true;
+                break;
+            }
+            ring_blocks++;
+            ring_left = block->hdr.bh1.num_pkts;
+            ring_pkt = RxRing::FirstPacket(block);
+            continue;
+        }
+
+        if (RxRing::IsTruncated(ring_pkt)) {
+            LOG_DEBUG_LIMITED("frame(%u) truncated, dropped\n", ring_pkt->tp_len);
+            stats->Drop(DROP_TRUNCATED);
+        } else if (!RxRing::IsOutgoing(ring_pkt)) {
+            // Our own transmissions, looped back to ETH_P_ALL sockets, are skipped
+            frames[n] = RxRing::PacketData(ring_pkt);
+            sizes[n] = ring_pkt->tp_snaplen;
+            n++;
+        }
+        ring_pkt = RxRing::NextPacket(ring_pkt);
+        ring_left--;
+    }
+
+    return n;
+}
+
+/**
+ * @brief Receive frames with recvmmsg()
+ * @param frames Frame pointers (output)
+ * @param sizes Frame lengths (output)
+ * @param max Maximum number of frames
+ * @return Number of frames received or -1 on error
+ */
+int RawPacketIO::ReceiveBatch(u_char** frames, int* sizes, int max) {
+    int received = rx_batch.Receive(soc, max < burst_size ? max : burst_size);
+    if (received < 0) {
+        // Logged by RxBatch::Receive()
+        return -1;
+    }
+
+    int n = 0;
+    for (int i = 0; i < received; i++) {
+        if (rx_batch.IsTruncated(i)) {
+            LOG_DEBUG_LIMITED("frame truncated, dropped\n");
+            stats->Drop(DROP_TRUNCATED);
+        } else if (!rx_batch.IsOutgoing(i)) {
+            frames[n] = rx_batch.Data(i);
+            sizes[n] = rx_batch.Length(i);
+            n++;
+        }
+    }
+
+    return n;
+}
+
+/**
+ * @brief Give the frames received since the last call back to the engine
+ *
+ * Ring blocks are handed back to the kernel; the read() and recvmmsg()
+ * buffers are simply reused by the next RxBurst().
+ */
+void RawPacketIO::Free() {
+    if (mode == RxMode::Ring) {
+        // Callers drain RxBurst() first, so no block is left half walked
+        ring_left = 0;
+        rx_ring.ReleaseBlocks();
+    }
+    ring_blocks = 0;
+    rx_done = false;
+}
@@ -0,0 +1,231 @@
+/**
+ * @file packet_io.hpp
+ * @brief Header file for the packet I/O engines of a port queue
+ */
+
+#ifndef PACKET_IO_HPP
+#define PACKET_IO_HPP
+
+#include <sys/types.h>
+#include <cstddef>
+#include <string>
+#include "netutil.hpp"
+#include "rx_ring.hpp"
+#include "rx_batch.hpp"
+#include "tx_batch.hpp"
+#include "stats.hpp"
+
+/**
+ * @brief Packet receive mode of the raw socket engine
+ */
+enum class RxMode {
+    Read,    // One read() syscall per packet
+    Ring,    // PACKET_MMAP (TPACKET_V3) receive ring
+    Batch    // recvmmsg() bursts
+};
+
+/**
+ * @brief Packet I/O engine
+ */
+enum class IoEngine {
+    Raw,     // AF_PACKET socket (RawPacketIO)
+    Xdp      // AF_XDP socket over a shared UMEM (XdpPacketIO)
+};
+
+/**
+ * @brief Frame I/O of one port queue
+ *
+ * A worker loop receives with RxBurst() until it returns 0, stages what
+ * it forwards, sends the batch with TxBurst() and finally returns the
+ * received frames with Free(). Received frames are lent to the caller until
+ * Free(); staged frames must stay valid until TxBurst(). Every engine limits
+ * how much RxBurst() hands out between two Free() calls, so that the other
+ * work of the loop is not starved. An engine is used by a single thread,
+ * except ControlFd(), which any thread may send control frames on.
+ */
+class PacketIO {
+public:
+    /**
+     * @brief Destructor
+     */
+    virtual ~PacketIO() {}
+
+    /**
+     * @brief Get the descriptor to poll() for received frames
+     * @return File descriptor
+     */
+    virtual int Fd() const = 0;
+
+    /**
+     * @brief Get the packet socket ARP is sent and received on
+     * @return Socket descriptor, Fd() when frames of every type share it,
+     *         or -1 if this queue has none
+     */
+    virtual int ControlFd() const = 0;
+
+    /**
+     * @brief Receive frames
+     * @param frames Frame pointers (output)
+     * @param sizes Frame lengths (output)
+     * @param max Maximum number of frames
+     * @return Number of frames received, 0 when none are left for this loop
+     *         iteration, or -1 on error
+     */
+    virtual int RxBurst(u_char** frames, int* sizes, int max) = 0;
+
+    /**
+     * @brief Stage a frame for transmission
+     * @param data Frame data (must stay valid until the next TxBurst())
+     * @param len Frame length
+     * @return Success or failure code
+     */
+    virtual int Stage(u_char* data, int len) = 0;
+
+    /**
+     * @brief Reserve engine-owned storage for a frame built in place
+     * @return Pointer to TxBatch::TX_SLOT_SIZE bytes or nullptr if none is left
+     */
+    virtual u_char* Reserve() = 0;
+
+    /**
+     * @brief Stage the frame previously written into Reserve() storage
+     * @param len Frame length
+     * @return Success or failure code
+     */
+    virtual int Commit(int len) = 0;
+
+    /**
+     * @brief Send all staged frames
+     * @param frames Frames handed to the kernel (output, optional)
+     * @param bytes Bytes of those frames (output, optional)
+     * @param rejected Frames the kernel refused to send (output, optional)
+     * @return Number of frames sent or -1 on error
+     */
+    virtual int TxBurst(size_t* frames = nullptr, size_t* bytes = nullptr, size_t* rejected = nullptr) = 0;
+
+    /**
+     * @brief Get the number of staged frames
+     * @return Number of frames TxBurst() would send
+     */
+    virtual size_t Pending() const = 0;
+
+    /**
+     * @brief Give the frames received since the last call back to the engine
+     */
+    virtual void Free() = 0;
+
+    /**
+     * @brief Take a received frame out of the engine
+     * @param data Frame returned by RxBurst()
+     * @return true if the frame now belongs to the caller, who must pass it
+     *         to Stage() of an engine sharing the buffers or to Release();
+     *         false if it is only lent until Free() and has to be copied
+     */
+    virtual bool Detach(u_char* data) { (void)data; return false; }
+
+    /**
+     * @brief Return a frame taken with Detach() that will not be sent
+     * @param data Frame data
+     */
+    virtual void Release(u_char* data) { (void)data; }
+
+    /**
+     * @brief Get the engine name
+     * @return Name for diagnostics
+     */
+    virtual const char* Name() const = 0;
+};
+
+/**
+ * @brief Engine over an AF_PACKET socket
+ *
+ * Frames are received with read(), from a TPACKET_V3 ring or with
+ * recvmmsg(), and sent by reference with TxBatch. Every frame type,
+ * including ARP, arrives on the one socket.
+ */
+class RawPacketIO : public PacketIO {
+public:
+    /**
+     * @brief Constructor
+     * @param mode Receive mode
+     * @param burst_size Frames received per recvmmsg() call
+     * @param stats Counters of the worker using the engine (drops)
+     */
+    RawPacketIO(RxMode mode, int burst_size, WorkerStats* stats);
+
+    /**
+     * @brief Destructor
+     */
+    ~RawPacketIO() override;
+
+    RawPacketIO(const RawPacketIO&) = delete;
+    RawPacketIO& operator=(const RawPacketIO&) = delete;
+
+    /**
+     * @brief Open the socket and set up the receive mode
+     * @param device Device name
+     * @param ring_block_size RX ring block size in bytes (RxMode::Ring only)
+     * @param ring_block_num RX ring block count (RxMode::Ring only)
+     * @param fanout Fanout mode, FANOUT_NONE for a standalone socket
+     * @param fanout_group Fanout group id, shared by all sockets of the device
+     * @param fanout_queues Number of sockets in the group
+     * @return Success or failure code
+     */
+    int Open(const std::string& device, unsigned int ring_block_size, unsigned int ring_block_num,
+             FanoutMode fanout, int fanout_group, int fanout_queues);
+
+    int Fd() const override { return soc; }
+    int ControlFd() const override { return soc; }
+    int RxBurst(u_char** frames, int* sizes, int max) override;
+    int Stage(u_char* data, int len) override { return tx_batch.Stage(data, len); }
+    u_char* Reserve() override { return tx_batch.Reserve(); }
+    int Commit(int len) override { return tx_batch.Commit(len); }
+    int TxBurst(size_t* frames = nullptr, size_t* bytes = nullptr, size_t* rejected = nullptr) override {
+        return tx_batch.Flush(frames, bytes, rejected);
+    }
+    size_t Pending() const override { return tx_batch.Pending(); }
+    void Free() override;
+    const char* Name() const override { return "raw"; }
+
+private:
+    RxMode mode;                         // Receive mode
+    int burst_size;                      // Frames received per recvmmsg() call
+    WorkerStats* stats;                  // Counters of the worker using the engine
+    int soc;                             // Packet socket
+    RxRing rx_ring;                      // RX ring (RxMode::Ring only)
+    RxBatch rx_batch;                    // RX batch (RxMode::Batch only)
+    TxBatch tx_batch;                    // Frames staged for this port
+    bool rx_done;                        // RxBurst() has nothing more until Free()
+    int ring_blocks;                     // Ring blocks taken since Free()
+    struct tpacket3_hdr* ring_pkt;       // Next frame of the current ring block
+    uint32_t ring_left;                  // Frames left in the current ring block
+    u_char rx_buf[2048];                 // Receive buffer (RxMode::Read only)
+
+    /**
+     * @brief Receive one frame with recv()
+     * @param frames Frame pointer (output)
+     * @param sizes Frame length (output)
+     * @return Number of frames received or -1 on error
+     */
+    int ReceiveRead(u_char** frames, int* sizes);
+
+    /**
+     * @brief Take frames from the RX ring
+     * @param frames Frame pointers (output)
+     * @param sizes Frame lengths (output)
+     * @param max Maximum number of frames
+     * @return Number of frames taken
+     */
+    int ReceiveRing(u_char** frames, int* sizes, int max);
+
+    /**
+     * @brief Receive frames with recvmmsg()
+     * @param frames Frame pointers (output)
+     * @param sizes Frame lengths (output)
+     * @param max Maximum number of frames
+     * @return Number of frames received or -1 on error
+     */
+    int ReceiveBatch(u_char** frames, int* sizes, int max);
+};
+
+#endif // PACKET_IO_HPP
@@ -0,0 +1,93 @@
+/**
+ * @file packet_parser.hpp
+ * @brief Header file for the parser of the forwarding fast path
+ */
+
+#ifndef PACKET_PARSER_HPP
+#define PACKET_PARSER_HPP
+
+#include <sys/types.h>
+#include <net/ethernet.h>
+#include <netinet/ip.h>
+#include <arpa/inet.h>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include "checksum.hpp"
+
+/**
+ * @brief Parser of the frames the forwarding fast path handles
+ *
+ * The fast path covers the common case: a frame addressed to the port that
+ * carries an IPv4 datagram with a 20-byte header and a TTL above 1. All of
+ * it is read at fixed offsets and combined into one verdict, so matching
+ * costs a single branch on the frame contents. Frames that do not match,
+ * ARP, options, expiring TTLs and malformed headers alike, are left to the
+ * general path, which classifies them and counts the drops.
+ *
+ * @tparam VerifyChecksum Verify the IPv4 header checksum as well
+ */
+template <bool VerifyChecksum>
+class FastPathParser {
+public:
+    static constexpr uint32_t ETHER_LEN = sizeof(struct ether_header);  // Ethernet header length
+    static constexpr uint32_t IP_LEN = sizeof(struct iphdr);            // IPv4 header length without options
+    static constexpr uint32_t MIN_LEN = ETHER_LEN + IP_LEN;             // Shortest frame matched
+
+    /**
+     * @brief Check whether a frame can take the fast path
+     * @param data Frame data
+     * @param len Frame length
+     * @param port_mac MAC address of the receiving port
+     * @return IPv4 header of the frame, or nullptr if the frame needs the general path
+     */
+    static struct iphdr* Match(u_char* data, uint32_t len, const u_char port_mac[6]) {
+        if (len < MIN_LEN) {
+            return nullptr;
+        }
+        struct iphdr* ip_hdr = reinterpret_cast<struct iphdr*>(data + ETHER_LEN);
+
+        uint32_t dhost_hi, port_hi;
+        uint16_t dhost_lo, port_lo, ether_type;
+        memcpy(&dhost_hi, data, sizeof(dhost_hi));
+        memcpy(&dhost_lo, data + 4, sizeof(dhost_lo));
+        memcpy(&port_hi, port_mac, sizeof(port_hi));
+        memcpy(&port_lo, port_mac + 4, sizeof(port_lo));
+        memcpy(&ether_type, data + offsetof(struct ether_header, ether_type), sizeof(ether_type));
+        uint32_t tot_len = ntohs(ip_hdr->tot_len);
+
+        bool match = ((dhost_hi ^ port_hi) | static_cast<uint32_t>(dhost_lo ^ port_lo)) == 0;
+        match &= ether_type == ETHERTYPE_IP_NET;
+        match &= data[ETHER_LEN] == VERSION_IHL;
+        match &= (tot_len >= IP_LEN) & (tot_len <= len - ETHER_LEN);
+        match &= ip_hdr->ttl > 1;
+        if constexpr (VerifyChecksum) {
+            match &= HeaderSum(data + ETHER_LEN) == 0xffff;
+        }
+
+        return match ? ip_hdr : nullptr;
+    }
+
+private:
+    // ETHERTYPE_IP as it appears in the frame, read in host byte order
+    static constexpr uint16_t ETHERTYPE_IP_NET =
+        __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ ? ((ETHERTYPE_IP >> 8) | ((ETHERTYPE_IP & 0xff) << 8)) : ETHERTYPE_IP;
+    static constexpr u_char VERSION_IHL = (4 << 4) | (IP_LEN / 4);       // First byte of a header without options
+
+    /**
+     * @brief Sum an IPv4 header without options
+     * @param ip IP header
+     * @return Ones' complement sum, 0xffff if the checksum is valid
+     */
+    static uint16_t HeaderSum(const u_char* ip) {
+        uint64_t sum = 0;
+        for (uint32_t off = 0; off < IP_LEN; off += sizeof(uint32_t)) {
+            uint32_t word;
+            memcpy(&word, ip + off, sizeof(word));
+            sum += word;
+        }
+        return InetChecksum::Fold(sum);
+    }
+};
+
+#endif // PACKET_PARSER_HPP
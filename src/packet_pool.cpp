@@ -0,0 +1,81 @@
+/**
+ * @file packet_pool.cpp
+ * @brief Implementation of the fixed-size packet buffer pool
+ */
+
+#include "packet_pool.hpp"
+
+/**
+ * @brief Constructor
+ * @param count Number of buffers
+ * @param name Name the buffer area is reported under by MemoryArena (a string literal)
+ */
+PacketPool::PacketPool(size_t count, const char* name)
+    : count(count), buffers(nullptr), lengths(new int[count]()),
+      next(new std::atomic<uint32_t>[count]), top(INDEX_NONE), free_count(0) {
+    LATENCY_ONLY(stamps.reset(new uint64_t[count]()));
+
+    // Page aligned, so that the pool can be registered as AF_XDP UMEM; a
+    // frame then never shares a cache line with its neighbor either
+    if (memory.Allocate(count * BUF_SIZE, name) < 0) {
+        this->count = 0;
+        return;
+    }
+    buffers = memory.Data();
+
+    // Chain every buffer, lowest index on top
+    for (size_t i = 0; i < count; i++) {
+        next[i].store(i + 1 < count ? static_cast<uint32_t>(i + 1) : INDEX_NONE, std::memory_order_relaxed);
+    }
+    top.store(count > 0 ? 0 : INDEX_NONE, std::memory_order_release);
+    free_count.store(count, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Destructor
+ */
+PacketPool::~PacketPool() {
+}
+
+/**
+ * @brief Take a buffer from the pool
+ * @return Buffer index or -1 if the pool is exhausted
+ */
+int PacketPool::Alloc() {
+    uint64_t old_top = top.load(std::memory_order_acquire);
+    uint64_t new_top;
+    uint32_t index;
+
+    do {
+        index = static_cast<uint32_t>(old_top);
+        if (index == INDEX_NONE) {
+            return -1;
+        }
+        // next[index] may be rewritten by a concurrent Alloc()/Free(); the
+        // tag then no longer matches and the exchange fails
+        uint32_t tag = static_cast<uint32_t>(old_top >> 32) + 1;
+        new_top = (static_cast<uint64_t>(tag) << 32) | next[index].load(std::memory_order_relaxed);
+    } while (!top.compare_exchange_weak(old_top, new_top, std::memory_order_acquire,
+                                        std::memory_order_acquire));
+
+    free_count.fetch_sub(1, std::memory_order_relaxed);
+    return static_cast<int>(index);
+}
+
+/**
+ * @brief Return a buffer to the pool
+ * @param index Buffer index returned by Alloc()
+ */
+void PacketPool::Free(int index) {
+    uint64_t old_top = top.load(std::memory_order_relaxed);
+    uint64_t new_top;
+
+    do {
+        next[index].store(static_cast<uint32_t>(old_top), std::memory_order_relaxed);
+        uint32_t tag = static_cast<uint32_t>(old_top >> 32) + 1;
+        new_top = (static_cast<uint64_t>(tag) << 32) | static_cast<uint32_t>(index);
+    } while (!top.compare_exchange_weak(old_top, new_top, std::memory_order_release,
+                                        std::memory_order_relaxed));
+
+    free_count.fetch_add(1, std::memory_order_relaxed);
+}
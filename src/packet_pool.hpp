@@ -0,0 +1,136 @@
+/**
+ * @file packet_pool.hpp
+ * @brief Header file for the fixed-size packet buffer pool
+ */
+
+#ifndef PACKET_POOL_HPP
+#define PACKET_POOL_HPP
+
+#include <sys/types.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include "latency.hpp"
+#include "memory_arena.hpp"
+
+/**
+ * @brief Preallocated pool of MTU-sized packet buffers
+ *
+ * Buffers are named by index. Free buffers form a lock-free stack whose
+ * head carries a modification tag, so Alloc() and Free() may be called
+ * from any thread without ABA problems.
+ */
+class PacketPool {
+public:
+    static const int BUF_SIZE = 2048;               // Size of one buffer
+    static const uint32_t INDEX_NONE = 0xffffffff;  // End of the free stack
+
+    /**
+     * @brief Constructor
+     * @param count Number of buffers
+     * @param name Name the buffer area is reported under by MemoryArena (a string literal)
+     */
+    explicit PacketPool(size_t count, const char* name = "packet pool");
+
+    /**
+     * @brief Destructor
+     */
+    ~PacketPool();
+
+    PacketPool(const PacketPool&) = delete;
+    PacketPool& operator=(const PacketPool&) = delete;
+
+    /**
+     * @brief Take a buffer from the pool
+     * @return Buffer index or -1 if the pool is exhausted
+     */
+    int Alloc();
+
+    /**
+     * @brief Return a buffer to the pool
+     * @param index Buffer index returned by Alloc()
+     */
+    void Free(int index);
+
+    /**
+     * @brief Get a buffer
+     * @param index Buffer index
+     * @return Pointer to BUF_SIZE bytes
+     */
+    u_char* Data(int index) { return buffers + static_cast<size_t>(index) * BUF_SIZE; }
+
+    /**
+     * @brief Get the buffer a pointer points into
+     * @param data Pointer
+     * @return Buffer index or -1 if the pointer is outside the pool
+     */
+    int Index(const u_char* data) const {
+        if (data < buffers || data >= buffers + count * BUF_SIZE) {
+            return -1;
+        }
+        return static_cast<int>((data - buffers) / BUF_SIZE);
+    }
+
+    /**
+     * @brief Get the start of the buffer area
+     * @return Pointer to Capacity() * BUF_SIZE bytes
+     */
+    u_char* Base() { return buffers; }
+
+    /**
+     * @brief Get the length recorded for a buffer
+     * @param index Buffer index
+     * @return Length in bytes
+     */
+    int Length(int index) const { return lengths[index]; }
+
+    /**
+     * @brief Record the length of a buffer's contents
+     * @param index Buffer index
+     * @param length Length in bytes (at most BUF_SIZE)
+     */
+    void SetLength(int index, int length) { lengths[index] = length; }
+
+#if ROUTER_LATENCY
+    /**
+     * @brief Get the timestamp recorded for a buffer
+     * @param index Buffer index
+     * @return Tsc::Now() when the buffer was filled
+     */
+    uint64_t Stamp(int index) const { return stamps[index]; }
+
+    /**
+     * @brief Record when a buffer was filled
+     * @param index Buffer index
+     * @param ticks Tsc::Now() value
+     */
+    void SetStamp(int index, uint64_t ticks) { stamps[index] = ticks; }
+#endif
+
+    /**
+     * @brief Get the number of buffers
+     * @return Number of buffers
+     */
+    size_t Capacity() const { return count; }
+
+    /**
+     * @brief Get the number of free buffers
+     * @return Number of free buffers (a snapshot under concurrency)
+     */
+    size_t FreeCount() const { return free_count.load(std::memory_order_relaxed); }
+
+private:
+    size_t count;                                   // Number of buffers
+    ArenaArray<u_char> memory;                      // Mapping of the buffer area, on huge pages
+    u_char* buffers;                                // count * BUF_SIZE bytes in memory
+    std::unique_ptr<int[]> lengths;                 // Length of each buffer's contents
+#if ROUTER_LATENCY
+    std::unique_ptr<uint64_t[]> stamps;             // When each buffer was filled
+#endif
+    std::unique_ptr<std::atomic<uint32_t>[]> next;  // Next free buffer of each free buffer
+    std::atomic<uint64_t> top;                      // tag << 32 | index of the first free buffer
+    std::atomic<size_t> free_count;                 // Number of free buffers
+};
+
+#endif // PACKET_POOL_HPP
@@ -0,0 +1,102 @@
+/**
+ * @file rcu.hpp
+ * @brief Quiescent-state-based reclamation of objects shared with workers
+ */
+
+#ifndef RCU_HPP
+#define RCU_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+/**
+ * @brief Grace periods between lock-free readers and one writer (QSBR)
+ *
+ * A writer publishes a replacement with an atomic pointer store and calls
+ * Synchronize() before freeing the old object. Readers take no lock: each
+ * loads the pointer when it starts a unit of work and reports a quiescent
+ * state with Quiescent() once it holds no pointer any more, or marks itself
+ * Offline() while it sleeps. Synchronize() returns once every reader has
+ * been quiescent or offline since the pointer was replaced, so no reader
+ * can still use the old object.
+ *
+ * Readers pay one store per report; all the waiting is done by the writer.
+ */
+class Rcu {
+public:
+    /**
+     * @brief Constructor
+     * @param readers Number of reader threads; every reader starts offline
+     */
+    explicit Rcu(size_t readers) : reader_num(readers), epoch(1), states(new State[readers]) {
+        for (size_t i = 0; i < readers; i++) {
+            states[i].epoch.store(OFFLINE, std::memory_order_relaxed);
+        }
+    }
+
+    Rcu(const Rcu&) = delete;
+    Rcu& operator=(const Rcu&) = delete;
+
+    /**
+     * @brief Report that a reader holds no published pointer (reader only)
+     * @param reader Reader index
+     */
+    void Quiescent(size_t reader) {
+        states[reader].epoch.store(epoch.load(std::memory_order_acquire), std::memory_order_release);
+    }
+
+    /**
+     * @brief Stop taking part in grace periods, e.g. before sleeping (reader only)
+     * @param reader Reader index
+     */
+    void Offline(size_t reader) {
+        states[reader].epoch.store(OFFLINE, std::memory_order_release);
+    }
+
+    /**
+     * @brief Take part in grace periods again; must precede loading a published pointer (reader only)
+     * @param reader Reader index
+     */
+    void Online(size_t reader) {
+        // A writer either sees us online or has published before we load
+        states[reader].epoch.store(epoch.load(std::memory_order_acquire), std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    /**
+     * @brief Wait until no reader can hold an object unpublished before the call (writer only)
+     */
+    void Synchronize() {
+        uint64_t target = epoch.fetch_add(1, std::memory_order_seq_cst) + 1;
+        for (size_t i = 0; i < reader_num; i++) {
+            for (;;) {
+                uint64_t seen = states[i].epoch.load(std::memory_order_seq_cst);
+                if (seen == OFFLINE || seen >= target) {
+                    break;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+    }
+
+private:
+    static const uint64_t OFFLINE = 0;    // Reader epoch while it is offline
+
+    /**
+     * @brief Last epoch a reader reported, on a cache line of its own
+     */
+    class alignas(64) State {
+    public:
+        std::atomic<uint64_t> epoch;
+    };
+
+    size_t reader_num;                    // Number of readers
+    std::atomic<uint64_t> epoch;          // Current grace period, advanced by Synchronize()
+    std::unique_ptr<State[]> states;      // Reader states, by reader index
+};
+
+#endif // RCU_HPP
@@ -0,0 +1,60 @@
+/**
+ * @file route_cache.cpp
+ * @brief Implementation of the per-worker route result cache
+ */
+
+#include "route_cache.hpp"
+#include <cstring>
+
+/**
+ * @brief Constructor
+ * @param size Number of entries, rounded up to a power of two
+ * @param node Preferred NUMA node of the entries, -1 for the default policy
+ */
+RouteCache::RouteCache(size_t size, int node) {
+    size_t n = 1;
+    bits = 0;
+    while (n < size) {
+        n <<= 1;
+        bits++;
+    }
+    entries.Allocate(n, "route cache", node);
+    Clear();
+}
+
+/**
+ * @brief Destructor
+ */
+RouteCache::~RouteCache() {
+}
+
+/**
+ * @brief Store a forwarding decision, replacing the slot's entry
+ * @param dst Destination address
+ * @param generation Generation read before the lookups that produced the decision
+ * @param device_number Egress device
+ * @param neighbor Neighbor the header was taken from
+ * @param header Ethernet header
+ */
+void RouteCache::Insert(in_addr_t dst, uint64_t generation, int device_number, IP2MAC* neighbor,
+                        const unsigned char header[IP2MAC_L2_SIZE]) {
+    Entry& e = entries[Slot(dst)];
+    e.generation = generation;
+    e.dst = dst;
+    e.device_number = device_number;
+    e.neighbor = neighbor;
+    memcpy(e.header, header, IP2MAC_L2_SIZE);
+}
+
+/**
+ * @brief Drop every entry
+ */
+void RouteCache::Clear() {
+    for (Entry& e : entries) {
+        e.generation = GENERATION_NONE;
+        e.dst = 0;
+        e.device_number = -1;
+        e.neighbor = nullptr;
+        memset(e.header, 0, IP2MAC_L2_SIZE);
+    }
+}
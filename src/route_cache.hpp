@@ -0,0 +1,101 @@
+/**
+ * @file route_cache.hpp
+ * @brief Header file for the per-worker route result cache
+ */
+
+#ifndef ROUTE_CACHE_HPP
+#define ROUTE_CACHE_HPP
+
+#include <netinet/in.h>
+#include <cstddef>
+#include <cstdint>
+#include "base.hpp"
+#include "netutil.hpp"
+#include "memory_arena.hpp"
+
+/**
+ * @brief Direct-mapped cache from destination address to egress port and
+ *        Ethernet header
+ *
+ * A hit replaces both the FIB lookup and the neighbor lookup. Every entry
+ * records the generation of the FIB and the neighbor table it was filled
+ * from; a change to either makes every older entry miss. Each worker owns
+ * its cache, so it is neither locked nor shared between cores.
+ */
+class RouteCache {
+public:
+    /**
+     * @brief Cached forwarding decision, one cache line each
+     */
+    struct alignas(64) Entry {
+        uint64_t generation;                        // Generation filled in, GENERATION_NONE if empty
+        in_addr_t dst;                              // Destination address
+        int device_number;                          // Egress device
+        IP2MAC* neighbor;                           // Neighbor, marked referenced on every hit
+        unsigned char header[IP2MAC_L2_SIZE];       // Ethernet header to write over the frame
+    };
+
+    static const uint64_t GENERATION_NONE = ~0ULL;  // Generation of an empty entry
+
+    /**
+     * @brief Constructor
+     * @param size Number of entries, rounded up to a power of two
+     * @param node Preferred NUMA node of the entries, -1 for the default policy
+     */
+    RouteCache(size_t size = 1024, int node = -1);
+
+    /**
+     * @brief Destructor
+     */
+    ~RouteCache();
+
+    /**
+     * @brief Look up a destination
+     * @param dst Destination address
+     * @param generation Current generation
+     * @return Entry or nullptr on a miss
+     */
+    const Entry* Lookup(in_addr_t dst, uint64_t generation) const {
+        const Entry& e = entries[Slot(dst)];
+        return (e.generation == generation && e.dst == dst) ? &e : nullptr;
+    }
+
+    /**
+     * @brief Start loading the slot of a destination into the cache
+     * @param dst Destination address
+     */
+    void Prefetch(in_addr_t dst) const {
+        __builtin_prefetch(&entries[Slot(dst)]);
+    }
+
+    /**
+     * @brief Store a forwarding decision, replacing the slot's entry
+     * @param dst Destination address
+     * @param generation Generation read before the lookups that produced the decision
+     * @param device_number Egress device
+     * @param neighbor Neighbor the header was taken from
+     * @param header Ethernet header
+     */
+    void Insert(in_addr_t dst, uint64_t generation, int device_number, IP2MAC* neighbor,
+                const unsigned char header[IP2MAC_L2_SIZE]);
+
+    /**
+     * @brief Drop every entry
+     */
+    void Clear();
+
+private:
+    ArenaArray<Entry> entries;     // Direct-mapped slots
+    int bits;                      // log2 of the number of entries
+
+    /**
+     * @brief Get the slot of a destination
+     * @param dst Destination address
+     * @return Slot number
+     */
+    size_t Slot(in_addr_t dst) const {
+        return NetworkUtil::AddrHash(dst, bits);
+    }
+};
+
+#endif // ROUTE_CACHE_HPP
@@ -4,13 +4,21 @@
  */
 
 #include "router.hpp"
+#include "checksum.hpp"
 #include <arpa/inet.h>
+#include <algorithm>
 #include <cstdarg>
 #include <cstring>
 #include <iostream>
 #include <fstream>
 #include <csignal>
+#include <ctime>
 #include <cerrno>  // For errno
+#include <sstream>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
 
 // ICMP time exceeded in transit
 #ifndef ICMP_TIME_EXCEEDED
@@ -21,10 +29,56 @@
  * @brief RouterConfig constructor
  */
 RouterConfig::RouterConfig()
-    : receiving_interface("enp0s8"),
-      sending_interface("enp0s9"),
+    : interfaces{"enp0s8", "enp0s9"},
       debug_out(true),
-      next_router("169.254.238.208") {
+      next_router("169.254.238.208"),
+      io_engine(IoEngine::Raw),
+      rx_mode(RxMode::Read),
+      ring_block_size(1 << 17),
+      ring_block_num(64),
+      burst_size(32),
+      prefetch_depth(4),
+      poll_mode(PollMode::Block),
+      busy_poll_us(50),
+      idle_spin_us(200),
+      route_file(""),
+      pin_workers(true),
+      port_ring_size(256),
+      queues_per_port(1),
+      fanout_mode(FANOUT_HASH),
+      verify_checksum(false),
+      packet_pool_size(4096),
+      umem_frames(16384),
+      pending_queue_depth(16),
+      pending_queue_bytes(64 * 1024),
+      route_cache_size(1024),
+      neighbor_table_size(4096),
+      stats_socket(""),
+      arp_retrans_ms(1000),
+      arp_max_probes(3),
+      arp_reachable_ms(30000),
+      arp_rate(100),
+      arp_burst(10),
+      icmp_rate(1000),
+      icmp_burst(50),
+      icmp_source_rate(1),
+      icmp_source_burst(6),
+      drain_ms(500) {
+}
+
+/**
+ * @brief Worker constructor
+ * @param device_number Port served by this worker
+ * @param queue Queue of the port served by this worker
+ * @param route_cache_size Entries of the route cache
+ * @param numa_node NUMA node of the worker's CPU, -1 if unknown
+ */
+Router::Worker::Worker(int device_number, int queue, size_t route_cache_size, int numa_node)
+    : device_number(device_number), queue(queue), numa_node(numa_node), wakeup_fd(-1), sleeping(false),
+      route_cache(route_cache_size, numa_node),
+      fib(nullptr), route_generation(RouteCache::GENERATION_NONE) {
+    LATENCY_ONLY(rx_tsc = 0);
+    LATENCY_ONLY(rx_staged = 0);
 }
 
 /**
@@ -32,8 +86,23 @@ RouterConfig::RouterConfig()
  * @param config Router configuration
  */
 Router::Router(const RouterConfig& config)
-    : config(config), running(false) {
-    memset(interface_info, 0, sizeof(interface_info));
+    : config(config), running(false), shutdown_fd(-1), draining(0), packet_pool(config.packet_pool_size, "pending pool"),
+      ip2mac_manager(config.neighbor_table_size), send_buffer(&packet_pool), fib(new Fib()), arp_resolver(&ip2mac_manager, &send_buffer, &interface_info) {
+    AsyncLog::SetEnabled(this->config.debug_out);
+    send_buffer.SetLimits(this->config.pending_queue_depth, this->config.pending_queue_bytes);
+    arp_resolver.Configure(this->config.arp_retrans_ms, this->config.arp_max_probes,
+                           this->config.arp_reachable_ms, this->config.arp_rate, this->config.arp_burst);
+    if (this->config.burst_size < 1 || this->config.burst_size > MAX_BURST) {
+        this->config.burst_size = MAX_BURST;
+    }
+    if (this->config.prefetch_depth < 0) {
+        this->config.prefetch_depth = 0;
+    } else if (this->config.prefetch_depth > MAX_BURST) {
+        this->config.prefetch_depth = MAX_BURST;
+    }
+    if (this->config.queues_per_port < 1) {
+        this->config.queues_per_port = 1;
+    }
 }
 
 /**
@@ -41,12 +110,29 @@ Router::Router(const RouterConfig& config)
  */
 Router::~Router() {
     Stop();
-    // Close sockets
-    for (int i = 0; i < 2; i++) {
-        if (interface_info[i].socket_descriptor > 0) {
-            close(interface_info[i].socket_descriptor);
+    CloseInterfaces();
+    if (shutdown_fd >= 0) {
+        close(shutdown_fd);
+    }
+    delete fib.load();
+}
+
+/**
+ * @brief Close all engines and detach XDP programs
+ */
+void Router::CloseInterfaces() {
+    for (auto& worker : workers) {
+        worker->io.reset();
+        if (worker->wakeup_fd >= 0) {
+            close(worker->wakeup_fd);
+            worker->wakeup_fd = -1;
         }
     }
+    // Interface sockets are the control sockets of queue 0
+    for (auto& info : interface_info) {
+        info.socket_descriptor = -1;
+    }
+    xdp_programs.clear();
 }
 
 /**
@@ -91,276 +177,1158 @@ int Router::Initialize() {
     // Disable IP forwarding
     DisableIpForward();
 
-    // Initialize interfaces
-    interface_info[0].socket_descriptor = NetworkUtil::InitRawSocket(config.receiving_interface.c_str(), 1, 0);
-    if (interface_info[0].socket_descriptor < 0) {
-        DebugPerror("InitRawSocket");
+    LATENCY_ONLY(Tsc::Calibrate());
+
+    // Never read: once Stop() signals it, it stays readable for every thread
+    shutdown_fd = eventfd(0, EFD_NONBLOCK);
+    if (shutdown_fd < 0) {
+        DebugPerror("eventfd");
         return -1;
     }
 
-    interface_info[1].socket_descriptor = NetworkUtil::InitRawSocket(config.sending_interface.c_str(), 1, 0);
-    if (interface_info[1].socket_descriptor < 0) {
-        DebugPerror("InitRawSocket");
-        close(interface_info[0].socket_descriptor);
+    size_t port_num = config.interfaces.size();
+    if (port_num == 0) {
+        DebugPrintf("no interfaces\n");
+        return -1;
+    }
+
+    interface_info.resize(port_num);
+    for (auto& info : interface_info) {
+        memset(&info, 0, sizeof(info));
+        info.socket_descriptor = -1;
+    }
+
+    // Device information first: the XDP programs need every local address
+    std::vector<in_addr_t> local_addrs;
+    for (size_t i = 0; i < port_num; i++) {
+        const std::string& name = config.interfaces[i];
+        if (NetworkUtil::GetDeviceInfo(name.c_str(),
+                                      interface_info[i].hw_addr,
+                                      &interface_info[i].ip_addr,
+                                      &interface_info[i].subnet,
+                                      &interface_info[i].netmask) < 0) {
+            DebugPerror("GetDeviceInfo");
+            return -1;
+        }
+        ip2mac_manager.SetPortAddress(static_cast<int>(i), interface_info[i].hw_addr);
+        local_addrs.push_back(interface_info[i].ip_addr.s_addr);
+
+        // Print interface information
+        DebugPrintf("[%zu] %s: %s\n", i, name.c_str(),
+                    NetworkUtil::EtherToString(interface_info[i].hw_addr).c_str());
+        DebugPrintf("[%zu] %s: %s\n", i, name.c_str(),
+                    NetworkUtil::InetToString(&interface_info[i].ip_addr).c_str());
+        DebugPrintf("[%zu] %s: %s\n", i, name.c_str(),
+                    NetworkUtil::InetToString(&interface_info[i].subnet).c_str());
+        DebugPrintf("[%zu] %s: %s\n", i, name.c_str(),
+                    NetworkUtil::InetToString(&interface_info[i].netmask).c_str());
+    }
+
+    int queue_num = config.queues_per_port;
+    FanoutMode fanout = (queue_num > 1) ? config.fanout_mode : FANOUT_NONE;
+
+    if (config.io_engine == IoEngine::Xdp) {
+        umem.reset(new PacketPool(config.umem_frames, "xdp umem"));
+        if (umem->Capacity() == 0) {
+            return -1;
+        }
+    }
+
+    for (size_t i = 0; i < port_num; i++) {
+        const std::string& name = config.interfaces[i];
+        // Every port needs its own fanout group
+        int fanout_group = (getpid() + static_cast<int>(i)) & 0xffff;
+
+        if (config.io_engine == IoEngine::Xdp) {
+            xdp_programs.emplace_back(new XdpProgram());
+            if (xdp_programs.back()->Attach(name, queue_num, local_addrs) < 0) {
+                DebugPrintf("XdpProgram::Attach:[%zu] failed\n", i);
+                CloseInterfaces();
+                return -1;
+            }
+            DebugPrintf("[%zu] %s: xdp %s mode\n", i, name.c_str(),
+                        xdp_programs.back()->IsDriverMode() ? "driver" : "generic");
+        }
+
+        for (int q = 0; q < queue_num; q++) {
+            // Worker memory prefers the node of the CPU the worker will be pinned to
+            int cpu = WorkerCpu(workers.size());
+            workers.emplace_back(new Worker(static_cast<int>(i), q, config.route_cache_size,
+                                            cpu >= 0 ? MemoryArena::CpuNode(cpu) : -1));
+            Worker& worker = *workers.back();
+
+            if (OpenPacketIO(worker, fanout, fanout_group) < 0) {
+                DebugPrintf("OpenPacketIO:[%zu/%d] failed\n", i, q);
+                CloseInterfaces();
+                return -1;
+            }
+
+            // Spinning workers have the kernel poll the device queue for them;
+            // without it they still spin, so a failure is not fatal
+            if (config.poll_mode != PollMode::Block && config.busy_poll_us > 0) {
+                NetworkUtil::SetBusyPoll(worker.io->Fd(), config.busy_poll_us, config.burst_size);
+            }
+
+            worker.wakeup_fd = eventfd(0, EFD_NONBLOCK);
+            if (worker.wakeup_fd < 0) {
+                DebugPerror("eventfd");
+                CloseInterfaces();
+                return -1;
+            }
+        }
+        interface_info[i].socket_descriptor = WorkerOf(static_cast<int>(i), 0).io->ControlFd();
+    }
+
+    // Rings carrying frames between workers of the same queue on different ports
+    for (auto& worker : workers) {
+        worker->inbound.resize(workers.size());
+        worker->inbound_staged.assign(workers.size(), 0);
+        for (size_t src = 0; src < workers.size(); src++) {
+            if (workers[src]->queue == worker->queue &&
+                workers[src]->device_number != worker->device_number) {
+                // Placed on the reader's node: the writer only fills slots, the reader polls them
+                worker->inbound[src].reset(new SpscRing<PortFrame>(config.port_ring_size, "port ring",
+                                                                   worker->numa_node));
+            }
+        }
+    }
+
+    // Each worker limits its own ICMP errors, with a share of the global rate
+    int worker_num = static_cast<int>(workers.size());
+    for (auto& worker : workers) {
+        worker->icmp_limiter.Configure(std::max(config.icmp_rate / worker_num, 1),
+                                       std::max(config.icmp_burst / worker_num, 1),
+                                       config.icmp_source_rate, config.icmp_source_burst);
+    }
+    rcu.reset(new Rcu(workers.size()));
+
+    // Build forwarding table; the workers are not running yet
+    if (BuildFib(*fib.load()) < 0) {
+        CloseInterfaces();
         return -1;
     }
 
-    // Get device information
-    if (NetworkUtil::GetDeviceInfo(config.receiving_interface.c_str(),
-                                  interface_info[0].hw_addr,
-                                  &interface_info[0].ip_addr,
-                                  &interface_info[0].subnet,
-                                  &interface_info[0].netmask) < 0) {
-        DebugPerror("GetDeviceInfo");
-        close(interface_info[0].socket_descriptor);
-        close(interface_info[1].socket_descriptor);
+    DebugPrintf("checksum: %s kernel\n", InetChecksum::KernelName());
+
+    // Counter export
+    if (!config.stats_socket.empty()) {
+        if (stats_server.Open(config.stats_socket) < 0) {
+            CloseInterfaces();
+            return -1;
+        }
+        DebugPrintf("stats: %s\n", config.stats_socket.c_str());
+    }
+
+    DebugPrintf("%s", MemoryArena::Report().c_str());
+    return 0;
+}
+
+/**
+ * @brief Get the CPU a worker thread is pinned to
+ * @param index Worker index
+ * @return CPU number or -1 if workers are not pinned
+ */
+int Router::WorkerCpu(size_t index) const {
+    unsigned int cpu_num = std::thread::hardware_concurrency();
+    if (!config.pin_workers || cpu_num == 0) {
         return -1;
     }
+    return static_cast<int>(index % cpu_num);
+}
+
+/**
+ * @brief Create and open the packet I/O engine of a worker
+ * @param worker Worker
+ * @param fanout Fanout mode of the port's raw sockets
+ * @param fanout_group Fanout group id of the port
+ * @return Success or failure code
+ */
+int Router::OpenPacketIO(Worker& worker, FanoutMode fanout, int fanout_group) {
+    const std::string& name = config.interfaces[worker.device_number];
+
+    if (config.io_engine == IoEngine::Xdp) {
+        // Half of the UMEM sits in fill rings; the rest is in flight or staged
+        size_t fill_frames = config.umem_frames / (2 * config.interfaces.size() * config.queues_per_port);
+        XdpPacketIO* io = new XdpPacketIO(umem.get(), static_cast<uint32_t>(fill_frames), &worker.stats);
+        worker.io.reset(io);
+        // The UMEM is registered on the first socket and shared by the others
+        int umem_fd = (workers.size() > 1) ? workers[0]->io->Fd() : -1;
+        if (io->Open(name, worker.queue, xdp_programs[worker.device_number].get(), umem_fd, worker.queue == 0) < 0) {
+            return -1;
+        }
+        DebugPrintf("[%d/%d] %s: xsk %s\n", worker.device_number, worker.queue, name.c_str(),
+                    io->IsZeroCopy() ? "zero-copy" : "copy");
+        return 0;
+    }
+
+    RawPacketIO* io = new RawPacketIO(config.rx_mode, config.burst_size, &worker.stats);
+    worker.io.reset(io);
+    return io->Open(name, config.ring_block_size, config.ring_block_num, fanout, fanout_group,
+                    config.queues_per_port);
+}
+
+/**
+ * @brief Get the prefix length of a netmask
+ * @param mask Netmask
+ * @return Prefix length
+ */
+static int NetmaskLength(struct in_addr mask) {
+    return __builtin_popcount(ntohl(mask.s_addr));
+}
+
+/**
+ * @brief Get the device number of an interface name
+ * @param name Interface name
+ * @return Device number or -1 if unknown
+ */
+int Router::DeviceNumber(const std::string& name) const {
+    for (size_t i = 0; i < config.interfaces.size(); i++) {
+        if (config.interfaces[i] == name) {
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Check whether an address belongs to one of our interfaces
+ * @param addr IP address
+ * @return true if the address is local
+ */
+bool Router::IsLocalAddress(in_addr_t addr) const {
+    for (const auto& info : interface_info) {
+        if (info.ip_addr.s_addr == addr) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Build the forwarding table from the interfaces and configuration
+ * @param table Empty table to fill
+ * @return Success or failure code
+ */
+int Router::BuildFib(Fib& table) {
+    // Directly connected subnets
+    for (int i = 0; i < static_cast<int>(interface_info.size()); i++) {
+        if (table.AddRoute(interface_info[i].subnet.s_addr, NetmaskLength(interface_info[i].netmask), i, 0) < 0) {
+            DebugPrintf("fib:cannot add connected route [%d]\n", i);
+            return -1;
+        }
+    }
 
-    if (NetworkUtil::GetDeviceInfo(config.sending_interface.c_str(),
-                                  interface_info[1].hw_addr,
-                                  &interface_info[1].ip_addr,
-                                  &interface_info[1].subnet,
-                                  &interface_info[1].netmask) < 0) {
-        DebugPerror("GetDeviceInfo");
-        close(interface_info[0].socket_descriptor);
-        close(interface_info[1].socket_descriptor);
+    // Default route through the next router, on the last interface unless
+    // the next router is on another connected subnet
+    int nh = table.Lookup(next_router.s_addr);
+    int device = (nh >= 0) ? table.GetNextHop(nh).device_number : static_cast<int>(interface_info.size()) - 1;
+    if (table.AddRoute(0, 0, device, next_router.s_addr) < 0) {
+        DebugPrintf("fib:cannot add default route\n");
         return -1;
     }
 
-    // Print interface information
-    DebugPrintf("[0] %s: %s\n", config.receiving_interface.c_str(),
-                NetworkUtil::EtherToString(interface_info[0].hw_addr).c_str());
-    DebugPrintf("[0] %s: %s\n", config.receiving_interface.c_str(),
-                NetworkUtil::InetToString(&interface_info[0].ip_addr).c_str());
-    DebugPrintf("[0] %s: %s\n", config.receiving_interface.c_str(),
-                NetworkUtil::InetToString(&interface_info[0].subnet).c_str());
-    DebugPrintf("[0] %s: %s\n", config.receiving_interface.c_str(),
-                NetworkUtil::InetToString(&interface_info[0].netmask).c_str());
-
-    DebugPrintf("[1] %s: %s\n", config.sending_interface.c_str(),
-                NetworkUtil::EtherToString(interface_info[1].hw_addr).c_str());
-    DebugPrintf("[1] %s: %s\n", config.sending_interface.c_str(),
-                NetworkUtil::InetToString(&interface_info[1].ip_addr).c_str());
-    DebugPrintf("[1] %s: %s\n", config.sending_interface.c_str(),
-                NetworkUtil::InetToString(&interface_info[1].subnet).c_str());
-    DebugPrintf("[1] %s: %s\n", config.sending_interface.c_str(),
-                NetworkUtil::InetToString(&interface_info[1].netmask).c_str());
+    if (!config.route_file.empty() && LoadRoutes(table, config.route_file) < 0) {
+        return -1;
+    }
 
+    DebugPrintf("fib: %zu routes, %zu tbl8 groups\n", table.RouteCount(), table.Tbl8GroupCount());
     return 0;
 }
 
 /**
- * @brief Send ICMP Time Exceeded message
- * @param device_number Device number
- * @param eth_hdr Ethernet header
- * @param ip_hdr IP header
- * @param data Data buffer
- * @param size Data size
+ * @brief Load static routes from a file
+ * @param table Table to add the routes to
+ * @param path File path
  * @return Success or failure code
+ *
+ * One route per line, in the form
+ *   <prefix>/<len>|default [via <gateway>] [dev <interface>]
+ * Empty lines and lines starting with '#' are ignored. Without "dev" the
+ * interface is the one whose connected subnet contains the gateway.
  */
-int Router::SendIcmpTimeExceeded(int device_number, struct ether_header* eth_hdr,
-                               struct iphdr* ip_hdr, u_char* data, int size) {
-    (void)size; // Suppress unused parameter warning
-
-    struct ether_header recieve_eth_hdr;
-    memcpy(recieve_eth_hdr.ether_dhost, eth_hdr->ether_shost, 6);
-    memcpy(recieve_eth_hdr.ether_shost, interface_info[device_number].hw_addr, 6);
-    recieve_eth_hdr.ether_type = htons(ETHERTYPE_IP);
-
-    struct iphdr recieve_ip_hdr;
-    recieve_ip_hdr.version = 4;
-    recieve_ip_hdr.ihl = 20 / 4;
-    recieve_ip_hdr.tos = 0;
-    recieve_ip_hdr.tot_len = htons(sizeof(struct icmp) + 64);
-    recieve_ip_hdr.id = 0;
-    recieve_ip_hdr.frag_off = 0;
-    recieve_ip_hdr.ttl = 64;
-    recieve_ip_hdr.protocol = IPPROTO_ICMP;
-    recieve_ip_hdr.check = 0;
-    recieve_ip_hdr.saddr = interface_info[device_number].ip_addr.s_addr;
-    recieve_ip_hdr.daddr = ip_hdr->saddr;
-
-    recieve_ip_hdr.check = NetworkUtil::Checksum((u_char*)&recieve_ip_hdr, sizeof(struct iphdr));
-
-    struct icmp icmp_hdr;
-    icmp_hdr.icmp_type = ICMP_TIME_EXCEEDED;
-    icmp_hdr.icmp_code = ICMP_TIMXCEED_INTRANS;
-    icmp_hdr.icmp_cksum = 0;
-    icmp_hdr.icmp_void = 0;
-
-    u_char* ip_ptr = data + sizeof(struct ether_header);
-
-    icmp_hdr.icmp_cksum = NetworkUtil::Checksum2((u_char*)&icmp_hdr, 8, ip_ptr, 64);
-
-    u_char buf[1500] = {'\0'};
-    u_char* tmp_ptr = buf;
-    memcpy(tmp_ptr, &recieve_eth_hdr, sizeof(struct ether_header));
-    tmp_ptr += sizeof(struct ether_header);
-    memcpy(tmp_ptr, &recieve_ip_hdr, sizeof(struct iphdr));
-    tmp_ptr += sizeof(struct iphdr);
-    memcpy(tmp_ptr, &icmp_hdr, 8);
-    tmp_ptr += 8;
-    memcpy(tmp_ptr, ip_ptr, 64);
-    tmp_ptr += 64;
-    int len = tmp_ptr - buf;  // ptrのずれ=大きさ
-
-    DebugPrintf("write:SendIcmpTimeExceeded:[%d] %dbytes\n", device_number, len);
-    write(interface_info[device_number].socket_descriptor, buf, len);
+int Router::LoadRoutes(Fib& table, const std::string& path) {
+    std::ifstream ifs(path);
+    if (!ifs) {
+        DebugPerror(path.c_str());
+        return -1;
+    }
+
+    std::string line;
+    for (int line_no = 1; std::getline(ifs, line); line_no++) {
+        std::istringstream iss(line);
+        std::string dest;
+        if (!(iss >> dest) || dest[0] == '#') {
+            continue;
+        }
+
+        struct in_addr prefix;
+        int prefix_len;
+        if (dest == "default") {
+            prefix.s_addr = 0;
+            prefix_len = 0;
+        } else {
+            size_t slash = dest.find('/');
+            std::string addr = dest.substr(0, slash);
+            prefix_len = (slash == std::string::npos) ? 32 : atoi(dest.c_str() + slash + 1);
+            if (inet_aton(addr.c_str(), &prefix) == 0 || prefix_len < 0 || prefix_len > 32) {
+                DebugPrintf("%s:%d: bad prefix %s\n", path.c_str(), line_no, dest.c_str());
+                return -1;
+            }
+        }
+
+        struct in_addr gateway;
+        gateway.s_addr = 0;
+        int device = -1;
+        std::string keyword, value;
+        while (iss >> keyword >> value) {
+            if (keyword == "via") {
+                if (inet_aton(value.c_str(), &gateway) == 0) {
+                    DebugPrintf("%s:%d: bad gateway %s\n", path.c_str(), line_no, value.c_str());
+                    return -1;
+                }
+            } else if (keyword == "dev") {
+                device = DeviceNumber(value);
+                if (device < 0) {
+                    DebugPrintf("%s:%d: unknown interface %s\n", path.c_str(), line_no, value.c_str());
+                    return -1;
+                }
+            } else {
+                DebugPrintf("%s:%d: unknown keyword %s\n", path.c_str(), line_no, keyword.c_str());
+                return -1;
+            }
+        }
+
+        if (device < 0 && gateway.s_addr != 0) {
+            int nh = table.Lookup(gateway.s_addr);
+            if (nh >= 0 && table.GetNextHop(nh).gateway == 0) {
+                device = table.GetNextHop(nh).device_number;
+            }
+        }
+        if (device < 0) {
+            DebugPrintf("%s:%d: no interface for route\n", path.c_str(), line_no);
+            return -1;
+        }
+
+        if (table.AddRoute(prefix.s_addr, prefix_len, device, gateway.s_addr) < 0) {
+            DebugPrintf("%s:%d: cannot add route\n", path.c_str(), line_no);
+            return -1;
+        }
+    }
 
     return 0;
 }
 
 /**
- * @brief Analyze packet
- * @param device_number Device number
+ * @brief Rebuild the forwarding table and publish it to the workers
+ * @return Success or failure code; on failure the current table is kept
+ *
+ * The new table is built from scratch, off the forwarding path, and its
+ * generation starts past the current one, so every route cache entry
+ * misses once it is published. The old table is freed once no worker can
+ * be looking it up any more. Neighbors and their queued packets are left
+ * alone; neighbors no route uses any more just age out.
+ */
+int Router::ReloadRoutes() {
+    Fib* current = fib.load(std::memory_order_acquire);
+    std::unique_ptr<Fib> table(new Fib(current->Generation() + 1));
+    if (BuildFib(*table) < 0) {
+        DebugPrintf("fib: reload of %s failed, keeping the current routes\n", config.route_file.c_str());
+        return -1;
+    }
+
+    // Sequentially consistent, as Rcu::Online() requires
+    Fib* old = fib.exchange(table.release());
+    rcu->Synchronize();
+    delete old;
+    DebugPrintf("fib: reloaded %s\n", config.route_file.c_str());
+    return 0;
+}
+
+/**
+ * @brief Reload route_file whenever it changes, until the router stops
+ *
+ * The file is checked every ROUTE_WATCH_MS. A file renamed over it counts
+ * as a change, so writing a new file and renaming it replaces the routes
+ * in one step; a file edited in place may be read half written, and is
+ * read again once the writer is done.
+ */
+void Router::WatchRoutes() {
+    static const int ROUTE_WATCH_MS = 100;
+    struct stat last;
+    bool known = (stat(config.route_file.c_str(), &last) == 0);
+
+    while (running) {
+        struct pollfd stop = {shutdown_fd, POLLIN, 0};
+        if (poll(&stop, 1, ROUTE_WATCH_MS) > 0) {
+            break;
+        }
+        struct stat now;
+        if (stat(config.route_file.c_str(), &now) < 0) {
+            // Removed or being replaced; the routes stay as they are
+            continue;
+        }
+        if (known && now.st_ino == last.st_ino && now.st_size == last.st_size &&
+            now.st_mtim.tv_sec == last.st_mtim.tv_sec && now.st_mtim.tv_nsec == last.st_mtim.tv_nsec) {
+            continue;
+        }
+        last = now;
+        known = true;
+        ReloadRoutes();
+    }
+}
+
+/**
+ * @brief Send an ICMP error about a packet back to its source
+ * @param worker Worker generating the error
+ * @param device_number Port the packet was received on
+ * @param data Frame of the packet, as received
+ * @param size Frame length
+ * @param type ICMP type
+ * @param code ICMP code
+ * @return 1 if the error was staged, 0 if it was suppressed, -1 on error
+ *
+ * As RFC 1812 requires, no error is sent about an ICMP error, a
+ * non-initial fragment or a packet whose source is not a single host, and
+ * the worker's IcmpLimiter caps the errors per destination and in total.
+ * The error quotes as much of the packet as fits in 576 bytes. It is built
+ * in a TX slot of the worker's engine and goes out with its next batch; an
+ * error for another port is built in icmp_frame and handed over like a
+ * forwarded frame.
+ */
+__attribute__((noinline, cold))
+int Router::SendIcmpError(Worker& worker, int device_number, const u_char* data, int size, int type, int code) {
+    static const int ERROR_MAX_LEN = 576;  // Largest error datagram (RFC 1812 4.3.2.3)
+
+    const struct ether_header* eth_hdr = (const struct ether_header*)data;
+    const u_char* ip_ptr = data + sizeof(struct ether_header);
+    int ip_len = size - static_cast<int>(sizeof(struct ether_header));
+    if (ip_len < static_cast<int>(sizeof(struct iphdr))) {
+        return 0;
+    }
+    const struct iphdr* ip_hdr = (const struct iphdr*)ip_ptr;
+    int header_len = ip_hdr->ihl * 4;
+    int total_len = ntohs(ip_hdr->tot_len);
+    if (header_len < static_cast<int>(sizeof(struct iphdr)) || total_len < header_len || total_len > ip_len) {
+        return 0;
+    }
+
+    uint32_t source = ntohl(ip_hdr->saddr);
+    if ((ntohs(ip_hdr->frag_off) & IP_OFFMASK) != 0 || source == INADDR_ANY || source == INADDR_BROADCAST ||
+        IN_MULTICAST(source) || (eth_hdr->ether_shost[0] & 0x01) != 0) {
+        return 0;
+    }
+    if (ip_hdr->protocol == IPPROTO_ICMP) {
+        // Only queries may be answered with an error
+        if (total_len == header_len) {
+            return 0;
+        }
+        int inner_type = ip_ptr[header_len];
+        if (inner_type > NR_ICMP_TYPES || inner_type == ICMP_DEST_UNREACH || inner_type == ICMP_SOURCE_QUENCH ||
+            inner_type == ICMP_REDIRECT || inner_type == ICMP_TIME_EXCEEDED || inner_type == ICMP_PARAMETERPROB) {
+            return 0;
+        }
+    }
+
+    if (!worker.icmp_limiter.Allow(ip_hdr->saddr, TimerWheel::NowMs())) {
+        LOG_DEBUG_LIMITED("[%d]:icmp:rate limited to %s\n", device_number,
+                          NetworkUtil::InAddrToString(ip_hdr->saddr).c_str());
+        WorkerStats::Add(worker.stats.icmp_ratelimited, 1);
+        return 0;
+    }
+
+    bool own_port = (device_number == worker.device_number);
+    u_char* buf = own_port ? worker.io->Reserve() : worker.icmp_frame;
+    if (buf == nullptr) {
+        worker.stats.Drop(DROP_TX);
+        return -1;
+    }
+
+    int quote_len = std::min(total_len, ERROR_MAX_LEN - static_cast<int>(sizeof(struct iphdr)) - ICMP_MINLEN);
+    int icmp_len = ICMP_MINLEN + quote_len;
+    int len = static_cast<int>(sizeof(struct ether_header) + sizeof(struct iphdr)) + icmp_len;
+
+    struct ether_header* error_eth = (struct ether_header*)buf;
+    memcpy(error_eth->ether_dhost, eth_hdr->ether_shost, 6);
+    memcpy(error_eth->ether_shost, interface_info[device_number].hw_addr, 6);
+    error_eth->ether_type = htons(ETHERTYPE_IP);
+
+    struct iphdr* error_ip = (struct iphdr*)(buf + sizeof(struct ether_header));
+    error_ip->version = 4;
+    error_ip->ihl = sizeof(struct iphdr) / 4;
+    error_ip->tos = IPTOS_PREC_INTERNETCONTROL;
+    error_ip->tot_len = htons(sizeof(struct iphdr) + icmp_len);
+    error_ip->id = 0;
+    error_ip->frag_off = 0;
+    error_ip->ttl = 64;
+    error_ip->protocol = IPPROTO_ICMP;
+    error_ip->check = 0;
+    error_ip->saddr = interface_info[device_number].ip_addr.s_addr;
+    error_ip->daddr = ip_hdr->saddr;
+    error_ip->check = InetChecksum::Compute((const unsigned char*)error_ip, sizeof(struct iphdr));
+
+    struct icmp* error_icmp = (struct icmp*)(error_ip + 1);
+    error_icmp->icmp_type = type;
+    error_icmp->icmp_code = code;
+    error_icmp->icmp_cksum = 0;
+    error_icmp->icmp_void = 0;
+    memcpy((u_char*)error_icmp + ICMP_MINLEN, ip_ptr, quote_len);
+    error_icmp->icmp_cksum = InetChecksum::Compute((const unsigned char*)error_icmp, icmp_len);
+
+    LOG_DEBUG("write:icmp %d/%d:[%d] %dbytes\n", type, code, device_number, len);
+    if (own_port) {
+        if (worker.io->Commit(len) < 0) {
+            worker.stats.Drop(DROP_TX);
+            return -1;
+        }
+    } else if (Transmit(worker, device_number, buf, len) < 0) {
+        return -1;
+    }
+
+    WorkerStats::Add(worker.stats.icmp_sent, 1);
+    return 1;
+}
+
+/**
+ * @brief Classify a received frame
+ * @param worker Worker that received the frame (counts drops)
  * @param data Data buffer
  * @param size Data size
- * @return Success or failure code
+ * @return FRAME_ARP, FRAME_IP or FRAME_DROP
  */
-int Router::AnalyzePacket(int device_number, u_char* data, int size) {
-    u_char* tmp_ptr = data;
-    int tmp_len = size;
+__attribute__((noinline, cold))
+int Router::ClassifyPacket(Worker& worker, u_char* data, int size) {
+    int device_number = worker.device_number;
 
     // Ethernet header
-    if (tmp_len < static_cast<int>(sizeof(struct ether_header))) {
-        DebugPrintf("[%d]:tmp_len(%d) < sizeof(struct ether_header)\n", device_number, tmp_len);
-        return -1;
+    if (size < static_cast<int>(sizeof(struct ether_header))) {
+        LOG_DEBUG_LIMITED("[%d]:tmp_len(%d) < sizeof(struct ether_header)\n", device_number, size);
+        worker.stats.Drop(DROP_SHORT_FRAME);
+        return FRAME_DROP;
     }
-    struct ether_header* eth_hdr = (struct ether_header*)tmp_ptr;
-    tmp_ptr += sizeof(struct ether_header);
-    tmp_len -= sizeof(struct ether_header);
+    struct ether_header* eth_hdr = (struct ether_header*)data;
 
     // Check if destination MAC address matches our interface
     if (memcmp(&eth_hdr->ether_dhost, interface_info[device_number].hw_addr, 6) != 0) {
-        DebugPrintf("[%d]:dhost not match %s\n", device_number,
+        LOG_DEBUG_LIMITED("[%d]:dhost not match %s\n", device_number,
                    NetworkUtil::EtherToString(eth_hdr->ether_dhost).c_str());
-        return -1;
+        worker.stats.Drop(DROP_DHOST_MISMATCH);
+        return FRAME_DROP;
     }
 
-    // ARP header
     if (ntohs(eth_hdr->ether_type) == ETHERTYPE_ARP) {
-        if (tmp_len < static_cast<int>(sizeof(struct ether_arp))) {
-            DebugPrintf("[%d]:tmp_len(%d) < sizeof(struct ether_arp)\n", device_number, tmp_len);
-            return -1;
+        return FRAME_ARP;
+    } else if (ntohs(eth_hdr->ether_type) == ETHERTYPE_IP) {
+        return FRAME_IP;
+    }
+
+    worker.stats.Drop(DROP_ETHERTYPE);
+    return FRAME_DROP;
+}
+
+/**
+ * @brief Analyze packet
+ * @param worker Worker that received the packet
+ * @param data Data buffer
+ * @param size Data size
+ * @return Success or failure code
+ */
+int Router::AnalyzePacket(Worker& worker, u_char* data, int size) {
+    WorkerStats::Add(worker.stats.rx_packets, 1);
+    WorkerStats::Add(worker.stats.rx_bytes, size);
+    LoadFib(worker);
+
+    struct iphdr* ip_hdr = config.verify_checksum ? MatchFastPath<true>(worker, data, size)
+                                                  : MatchFastPath<false>(worker, data, size);
+    if (__builtin_expect(ip_hdr != nullptr, 1)) {
+        LATENCY_RECORD(worker.latency, LAT_CLASSIFY, worker.rx_tsc, 1);
+        return ForwardChecked(worker, data, size, ip_hdr, ROUTE_LOOKUP);
+    }
+
+    int frame_class = ClassifyPacket(worker, data, size);
+    LATENCY_RECORD(worker.latency, LAT_CLASSIFY, worker.rx_tsc, 1);
+    switch (frame_class) {
+    case FRAME_ARP:
+        return AnalyzeArp(worker, data, size);
+    case FRAME_IP:
+        return ForwardIp(worker, data, size, ROUTE_LOOKUP);
+    default:
+        return -1;
+    }
+}
+
+/**
+ * @brief Analyze a burst of packets received on one port
+ * @param worker Worker that received the packets
+ * @param frames Frame pointers
+ * @param sizes Frame sizes
+ * @param n Number of frames (at most MAX_BURST)
+ * @return Number of frames forwarded
+ *
+ * The whole burst is classified first. ARP frames are handled next so that
+ * neighbors learned from the burst are visible to its IPv4 frames, which are
+ * routed with one batch lookup and forwarded last.
+ */
+int Router::AnalyzePacketBurst(Worker& worker, u_char** frames, int* sizes, int n) {
+    // The checksum setting is fixed, so pick the specialization once per burst
+    if (config.verify_checksum) {
+        return AnalyzeBurst<true>(worker, frames, sizes, n);
+    }
+    return AnalyzeBurst<false>(worker, frames, sizes, n);
+}
+
+/**
+ * @brief Analyze a burst, specialized on checksum verification
+ * @tparam VerifyChecksum config.verify_checksum
+ * @param worker Worker that received the packets
+ * @param frames Frame pointers
+ * @param sizes Frame sizes
+ * @param n Number of frames (at most MAX_BURST)
+ * @return Number of frames forwarded
+ *
+ * Frames matching FastPathParser are forwarded by ForwardChecked(); the
+ * others are classified and forwarded by the general path, in burst order.
+ *
+ * Each pass over the burst prefetches what a later frame will need while
+ * the current one is processed, config.prefetch_depth frames ahead: the
+ * frame headers while classifying, the route cache slots while probing
+ * the cache, and, while forwarding, a neighbor's hash index slot two
+ * depths ahead and its published entry one depth ahead. The neighbor
+ * table does not fit in the cache, so this turns one miss per frame into
+ * misses that overlap.
+ */
+template <bool VerifyChecksum>
+int Router::AnalyzeBurst(Worker& worker, u_char** frames, int* sizes, int n) {
+    int arp_idx[MAX_BURST];
+    int ip_idx[MAX_BURST];
+    struct iphdr* ip_hdrs[MAX_BURST];
+    int arp_num = 0;
+    int ip_num = 0;
+    int depth = config.prefetch_depth;
+
+    LoadFib(worker);
+
+    uint64_t bytes = 0;
+    for (int i = 0; i < n; i++) {
+        bytes += sizes[i];
+    }
+    WorkerStats::Add(worker.stats.rx_packets, n);
+    WorkerStats::Add(worker.stats.rx_bytes, bytes);
+
+    for (int i = 0; i < n; i++) {
+        if (depth > 0 && i + depth < n) {
+            __builtin_prefetch(frames[i + depth]);
         }
-        struct ether_arp* arp_hdr = (struct ether_arp*)tmp_ptr;
-        tmp_ptr += sizeof(struct ether_arp);
-        tmp_len -= sizeof(struct ether_arp);
+        struct iphdr* ip_hdr = MatchFastPath<VerifyChecksum>(worker, frames[i], sizes[i]);
+        if (__builtin_expect(ip_hdr != nullptr, 1)) {
+            ip_hdrs[ip_num] = ip_hdr;
+            ip_idx[ip_num++] = i;
+            continue;
+        }
+        int frame_class = ClassifyPacket(worker, frames[i], sizes[i]);
+        if (frame_class == FRAME_IP) {
+            ip_hdrs[ip_num] = nullptr;
+            ip_idx[ip_num++] = i;
+        } else if (frame_class == FRAME_ARP) {
+            arp_idx[arp_num++] = i;
+        }
+    }
+    LATENCY_RECORD(worker.latency, LAT_CLASSIFY, worker.rx_tsc, n);
 
-        if (arp_hdr->arp_op == htons(ARPOP_REQUEST)) {
-            DebugPrintf("[%d]recv:ARP REQUEST:%dbytes\n", device_number, size);
-            ip2mac_manager.GetIp2Mac(device_number, *(in_addr_t*)arp_hdr->arp_spa, arp_hdr->arp_sha);
+    for (int i = 0; i < arp_num; i++) {
+        AnalyzeArp(worker, frames[arp_idx[i]], sizes[arp_idx[i]]);
+    }
+
+    // Route the route cache misses of the fast path frames at once; the
+    // general path looks its frames up itself
+    in_addr_t dst[MAX_BURST];
+    int miss_idx[MAX_BURST];
+    int miss_routes[MAX_BURST];
+    int routes[MAX_BURST];
+    int miss_num = 0;
+    for (int i = 0; i < ip_num; i++) {
+        if (depth > 0 && i + depth < ip_num && ip_hdrs[i + depth] != nullptr) {
+            worker.route_cache.Prefetch(ip_hdrs[i + depth]->daddr);
         }
-        if (arp_hdr->arp_op == htons(ARPOP_REPLY)) {
-            DebugPrintf("[%d]recv:ARP REPLY:%dbytes\n", device_number, size);
-            ip2mac_manager.GetIp2Mac(device_number, *(in_addr_t*)arp_hdr->arp_spa, arp_hdr->arp_sha);
+        routes[i] = ROUTE_LOOKUP;
+        if (ip_hdrs[i] != nullptr && worker.route_cache.Lookup(ip_hdrs[i]->daddr, worker.route_generation) == nullptr) {
+            dst[miss_num] = ip_hdrs[i]->daddr;
+            miss_idx[miss_num++] = i;
         }
     }
-    // IP header
-    else if (ntohs(eth_hdr->ether_type) == ETHERTYPE_IP) {
-        if (tmp_len < static_cast<int>(sizeof(struct iphdr))) {
-            DebugPrintf("[%d]:tmp_len(%d) < sizeof(struct iphdr)\n", device_number, tmp_len);
-            return -1;
+    worker.fib->LookupBurst(dst, miss_routes, miss_num);
+    for (int i = 0; i < miss_num; i++) {
+        routes[miss_idx[i]] = miss_routes[i];
+    }
+
+    // Neighbors of the routed frames, -1 for the others
+    int hop_device[MAX_BURST];
+    in_addr_t hop_addr[MAX_BURST];
+    if (depth > 0) {
+        for (int i = 0; i < ip_num; i++) {
+            hop_device[i] = -1;
+        }
+        for (int i = 0; i < miss_num; i++) {
+            int route = miss_routes[i];
+            if (route >= 0) {
+                const NextHop& hop = worker.fib->GetNextHop(route);
+                int j = miss_idx[i];
+                hop_device[j] = hop.device_number;
+                hop_addr[j] = (hop.gateway != 0) ? hop.gateway : ip_hdrs[j]->daddr;
+            }
+        }
+        for (int i = 0; i < depth * 2 && i < ip_num; i++) {
+            if (hop_device[i] >= 0) {
+                ip2mac_manager.PrefetchSlot(hop_device[i], hop_addr[i]);
+            }
         }
-        struct iphdr* ip_hdr = (struct iphdr*)tmp_ptr;
-        tmp_ptr += sizeof(struct iphdr);
-        tmp_len -= sizeof(struct iphdr);
+        for (int i = 0; i < depth && i < ip_num; i++) {
+            if (hop_device[i] >= 0) {
+                ip2mac_manager.PrefetchEntry(hop_device[i], hop_addr[i]);
+            }
+        }
+    }
 
-        u_char option[1500] = {'\0'};
-        int option_len = ip_hdr->ihl * 4 - sizeof(struct iphdr);
-        if (option_len > 0) {
-            if (option_len >= 1500) {
-                DebugPrintf("[%d]:IP option_len(%d):too big\n", device_number, option_len);
-                return -1;
+    int forwarded = 0;
+    for (int i = 0; i < ip_num; i++) {
+        if (depth > 0) {
+            int slot_ahead = i + depth * 2;
+            int entry_ahead = i + depth;
+            if (slot_ahead < ip_num && hop_device[slot_ahead] >= 0) {
+                ip2mac_manager.PrefetchSlot(hop_device[slot_ahead], hop_addr[slot_ahead]);
+            }
+            if (entry_ahead < ip_num && hop_device[entry_ahead] >= 0) {
+                ip2mac_manager.PrefetchEntry(hop_device[entry_ahead], hop_addr[entry_ahead]);
             }
-            memcpy(option, tmp_ptr, option_len);
-            tmp_ptr += option_len;
-            tmp_len -= option_len;
         }
+        u_char* data = frames[ip_idx[i]];
+        int size = sizes[ip_idx[i]];
+        int result = ip_hdrs[i] != nullptr ? ForwardChecked(worker, data, size, ip_hdrs[i], routes[i])
+                                           : ForwardIp(worker, data, size, routes[i]);
+        if (result == 0) {
+            forwarded++;
+        }
+    }
 
-        if (ip_hdr->ttl <= 1) {
-            DebugPrintf("[%d]:TTL <= 1\n", device_number);
-            SendIcmpTimeExceeded(device_number, eth_hdr, ip_hdr, data, size);
-            return -1;
+    return forwarded;
+}
+
+/**
+ * @brief Analyze an ARP packet
+ * @param device_number Device number
+ * @param data Data buffer
+ * @param size Data size
+ * @return Success or failure code
+ */
+__attribute__((noinline, cold))
+int Router::AnalyzeArp(Worker& worker, u_char* data, int size) {
+    int device_number = worker.device_number;
+    u_char* tmp_ptr = data + sizeof(struct ether_header);
+    int tmp_len = size - sizeof(struct ether_header);
+
+    // ARP header
+    if (tmp_len < static_cast<int>(sizeof(struct ether_arp))) {
+        LOG_DEBUG_LIMITED("[%d]:tmp_len(%d) < sizeof(struct ether_arp)\n", device_number, tmp_len);
+        worker.stats.Drop(DROP_SHORT_FRAME);
+        return -1;
+    }
+    struct ether_arp* arp_hdr = (struct ether_arp*)tmp_ptr;
+
+    std::lock_guard<std::mutex> lock(neighbor_mutex);
+    IP2MAC* ip2mac = nullptr;
+    int discarded = 0;
+    if (arp_hdr->arp_op == htons(ARPOP_REQUEST)) {
+        LOG_DEBUG("[%d]recv:ARP REQUEST:%dbytes\n", device_number, size);
+        ip2mac = ip2mac_manager.GetIp2Mac(device_number, *(in_addr_t*)arp_hdr->arp_spa, arp_hdr->arp_sha,
+                                          &discarded);
+    }
+    if (arp_hdr->arp_op == htons(ARPOP_REPLY)) {
+        LOG_DEBUG("[%d]recv:ARP REPLY:%dbytes\n", device_number, size);
+        ip2mac = ip2mac_manager.GetIp2Mac(device_number, *(in_addr_t*)arp_hdr->arp_spa, arp_hdr->arp_sha,
+                                          &discarded);
+    }
+    if (discarded > 0) {
+        // Queued for a neighbor evicted from the full table
+        worker.stats.Drop(DROP_PENDING_FULL, discarded);
+    }
+
+    // The neighbor is confirmed now; send what was waiting for it
+    if (ip2mac != nullptr && ip2mac->state == NEIGH_REACHABLE && arp_resolver.Confirm(ip2mac)) {
+        DrainPending(worker, ip2mac);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Transmit the packets queued for a neighbor that has been resolved
+ * @param worker Worker that learned the neighbor's address
+ * @param ip2mac Neighbor (neighbor_mutex must be held)
+ * @return Number of packets transmitted
+ *
+ * The packets already carry their decremented TTL; only the Ethernet
+ * addresses are rewritten. They are staged together and go out with the
+ * worker's next sendmmsg().
+ */
+int Router::DrainPending(Worker& worker, IP2MAC* ip2mac) {
+    PacketPool* pool = send_buffer.Pool();
+    int sent = 0;
+    int index;
+
+    while (send_buffer.GetSendData(ip2mac, &index) == 1) {
+        u_char* data = pool->Data(index);
+        int size = pool->Length(index);
+        LATENCY_RECORD(worker.latency, LAT_PENDING, pool->Stamp(index), 1);
+        struct ether_header* eth_hdr = (struct ether_header*)data;
+        memcpy(eth_hdr->ether_dhost, ip2mac->hw_addr, 6);
+        memcpy(eth_hdr->ether_shost, interface_info[ip2mac->device_number].hw_addr, 6);
+
+        if (ip2mac->device_number == worker.device_number) {
+            // Staged by reference; freed once the batch has been sent
+            if (worker.io->Stage(data, size) >= 0) {
+                worker.pool_staged.push_back(index);
+                sent++;
+            } else {
+                worker.stats.Drop(DROP_TX);
+                pool->Free(index);
+            }
+        } else {
+            if (Transmit(worker, ip2mac->device_number, data, size) == 0) {
+                sent++;
+            }
+            pool->Free(index);
         }
+    }
 
-        // Check if the destination IP is our interface
-        if (ip_hdr->daddr == interface_info[0].ip_addr.s_addr ||
-            ip_hdr->daddr == interface_info[1].ip_addr.s_addr) {
-            DebugPrintf("[%d]:recv:myaddr\n", device_number);
-            return -1;
+    LOG_DEBUG("[%d]:drained %d pending packets to %s\n", worker.device_number, sent,
+                NetworkUtil::InAddrToString(ip2mac->ip_addr).c_str());
+    return sent;
+}
+
+/**
+ * @brief Answer stats_server connections until the router stops
+ */
+void Router::ServeStats() {
+    while (running) {
+        stats_server.ServeOne(100, [this]() { return RenderStats(); }, shutdown_fd);
+    }
+}
+
+/**
+ * @brief Render every worker's counters, summed per port
+ * @return Snapshot in the Prometheus text format
+ *
+ * The counters are read while the workers keep writing them, so a
+ * snapshot is not atomic across counters, but every counter only grows.
+ */
+std::string Router::RenderStats() const {
+    std::ostringstream out;
+    int queues = config.queues_per_port;
+
+    for (size_t port = 0; port < config.interfaces.size(); port++) {
+        WorkerStats sum;
+        for (int q = 0; q < queues; q++) {
+            sum.Accumulate(workers[port * queues + q]->stats);
         }
 
-        // Check if the packet is from external network
-        int target_device = -1;
-        if ((ip_hdr->daddr & interface_info[0].netmask.s_addr) == interface_info[0].subnet.s_addr) {
-            target_device = 0;
-        } else if ((ip_hdr->daddr & interface_info[1].netmask.s_addr) == interface_info[1].subnet.s_addr) {
-            target_device = 1;
-        } else {
-            target_device = 1;
-        }
-
-        // Forward packet
-        struct ether_header forward_eth_hdr;
-        memcpy(forward_eth_hdr.ether_shost, interface_info[target_device].hw_addr, 6);
-        forward_eth_hdr.ether_type = htons(ETHERTYPE_IP);
-
-        // Decrement TTL
-        ip_hdr->ttl--;
-        ip_hdr->check = 0;
-        ip_hdr->check = NetworkUtil::Checksum2((u_char*)ip_hdr, sizeof(struct iphdr), option, option_len);
-
-        // Create forwarding packet
-        u_char forward_buf[1500] = {'\0'};
-        u_char* forward_ptr = forward_buf;
-        memcpy(forward_ptr, &forward_eth_hdr, sizeof(struct ether_header));
-        forward_ptr += sizeof(struct ether_header);
-        memcpy(forward_ptr, ip_hdr, sizeof(struct iphdr));
-        forward_ptr += sizeof(struct iphdr);
-        if (option_len > 0) {
-            memcpy(forward_ptr, option, option_len);
-            forward_ptr += option_len;
-        }
-        memcpy(forward_ptr, tmp_ptr, tmp_len);
-        forward_ptr += tmp_len;
-        int forward_len = forward_ptr - forward_buf;
-
-        // Get next hop IP
-        in_addr_t next_hop;
-        if (target_device == 0) {
-            next_hop = ip_hdr->daddr;
-        } else {
-            next_hop = next_router.s_addr;
+        const std::string label = "{port=\"" + config.interfaces[port] + "\"";
+        out << "router_rx_packets" << label << "} " << sum.rx_packets.load() << "\n";
+        out << "router_rx_bytes" << label << "} " << sum.rx_bytes.load() << "\n";
+        out << "router_tx_packets" << label << "} " << sum.tx_packets.load() << "\n";
+        out << "router_tx_bytes" << label << "} " << sum.tx_bytes.load() << "\n";
+        for (int r = 0; r < DROP_REASON_NUM; r++) {
+            out << "router_drops" << label << ",reason=\"" << WorkerStats::DropReasonName(r) << "\"} "
+                << sum.drops[r].load() << "\n";
         }
+        out << "router_icmp_sent" << label << "} " << sum.icmp_sent.load() << "\n";
+        out << "router_icmp_ratelimited" << label << "} " << sum.icmp_ratelimited.load() << "\n";
+    }
 
-        // Send packet
-        IP2MAC* ip2mac = ip2mac_manager.GetIp2Mac(target_device, next_hop, nullptr);
-        if (ip2mac == nullptr) {
-            DebugPrintf("[%d]:ip2mac:error\n", device_number);
-            return -1;
+    out << "router_arp_requests " << arp_resolver.Requests() << "\n";
+    out << "router_arp_throttled " << arp_resolver.Throttled() << "\n";
+    out << "router_arp_failed_packets " << arp_resolver.FailedPackets() << "\n";
+    out << "router_pool_free " << packet_pool.FreeCount() << "\n";
+
+#if ROUTER_LATENCY
+    static const double QUANTILES[] = {0.5, 0.99, 0.999};
+    std::unique_ptr<LatencyStats> latency(new LatencyStats());
+    SumLatency(latency.get());
+    for (int stage = 0; stage < LAT_STAGE_NUM; stage++) {
+        const LatencyHistogram& hist = latency->stages[stage];
+        const std::string label = "{stage=\"" + std::string(LatencyHistogram::StageName(stage)) + "\"";
+        for (double q : QUANTILES) {
+            out << "router_latency_ns" << label << ",quantile=\"" << q << "\"} "
+                << Tsc::ToNs(hist.Quantile(q)) << "\n";
         }
+        out << "router_latency_ns_count" << label << "} " << hist.Count() << "\n";
+    }
+#endif
+    return out.str();
+}
 
-        if (ip2mac->flag == FLAG_NG) {
-            DebugPrintf("[%d]:ip2mac:error\n", device_number);
-            return -1;
-        } else if (ip2mac->flag == FLAG_OK) {
-            memcpy(forward_eth_hdr.ether_dhost, ip2mac->hw_addr, 6);
-            memcpy(forward_buf, &forward_eth_hdr, sizeof(struct ether_header));
-            DebugPrintf("write:[%d] %dbytes\n", target_device, forward_len);
-            write(interface_info[target_device].socket_descriptor, forward_buf, forward_len);
+/**
+ * @brief Print the non-zero counters to stderr
+ */
+void Router::ReportStats() const {
+    std::istringstream lines(RenderStats());
+    std::string line;
+    while (std::getline(lines, line)) {
+        if (line.size() < 2 || line.compare(line.size() - 2, 2, " 0") != 0) {
+            fprintf(stderr, "%s\n", line.c_str());
+        }
+    }
+}
+
+#if ROUTER_LATENCY
+/**
+ * @brief Sum every worker's latency histograms
+ * @param sum Histograms to add to
+ */
+void Router::SumLatency(LatencyStats* sum) const {
+    for (const auto& worker : workers) {
+        for (int stage = 0; stage < LAT_STAGE_NUM; stage++) {
+            sum->stages[stage].Accumulate(worker->latency.stages[stage]);
+        }
+    }
+}
+
+/**
+ * @brief Print p50/p99/p999 of every stage to stderr
+ */
+void Router::ReportLatency() const {
+    std::unique_ptr<LatencyStats> latency(new LatencyStats());
+    SumLatency(latency.get());
+
+    fprintf(stderr, "%-10s %12s %10s %10s %10s\n", "stage", "samples", "p50 ns", "p99 ns", "p999 ns");
+    for (int stage = 0; stage < LAT_STAGE_NUM; stage++) {
+        const LatencyHistogram& hist = latency->stages[stage];
+        fprintf(stderr, "%-10s %12llu %10llu %10llu %10llu\n", LatencyHistogram::StageName(stage),
+                static_cast<unsigned long long>(hist.Count()),
+                static_cast<unsigned long long>(Tsc::ToNs(hist.Quantile(0.5))),
+                static_cast<unsigned long long>(Tsc::ToNs(hist.Quantile(0.99))),
+                static_cast<unsigned long long>(Tsc::ToNs(hist.Quantile(0.999))));
+    }
+}
+#endif
+
+/**
+ * @brief Run the neighbor timers (retransmits, probes, failures)
+ * @param worker Worker running the timers (sends Host Unreachable for failed packets)
+ * @return Number of timers run
+ *
+ * The packets of neighbors that failed are answered once the lock is
+ * released. They still carry the Ethernet header they were received with,
+ * whose destination tells the port they came in on.
+ */
+int Router::RunNeighborTimers(Worker& worker) {
+    int run;
+    {
+        std::unique_lock<std::mutex> lock(neighbor_mutex, std::try_to_lock);
+        if (!lock.owns_lock()) {
+            // Another worker is updating neighbors, maybe running the timers itself
             return 0;
-        } else {
-            send_buffer.AppendSendData(ip2mac, target_device, next_hop, forward_buf, forward_len);
-            if (ip2mac->flag == FLAG_FREE) {
-                ip2mac->flag = FLAG_OK;
-                NetworkUtil::SendArpRequest(interface_info[target_device].socket_descriptor,
-                                         next_hop, nullptr,
-                                         interface_info[target_device].ip_addr.s_addr,
-                                         interface_info[target_device].hw_addr);
+        }
+        run = arp_resolver.RunTimers(TimerWheel::NowMs(), &worker.unreachable);
+    }
+    if (worker.unreachable.empty()) {
+        return run;
+    }
+
+    PacketPool* pool = send_buffer.Pool();
+    for (int index : worker.unreachable) {
+        const u_char* data = pool->Data(index);
+        for (int port = 0; port < static_cast<int>(interface_info.size()); port++) {
+            if (memcmp(((const struct ether_header*)data)->ether_dhost, interface_info[port].hw_addr, 6) == 0) {
+                SendIcmpError(worker, port, data, pool->Length(index), ICMP_DEST_UNREACH, ICMP_HOST_UNREACH);
+                break;
             }
         }
+        pool->Free(index);
+    }
+    worker.unreachable.clear();
+
+    // The loop has already flushed this iteration's batch
+    FlushTx(worker);
+    return run;
+}
+
+/**
+ * @brief Forward an IPv4 packet (general path)
+ * @param worker Worker that received the packet
+ * @param data Data buffer
+ * @param size Data size
+ * @param route Next hop index from Fib::Lookup(), or ROUTE_LOOKUP
+ * @return Success or failure code
+ *
+ * Validates everything FastPathParser does not accept: options, bad
+ * lengths and checksums, expiring TTLs and packets for us.
+ */
+__attribute__((noinline, cold))
+int Router::ForwardIp(Worker& worker, u_char* data, int size, int route) {
+    int device_number = worker.device_number;
+    u_char* tmp_ptr = data + sizeof(struct ether_header);
+    int tmp_len = size - sizeof(struct ether_header);
+
+    // IP header
+    if (tmp_len < static_cast<int>(sizeof(struct iphdr))) {
+        LOG_DEBUG_LIMITED("[%d]:tmp_len(%d) < sizeof(struct iphdr)\n", device_number, tmp_len);
+        worker.stats.Drop(DROP_SHORT_FRAME);
+        return -1;
+    }
+    struct iphdr* ip_hdr = (struct iphdr*)tmp_ptr;
+
+    // Options stay in place; they are only needed to verify the checksum
+    int option_len = ip_hdr->ihl * 4 - sizeof(struct iphdr);
+    if (option_len < 0 || ip_hdr->ihl * 4 > tmp_len) {
+        LOG_DEBUG_LIMITED("[%d]:IP ihl(%d):bad header length\n", device_number, ip_hdr->ihl);
+        worker.stats.Drop(DROP_BAD_HEADER);
+        return -1;
+    }
+
+    // The frame is forwarded as received, Ethernet padding included, so it
+    // only has to hold the whole datagram
+    int total_len = ntohs(ip_hdr->tot_len);
+    if (total_len < ip_hdr->ihl * 4 || total_len > tmp_len) {
+        LOG_DEBUG_LIMITED("[%d]:IP tot_len(%d):bad total length\n", device_number, total_len);
+        worker.stats.Drop(DROP_BAD_HEADER);
+        return -1;
+    }
+
+    if (config.verify_checksum &&
+        !NetworkUtil::CheckIPChecksum(ip_hdr, tmp_ptr + sizeof(struct iphdr), option_len)) {
+        LOG_DEBUG_LIMITED("[%d]:bad IP checksum\n", device_number);
+        worker.stats.Drop(DROP_BAD_CHECKSUM);
+        return -1;
+    }
+
+    if (ip_hdr->ttl <= 1) {
+        LOG_DEBUG_LIMITED("[%d]:TTL <= 1\n", device_number);
+        worker.stats.Drop(DROP_TTL_EXPIRED);
+        SendIcmpError(worker, device_number, data, size, ICMP_TIME_EXCEEDED, ICMP_TIMXCEED_INTRANS);
+        return -1;
+    }
+
+    // Check if the destination IP is our interface
+    if (IsLocalAddress(ip_hdr->daddr)) {
+        LOG_DEBUG_LIMITED("[%d]:recv:myaddr\n", device_number);
+        worker.stats.Drop(DROP_LOCAL);
+        return -1;
+    }
+
+    return ForwardChecked(worker, data, size, ip_hdr, route);
+}
+
+/**
+ * @brief Forward an IPv4 packet whose header has been checked
+ * @param worker Worker that received the packet
+ * @param data Data buffer
+ * @param size Data size
+ * @param ip_hdr IP header, TTL above 1, not addressed to us
+ * @param route Next hop index from Fib::Lookup(), or ROUTE_LOOKUP
+ * @return Success or failure code
+ *
+ * The TTL is only decremented once a route is found, so that an error
+ * about an unroutable packet quotes its header as received.
+ */
+int Router::ForwardChecked(Worker& worker, u_char* data, int size, struct iphdr* ip_hdr, int route) {
+    // Route cache hit: no FIB and no neighbor lookup
+    const RouteCache::Entry* cached = worker.route_cache.Lookup(ip_hdr->daddr, worker.route_generation);
+    if (cached != nullptr) {
+        // Decrement TTL, adjusting the checksum instead of recomputing it
+        NetworkUtil::DecrementTtl(ip_hdr);
+        memcpy(data, cached->header, sizeof(struct ether_header));
+        ip2mac_manager.Touch(cached->neighbor);
+        LOG_DEBUG("write:[%d] %dbytes\n", cached->device_number, size);
+        return Transmit(worker, cached->device_number, data, size);
+    }
+
+    // Look up the egress interface and next hop
+    if (route == ROUTE_LOOKUP) {
+        route = worker.fib->Lookup(ip_hdr->daddr);
+    }
+    if (__builtin_expect(route < 0, 0)) {
+        LOG_DEBUG_LIMITED("[%d]:no route to %s\n", worker.device_number,
+                          NetworkUtil::InAddrToString(ip_hdr->daddr).c_str());
+        worker.stats.Drop(DROP_NO_ROUTE);
+        SendIcmpError(worker, worker.device_number, data, size, ICMP_DEST_UNREACH, ICMP_NET_UNREACH);
+        return -1;
+    }
+    const NextHop& hop = worker.fib->GetNextHop(route);
+    int target_device = hop.device_number;
+
+    // Routable: forwarded now or queued for ARP with the TTL decremented
+    NetworkUtil::DecrementTtl(ip_hdr);
+
+    // Get next hop IP
+    in_addr_t next_hop = (hop.gateway != 0) ? hop.gateway : ip_hdr->daddr;
+
+    // Fast path: resolved neighbor, no lock taken. The neighbor caches the
+    // whole Ethernet header, so the rewrite is one fixed-size copy
+    alignas(16) unsigned char l2_header[IP2MAC_L2_SIZE];
+    IP2MAC* neighbor;
+    if (ip2mac_manager.Lookup(target_device, next_hop, l2_header, &neighbor) == 1) {
+        worker.route_cache.Insert(ip_hdr->daddr, worker.route_generation, target_device, neighbor, l2_header);
+        memcpy(data, l2_header, sizeof(struct ether_header));
+        LOG_DEBUG("write:[%d] %dbytes\n", target_device, size);
+        return Transmit(worker, target_device, data, size);
+    }
+
+    return ForwardUnresolved(worker, data, size, target_device, next_hop);
+}
+
+/**
+ * @brief Forward or queue a packet whose neighbor missed the lock-free lookup
+ * @param worker Worker that received the packet
+ * @param data Data buffer
+ * @param size Data size
+ * @param target_device Egress device
+ * @param next_hop Neighbor address
+ * @return Success or failure code
+ */
+__attribute__((noinline, cold))
+int Router::ForwardUnresolved(Worker& worker, u_char* data, int size, int target_device, in_addr_t next_hop) {
+    int device_number = worker.device_number;
+    struct ether_header* eth_hdr = (struct ether_header*)data;
+
+    // Slow path: neighbor updates are serialized between workers. Queued
+    // packets keep the Ethernet header they were received with, so that a
+    // Host Unreachable can be sent if resolution fails; it is rewritten when
+    // they are drained
+    std::lock_guard<std::mutex> lock(neighbor_mutex);
+    int discarded;
+    IP2MAC* ip2mac = ip2mac_manager.GetIp2Mac(target_device, next_hop, nullptr, &discarded);
+    if (discarded > 0) {
+        // Queued for a neighbor evicted from the full table
+        worker.stats.Drop(DROP_PENDING_FULL, discarded);
+    }
+    if (ip2mac == nullptr) {
+        LOG_DEBUG_LIMITED("[%d]:ip2mac:error\n", device_number);
+        worker.stats.Drop(DROP_NEIGHBOR);
+        return -1;
+    }
+
+    if (ip2mac->flag == FLAG_NG) {
+        LOG_DEBUG_LIMITED("[%d]:ip2mac:error\n", device_number);
+        worker.stats.Drop(DROP_NEIGHBOR);
+        return -1;
+    }
+
+    // Unresolved packets wait in the neighbor's queue; only the state
+    // machine sends requests, so a burst to one neighbor costs one request
+    int evicted;
+    int resolved = arp_resolver.Resolve(ip2mac, data, size, &evicted);
+    if (evicted > 0) {
+        // Older packets pushed out of the neighbor's full queue
+        worker.stats.Drop(DROP_PENDING_FULL, evicted);
+    }
+    if (resolved == 1) {
+        memcpy(eth_hdr->ether_dhost, ip2mac->hw_addr, 6);
+        memcpy(eth_hdr->ether_shost, interface_info[target_device].hw_addr, 6);
+        LOG_DEBUG("write:[%d] %dbytes\n", target_device, size);
+        return Transmit(worker, target_device, data, size);
+    } else if (resolved < 0) {
+        LOG_DEBUG_LIMITED("[%d]:pending queue:no buffer\n", device_number);
+        worker.stats.Drop(DROP_PENDING_FULL);
+        return -1;
     }
 
     return 0;
@@ -382,46 +1350,369 @@ int Router::DisableIpForward() {
     return 0;
 }
 
+/**
+ * @brief Receive and analyze the frames of one loop iteration
+ * @param worker Receiving worker
+ * @return Number of frames received
+ *
+ * Frames are analyzed in bursts of up to burst_size as the engine hands
+ * them out; they are given back to it by FlushTx().
+ */
+int Router::Receive(Worker& worker) {
+    u_char* frames[MAX_BURST];
+    int sizes[MAX_BURST];
+    int received = 0;
+    int n;
+
+    while ((n = worker.io->RxBurst(frames, sizes, config.burst_size)) > 0) {
+        LATENCY_ONLY(worker.rx_tsc = Tsc::Now());
+        AnalyzePacketBurst(worker, frames, sizes, n);
+        received += n;
+    }
+    return received;
+}
+
+/**
+ * @brief Transmit a frame on a port
+ * @param worker Worker handling the frame
+ * @param target_device Egress port
+ * @param data Frame data (must stay valid until the worker's next FlushTx())
+ * @param size Frame length
+ * @return Success or failure code
+ *
+ * Frames for the worker's own port are staged by reference. Frames for
+ * another port are queued in the inbound ring of the worker with the same
+ * queue there, which is woken if it is about to block in poll(); the frame
+ * itself is handed over if the engine lets it go, and copied otherwise.
+ */
+int Router::Transmit(Worker& worker, int target_device, u_char* data, int size) {
+    if (target_device == worker.device_number) {
+        if (worker.io->Stage(data, size) < 0) {
+            worker.stats.Drop(DROP_TX);
+            return -1;
+        }
+        LATENCY_RECORD(worker.latency, LAT_FORWARD, worker.rx_tsc, 1);
+        LATENCY_ONLY(worker.rx_staged++);
+        return 0;
+    }
+
+    if (size > TxBatch::TX_SLOT_SIZE) {
+        LOG_DEBUG_LIMITED("[%d]:frame(%d) too big for port ring\n", worker.device_number, size);
+        worker.stats.Drop(DROP_TX);
+        return -1;
+    }
+
+    Worker& target = WorkerOf(target_device, worker.queue);
+    SpscRing<PortFrame>& ring = *target.inbound[worker.device_number * config.queues_per_port + worker.queue];
+    PortFrame* frame = ring.ProducerSlot();
+    if (frame == nullptr) {
+        LOG_DEBUG_LIMITED("[%d]:port ring to [%d] full\n", worker.device_number, target_device);
+        worker.stats.Drop(DROP_TX);
+        return -1;
+    }
+    if (worker.io->Detach(data)) {
+        frame->zero_copy = data;
+    } else {
+        memcpy(frame->data, data, size);
+        frame->zero_copy = nullptr;
+    }
+    frame->size = size;
+    LATENCY_ONLY(frame->rx_tsc = worker.rx_tsc);
+    ring.ProducerCommit();
+    LATENCY_RECORD(worker.latency, LAT_FORWARD, worker.rx_tsc, 1);
+
+    // Pairs with the fence in ProcessRouter(): either the target sees the
+    // frame before it sleeps, or we see it sleeping and wake it up
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (target.sleeping.load(std::memory_order_relaxed) && target.sleeping.exchange(false)) {
+        uint64_t one = 1;
+        if (write(target.wakeup_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            LOG_ERROR_LIMITED("write:eventfd: %s\n", strerror(errno));
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Stage frames queued by other workers for transmission
+ * @param worker Receiving worker
+ * @return Number of frames staged
+ *
+ * The frames stay in the rings until FlushTx() has sent them.
+ */
+int Router::DrainInbound(Worker& worker) {
+    int staged = 0;
+
+    for (size_t src = 0; src < worker.inbound.size(); src++) {
+        if (!worker.inbound[src]) {
+            continue;
+        }
+        SpscRing<PortFrame>& ring = *worker.inbound[src];
+        size_t available = ring.Available();
+        for (size_t i = worker.inbound_staged[src]; i < available; i++) {
+            PortFrame* frame = ring.ConsumerSlot(i);
+            if (frame->zero_copy != nullptr) {
+                if (worker.io->Stage(frame->zero_copy, frame->size) < 0) {
+                    worker.io->Release(frame->zero_copy);
+                    worker.stats.Drop(DROP_TX);
+                }
+            } else if (worker.io->Stage(frame->data, frame->size) < 0) {
+                worker.stats.Drop(DROP_TX);
+            }
+            LATENCY_RECORD(worker.latency, LAT_HANDOFF, frame->rx_tsc, 1);
+            staged++;
+        }
+        worker.inbound_staged[src] = available;
+    }
+
+    return staged;
+}
+
+/**
+ * @brief Transmit staged frames and release the buffers they reference
+ * @param worker Transmitting worker
+ *
+ * Forwarded frames reference the RX buffers, inbound ring slots or pool
+ * buffers they are stored in, so those are only released once the batch
+ * has been sent.
+ */
+void Router::FlushTx(Worker& worker) {
+    if (worker.io->Pending() > 0) {
+        size_t frames = 0;
+        size_t bytes = 0;
+        size_t rejected = 0;
+        worker.io->TxBurst(&frames, &bytes, &rejected);
+        WorkerStats::Add(worker.stats.tx_packets, frames);
+        WorkerStats::Add(worker.stats.tx_bytes, bytes);
+        if (rejected > 0) {
+            worker.stats.Drop(DROP_TX, rejected);
+        }
+
+#if ROUTER_LATENCY
+        // Our own frames share the receive timestamp of this iteration;
+        // inbound frames carry the one of the worker that received them
+        if (worker.rx_staged > 0) {
+            worker.latency.Record(LAT_TX, worker.rx_tsc, worker.rx_staged);
+        }
+        for (size_t src = 0; src < worker.inbound.size(); src++) {
+            for (size_t i = 0; i < worker.inbound_staged[src]; i++) {
+                worker.latency.Record(LAT_TX, worker.inbound[src]->ConsumerSlot(i)->rx_tsc);
+            }
+        }
+#endif
+    }
+    LATENCY_ONLY(worker.rx_staged = 0);
+
+    worker.io->Free();
+
+    for (int index : worker.pool_staged) {
+        send_buffer.Pool()->Free(index);
+    }
+    worker.pool_staged.clear();
+
+    for (size_t src = 0; src < worker.inbound.size(); src++) {
+        if (worker.inbound_staged[src] > 0) {
+            worker.inbound[src]->ConsumerRelease(worker.inbound_staged[src]);
+            worker.inbound_staged[src] = 0;
+        }
+    }
+}
+
+/**
+ * @brief Get the monotonic time in microseconds
+ * @return Microseconds since an arbitrary point
+ */
+static uint64_t NowUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
 /**
  * @brief Process router function
+ * @param worker Worker running the loop
+ *
+ * A blocking worker sleeps in poll() between loop iterations. A spinning
+ * worker skips poll() and asks its engine for frames every iteration; in
+ * PollMode::Adaptive it goes back to poll() once it has found nothing to
+ * do for idle_spin_us, and spins again as soon as it has work. Stop()
+ * wakes a sleeping worker through shutdown_fd, after which the worker
+ * sends what is still queued (see DrainOnStop()).
  */
-void Router::ProcessRouter() {
-    struct pollfd targets[2];
+void Router::ProcessRouter(Worker& worker) {
+    struct pollfd targets[4] = {};
+    nfds_t target_num = 3;
 
-    targets[0].fd = interface_info[0].socket_descriptor;
+    targets[0].fd = worker.io->Fd();
     targets[0].events = POLLIN | POLLERR;
-    targets[1].fd = interface_info[1].socket_descriptor;
-    targets[1].events = POLLIN | POLLERR;
+    targets[1].fd = worker.wakeup_fd;
+    targets[1].events = POLLIN;
+    targets[2].fd = shutdown_fd;
+    targets[2].events = POLLIN;
+    // An engine may receive ARP on a socket of its own
+    int control_fd = worker.io->ControlFd();
+    if (control_fd >= 0 && control_fd != targets[0].fd) {
+        targets[3].fd = control_fd;
+        targets[3].events = POLLIN;
+        target_num = 4;
+    }
+
+    size_t index = worker.device_number * config.queues_per_port + worker.queue;
+    rcu->Online(index);
+
+    bool spinning = (config.poll_mode != PollMode::Block);
+    uint64_t idle_since = 0;   // When an adaptive worker began to find no work, 0 if it had some
+    uint64_t timer_ms = 0;     // When the neighbor timers were last run
 
     while (running) {
-        int ready = poll(targets, 2, 1000);
+        if (spinning) {
+            int work = Receive(worker);
+            work += DrainInbound(worker);
+            FlushTx(worker);
+
+            if (work > 0) {
+                idle_since = 0;
+            } else if (config.poll_mode == PollMode::Adaptive) {
+                uint64_t now = NowUs();
+                if (idle_since == 0) {
+                    idle_since = now;
+                } else if (now - idle_since >= config.idle_spin_us) {
+                    spinning = false;
+                }
+            }
+
+            // The timers have millisecond resolution; running them on every
+            // pass would have all spinning workers contend for neighbor_mutex
+            uint64_t now_ms = TimerWheel::NowMs();
+            if (now_ms != timer_ms) {
+                timer_ms = now_ms;
+                RunNeighborTimers(worker);
+            }
+
+            // Nothing loaded from the FIB is used past this point
+            rcu->Quiescent(index);
+            continue;
+        }
+
+        // Announce that we may sleep, then make sure nothing was queued
+        // in the meantime
+        worker.sleeping.store(true);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int timeout = 1000;
+        for (auto& ring : worker.inbound) {
+            if (ring && !ring->Empty()) {
+                timeout = 0;
+                break;
+            }
+        }
+
+        // A sleeping worker does not hold up FIB reloads
+        rcu->Offline(index);
+        int ready = poll(targets, target_num, timeout);
+        rcu->Online(index);
+        worker.sleeping.store(false, std::memory_order_relaxed);
         if (ready == -1) {
             if (errno == EINTR) {
                 continue;
             }
-            DebugPerror("poll");
+            LOG_ERROR_LIMITED("poll: %s\n", strerror(errno));
             break;
         }
 
-        if (ready == 0) {
-            continue;
+        if (targets[1].revents & POLLIN) {
+            uint64_t count;
+            if (read(worker.wakeup_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+                LOG_ERROR_LIMITED("read:eventfd: %s\n", strerror(errno));
+            }
         }
 
-        // Check for data on interfaces
-        for (int i = 0; i < 2; i++) {
-            if (targets[i].revents & (POLLIN | POLLERR)) {
-                u_char buf[2048];
-                int size = read(targets[i].fd, buf, sizeof(buf));
-                if (size < 0) {
-                    DebugPerror("read");
-                } else if (size > 0) {
-                    AnalyzePacket(i, buf, size);
-                }
+        // Check for data on the port
+        int work = 0;
+        if ((targets[0].revents & (POLLIN | POLLERR)) || (targets[3].revents & POLLIN)) {
+            work += Receive(worker);
+        }
+
+        // Frames forwarded to this port by other workers
+        work += DrainInbound(worker);
+
+        // Send everything staged during this iteration
+        FlushTx(worker);
+
+        // Retransmit ARP requests, probe stale neighbors, drop failed queues
+        RunNeighborTimers(worker);
+
+        // Traffic is flowing again
+        if (config.poll_mode == PollMode::Adaptive && work > 0) {
+            spinning = true;
+            idle_since = 0;
+        }
+    }
+
+    DrainOnStop(worker, targets, target_num);
+    rcu->Offline(index);
+}
+
+/**
+ * @brief Send what was queued when the router stopped, until drain_ms has passed
+ * @param worker Stopping worker
+ * @param targets Descriptors polled by ProcessRouter(); [0] is the engine, [1] the wakeup eventfd
+ * @param target_num Number of descriptors
+ *
+ * The worker keeps forwarding, so that packets waiting for ARP get the
+ * replies they need, until no packet waits for ARP and its own rings and
+ * TX batch are empty. It then only sends what other workers still hand
+ * it, until every worker is done. Whatever is left at the deadline is
+ * dropped with the router.
+ */
+void Router::DrainOnStop(Worker& worker, struct pollfd* targets, nfds_t target_num) {
+    size_t index = worker.device_number * config.queues_per_port + worker.queue;
+    uint64_t deadline = NowUs() + config.drain_ms * 1000;
+    bool done = false;
+
+    // shutdown_fd stays readable
+    targets[2].fd = -1;
+
+    while (NowUs() < deadline) {
+        if (!done) {
+            Receive(worker);
+        }
+        DrainInbound(worker);
+        FlushTx(worker);
+        if (!done) {
+            RunNeighborTimers(worker);
+        }
+        rcu->Quiescent(index);
+
+        bool idle = (worker.io->Pending() == 0);
+        for (auto& ring : worker.inbound) {
+            if (ring && !ring->Empty()) {
+                idle = false;
+                break;
             }
         }
+        if (!done && idle && packet_pool.FreeCount() == packet_pool.Capacity()) {
+            done = true;
+            draining.fetch_sub(1);
+        }
+        if (done && idle && draining.load() == 0) {
+            break;
+        }
 
-        // Process send buffer
-        ip2mac_manager.BufferSend();
+        // Wait a little for ARP replies, or only for frames from other workers once done
+        rcu->Offline(index);
+        int ready = done ? poll(&targets[1], 1, 1) : poll(targets, target_num, 1);
+        rcu->Online(index);
+        if (ready > 0 && (targets[1].revents & POLLIN)) {
+            uint64_t count;
+            if (read(worker.wakeup_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+                LOG_ERROR_LIMITED("read:eventfd: %s\n", strerror(errno));
+            }
+        }
+    }
+
+    if (!done) {
+        draining.fetch_sub(1);
     }
 }
 
@@ -431,16 +1722,71 @@ void Router::ProcessRouter() {
  */
 int Router::Run() {
     running = true;
-    process_thread = std::thread(&Router::ProcessRouter, this);
+    draining = static_cast<int>(workers.size());
+    AsyncLog::Start();
+
+    if (stats_server.IsOpen()) {
+        stats_thread = std::thread(&Router::ServeStats, this);
+    }
+    if (!config.route_file.empty()) {
+        reload_thread = std::thread(&Router::WatchRoutes, this);
+    }
+
+    for (size_t i = 0; i < workers.size(); i++) {
+        Worker* w = workers[i].get();
+        w->thread = std::thread(&Router::ProcessRouter, this, std::ref(*w));
+
+        int cpu = WorkerCpu(i);
+        if (cpu >= 0) {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(cpu, &cpus);
+            int err = pthread_setaffinity_np(w->thread.native_handle(), sizeof(cpus), &cpus);
+            if (err != 0) {
+                DebugPrintf("[%d/%d]:pthread_setaffinity_np:%s\n", w->device_number, w->queue, strerror(err));
+            }
+        }
+    }
+
     return 0;
 }
 
 /**
- * @brief Stop router
+ * @brief Stop router, once the workers have sent what was queued or drain_ms has passed
  */
 void Router::Stop() {
-    running = false;
-    if (process_thread.joinable()) {
-        process_thread.join();
+    // Also run by the destructor; only the first call reports
+    bool was_running = running.exchange(false);
+
+    // Wake every thread so it notices the flag without waiting for a timeout
+    if (shutdown_fd >= 0) {
+        uint64_t one = 1;
+        if (write(shutdown_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            DebugPerror("write:eventfd");
+        }
     }
-}
\ No newline at end of file
+
+    for (auto& worker : workers) {
+        if (worker->thread.joinable()) {
+            worker->thread.join();
+        }
+    }
+    if (stats_thread.joinable()) {
+        stats_thread.join();
+    }
+    if (reload_thread.joinable()) {
+        reload_thread.join();
+    }
+    stats_server.Close();
+
+    // Everything the workers logged is written before returning
+    AsyncLog::Stop();
+    if (was_running) {
+        size_t pending = packet_pool.Capacity() - packet_pool.FreeCount();
+        if (pending > 0) {
+            DebugPrintf("stop: %zu packets still waiting for ARP dropped\n", pending);
+        }
+        ReportStats();
+        LATENCY_ONLY(ReportLatency());
+    }
+}
@@ -14,21 +14,77 @@
 #include <poll.h>
 #include <thread>
 #include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
 #include <unistd.h>  // For close(), read(), write()
 #include "base.hpp"
 #include "send_buf.hpp"
 #include "ip2mac.hpp"
 #include "netutil.hpp"
+#include "packet_io.hpp"
+#include "xdp_io.hpp"
+#include "fib.hpp"
+#include "spsc_ring.hpp"
+#include "rcu.hpp"
+#include "packet_pool.hpp"
+#include "arp_resolver.hpp"
+#include "route_cache.hpp"
+#include "icmp_limiter.hpp"
+#include "async_log.hpp"
+#include "stats.hpp"
+#include "latency.hpp"
+#include "packet_parser.hpp"
+
+/**
+ * @brief How a worker waits for frames
+ */
+enum class PollMode {
+    Block,     // Sleep in poll() until a frame or a wakeup arrives
+    Busy,      // Never sleep; receive in a tight loop
+    Adaptive   // Spin while busy, sleep in poll() after idle_spin_us without work
+};
 
 /**
  * @brief Router configuration class
  */
 class RouterConfig {
 public:
-    std::string receiving_interface;   // Receiving interface name
-    std::string sending_interface;     // Sending interface name
+    std::vector<std::string> interfaces;  // Interface names, one port each
     bool debug_out;                    // Debug output flag
     std::string next_router;           // Next hop router IP
+    IoEngine io_engine;                // Packet I/O engine
+    RxMode rx_mode;                    // Packet receive mode (IoEngine::Raw only)
+    unsigned int ring_block_size;      // RX ring block size in bytes
+    unsigned int ring_block_num;       // RX ring block count
+    int burst_size;                    // Frames received per recvmmsg() call
+    int prefetch_depth;                // Frames a burst prefetches ahead of the one forwarded, 0 for none
+    PollMode poll_mode;                // How workers wait for frames
+    int busy_poll_us;                  // SO_BUSY_POLL time of spinning workers' sockets, 0 for none
+    uint64_t idle_spin_us;             // Idle time before an adaptive worker sleeps
+    std::string route_file;            // Static routes to load and reload when changed, empty for none
+    bool pin_workers;                  // Pin each worker thread to a CPU
+    size_t port_ring_size;             // Frames queued between two workers
+    int queues_per_port;               // Sockets (and workers) per interface
+    FanoutMode fanout_mode;            // How an interface's packets are spread over its sockets
+    bool verify_checksum;              // Drop forwarded packets whose IP header checksum is wrong
+    size_t packet_pool_size;           // Buffers for packets waiting for ARP resolution
+    size_t umem_frames;                // Buffers of the UMEM shared by all sockets (IoEngine::Xdp only)
+    unsigned long pending_queue_depth; // Packets queued per unresolved neighbor
+    unsigned long pending_queue_bytes; // Bytes queued per unresolved neighbor
+    size_t route_cache_size;           // Per-worker route cache entries
+    size_t neighbor_table_size;        // Entries of the neighbor table
+    std::string stats_socket;          // Unix socket path serving counters, empty for none
+    uint64_t arp_retrans_ms;           // Time between ARP requests for one neighbor
+    int arp_max_probes;                // ARP requests sent before a neighbor is given up
+    uint64_t arp_reachable_ms;         // Time a confirmed neighbor is used without probing
+    int arp_rate;                      // ARP requests per second over all neighbors
+    int arp_burst;                     // ARP requests that may be sent back to back
+    int icmp_rate;                     // ICMP errors per second over all destinations
+    int icmp_burst;                    // ICMP errors that may be sent back to back
+    int icmp_source_rate;              // ICMP errors per second to one destination
+    int icmp_source_burst;             // ICMP errors that may be sent back to back to one destination
+    uint64_t drain_ms;                 // Time stopping workers get to send queued and ARP-pending packets
 
     /**
      * @brief Constructor
@@ -38,6 +94,19 @@ public:
 
 /**
  * @brief Router class
+ *
+ * Every port is served by one or more worker threads, each with its own
+ * PacketIO engine, that receive, classify and forward. With several queues
+ * per port the raw sockets form a PACKET_FANOUT group, and AF_XDP sockets
+ * are bound to the device receive queues, so every flow stays on one
+ * worker. Frames leaving through another port are handed to the worker
+ * with the same queue number on that port through a lock-free SPSC ring,
+ * so each engine's TX batch has a single owner and flow order is kept.
+ * Engines sharing a UMEM hand over the frame buffer instead of a copy.
+ *
+ * Workers look routes up in a published FIB without locking it. A reload
+ * builds a new table on another thread, swaps the pointer and frees the
+ * old table after an RCU grace period; the neighbor table is kept.
  */
 class Router {
 public:
@@ -65,23 +134,138 @@ public:
     int Run();
 
     /**
-     * @brief Stop router
+     * @brief Stop router, once the workers have sent what was queued or drain_ms has passed
      */
     void Stop();
 
+    static const int MAX_BURST = 64;     // Maximum frames per AnalyzePacketBurst()
+
 private:
+    friend class RouterBench;            // Drives the forwarding path without sockets (bench/)
+
+    /**
+     * @brief Frame handed from one worker to another
+     */
+    class PortFrame {
+    public:
+        int size;                               // Frame length
+        u_char* zero_copy;                      // Frame detached from the sender's engine, or nullptr for data
+#if ROUTER_LATENCY
+        uint64_t rx_tsc;                        // When the sending worker received the frame
+#endif
+        u_char data[TxBatch::TX_SLOT_SIZE];     // Frame data
+    };
+
+    /**
+     * @brief Per-queue worker state, owned by the worker thread
+     */
+    class Worker {
+    public:
+        int device_number;                 // Port served by this worker
+        int queue;                         // Queue of the port served by this worker
+        int numa_node;                     // NUMA node of the worker's CPU, -1 if unknown or not pinned
+        std::unique_ptr<PacketIO> io;      // Frame I/O of this queue
+        std::thread thread;                // Worker thread
+        int wakeup_fd;                     // eventfd signalled when inbound frames are queued
+        std::atomic<bool> sleeping;        // Set while the worker may block in poll()
+        std::vector<std::unique_ptr<SpscRing<PortFrame>>> inbound;  // Frames from each worker, by worker index
+        std::vector<size_t> inbound_staged;  // Inbound frames staged but not yet released
+        std::vector<int> pool_staged;      // Pool buffers staged but not yet released
+        RouteCache route_cache;            // Forwarding decisions of recent destinations
+        const Fib* fib;                    // FIB of the current burst (see LoadFib())
+        uint64_t route_generation;         // Route cache generation of the current burst
+        WorkerStats stats;                 // Packet and drop counters
+        IcmpLimiter icmp_limiter;          // Rate limit of the ICMP errors this worker generates
+        std::vector<int> unreachable;      // Pool buffers of packets whose neighbor failed (RunNeighborTimers())
+        u_char icmp_frame[TxBatch::TX_SLOT_SIZE];  // ICMP error being built for another port
+#if ROUTER_LATENCY
+        uint64_t rx_tsc;                   // When the frames being analyzed were received
+        uint64_t rx_staged;                // Own frames staged since the last FlushTx()
+        LatencyStats latency;              // Per-stage latency histograms
+#endif
+
+        /**
+         * @brief Constructor
+         * @param device_number Port served by this worker
+         * @param queue Queue of the port served by this worker
+         * @param route_cache_size Entries of the route cache
+         * @param numa_node NUMA node of the worker's CPU, -1 if unknown
+         */
+        Worker(int device_number, int queue, size_t route_cache_size, int numa_node = -1);
+    };
+
     RouterConfig config;                 // Router configuration
-    InterfaceInfo interface_info[2];     // Interface information
+    std::vector<InterfaceInfo> interface_info;  // Interface information
     struct in_addr next_router;          // Next hop router IP address
     std::atomic<bool> running;           // Running flag
-    std::thread process_thread;          // Processing thread
+    int shutdown_fd;                     // eventfd signalled by Stop(), polled by every thread while running
+    std::atomic<int> draining;           // Stopping workers still sending what was queued
+    std::unique_ptr<PacketPool> umem;    // Frames of every AF_XDP socket (IoEngine::Xdp only)
+    std::vector<std::unique_ptr<XdpProgram>> xdp_programs;  // XDP program of each port (IoEngine::Xdp only)
+    std::vector<std::unique_ptr<Worker>> workers;  // Workers by (port * queues_per_port + queue)
+    PacketPool packet_pool;              // Buffers of packets waiting for ARP (outlives ip2mac_manager)
     IP2MACManager ip2mac_manager;        // IP to MAC address manager
     SendBuf send_buffer;                 // Send buffer
+    std::atomic<Fib*> fib;               // Published forwarding table, replaced whole by ReloadRoutes()
+    std::unique_ptr<Rcu> rcu;            // Grace periods of the workers' FIB pointers, readers by worker index
+    std::thread reload_thread;           // Thread reloading route_file when it changes
+    std::mutex neighbor_mutex;           // Serializes neighbor updates and pending queues
+    ArpResolver arp_resolver;            // Neighbor resolution state machine
+    StatsServer stats_server;            // Counter export
+    std::thread stats_thread;            // Thread answering stats_server
 
     /**
      * @brief Process router function
+     * @param worker Worker running the loop
+     */
+    void ProcessRouter(Worker& worker);
+
+    /**
+     * @brief Send what was queued when the router stopped, until drain_ms has passed
+     * @param worker Stopping worker
+     * @param targets Descriptors polled by ProcessRouter(); [0] is the engine, [1] the wakeup eventfd
+     * @param target_num Number of descriptors
+     */
+    void DrainOnStop(Worker& worker, struct pollfd* targets, nfds_t target_num);
+
+    /**
+     * @brief Receive and analyze the frames of one loop iteration
+     * @param worker Receiving worker
+     * @return Number of frames received
+     */
+    int Receive(Worker& worker);
+
+    /**
+     * @brief Create and open the packet I/O engine of a worker
+     * @param worker Worker
+     * @param fanout Fanout mode of the port's raw sockets
+     * @param fanout_group Fanout group id of the port
+     * @return Success or failure code
+     */
+    int OpenPacketIO(Worker& worker, FanoutMode fanout, int fanout_group);
+
+    /**
+     * @brief Stage frames queued by other workers for transmission
+     * @param worker Receiving worker
+     * @return Number of frames staged
+     */
+    int DrainInbound(Worker& worker);
+
+    /**
+     * @brief Transmit staged frames and release the buffers they reference
+     * @param worker Transmitting worker
+     */
+    void FlushTx(Worker& worker);
+
+    /**
+     * @brief Transmit a frame on a port
+     * @param worker Worker handling the frame
+     * @param target_device Egress port
+     * @param data Frame data (must stay valid until the worker's next FlushTx())
+     * @param size Frame length
+     * @return Success or failure code
      */
-    void ProcessRouter();
+    int Transmit(Worker& worker, int target_device, u_char* data, int size);
 
     /**
      * @brief Debug print function
@@ -99,25 +283,241 @@ private:
     int DebugPerror(const char* msg);
 
     /**
-     * @brief Send ICMP Time Exceeded message
-     * @param device_number Device number
-     * @param eth_hdr Ethernet header
-     * @param ip_hdr IP header
+     * @brief Send an ICMP error about a packet back to its source
+     * @param worker Worker generating the error
+     * @param device_number Port the packet was received on
+     * @param data Frame of the packet, as received
+     * @param size Frame length
+     * @param type ICMP type
+     * @param code ICMP code
+     * @return 1 if the error was staged, 0 if it was suppressed, -1 on error
+     */
+    int SendIcmpError(Worker& worker, int device_number, const u_char* data, int size, int type, int code);
+
+    enum FrameClass {
+        FRAME_DROP,    // Malformed, not for us, or unsupported type
+        FRAME_ARP,     // ARP
+        FRAME_IP       // IPv4
+    };
+
+    /**
+     * @brief Classify a received frame
+     * @param worker Worker that received the frame (counts drops)
      * @param data Data buffer
      * @param size Data size
-     * @return Success or failure code
+     * @return FRAME_ARP, FRAME_IP or FRAME_DROP
      */
-    int SendIcmpTimeExceeded(int device_number, struct ether_header* eth_hdr,
-                             struct iphdr* ip_hdr, u_char* data, int size);
+    int ClassifyPacket(Worker& worker, u_char* data, int size);
 
     /**
      * @brief Analyze packet
-     * @param device_number Device number
+     * @param worker Worker that received the packet
+     * @param data Data buffer
+     * @param size Data size
+     * @return Success or failure code
+     */
+    int AnalyzePacket(Worker& worker, u_char* data, int size);
+
+    /**
+     * @brief Analyze a burst of packets received on one port
+     * @param worker Worker that received the packets
+     * @param frames Frame pointers
+     * @param sizes Frame sizes
+     * @param n Number of frames (at most MAX_BURST)
+     * @return Number of frames forwarded
+     */
+    int AnalyzePacketBurst(Worker& worker, u_char** frames, int* sizes, int n);
+
+    /**
+     * @brief Analyze a burst, specialized on checksum verification
+     * @tparam VerifyChecksum config.verify_checksum
+     * @param worker Worker that received the packets
+     * @param frames Frame pointers
+     * @param sizes Frame sizes
+     * @param n Number of frames (at most MAX_BURST)
+     * @return Number of frames forwarded
+     */
+    template <bool VerifyChecksum>
+    int AnalyzeBurst(Worker& worker, u_char** frames, int* sizes, int n);
+
+    /**
+     * @brief Check whether a frame can take the forwarding fast path
+     * @tparam VerifyChecksum config.verify_checksum
+     * @param worker Worker that received the frame
+     * @param data Data buffer
+     * @param size Data size
+     * @return IPv4 header of the frame, or nullptr if the frame needs the general path
+     */
+    template <bool VerifyChecksum>
+    struct iphdr* MatchFastPath(const Worker& worker, u_char* data, int size) const {
+        struct iphdr* ip_hdr = FastPathParser<VerifyChecksum>::Match(
+            data, static_cast<uint32_t>(size), interface_info[worker.device_number].hw_addr);
+        return (ip_hdr != nullptr && !IsLocalAddress(ip_hdr->daddr)) ? ip_hdr : nullptr;
+    }
+
+    /**
+     * @brief Analyze an ARP packet
+     * @param worker Worker that received the packet
      * @param data Data buffer
      * @param size Data size
      * @return Success or failure code
      */
-    int AnalyzePacket(int device_number, u_char* data, int size);
+    int AnalyzeArp(Worker& worker, u_char* data, int size);
+
+    /**
+     * @brief Transmit the packets queued for a neighbor that has been resolved
+     * @param worker Worker that learned the neighbor's address
+     * @param ip2mac Neighbor (neighbor_mutex must be held)
+     * @return Number of packets transmitted
+     */
+    int DrainPending(Worker& worker, IP2MAC* ip2mac);
+
+    /**
+     * @brief Answer stats_server connections until the router stops
+     */
+    void ServeStats();
+
+    /**
+     * @brief Render every worker's counters, summed per port
+     * @return Snapshot in the Prometheus text format
+     */
+    std::string RenderStats() const;
+
+    /**
+     * @brief Print the non-zero counters to stderr
+     */
+    void ReportStats() const;
+
+#if ROUTER_LATENCY
+    /**
+     * @brief Sum every worker's latency histograms
+     * @param sum Histograms to add to
+     */
+    void SumLatency(LatencyStats* sum) const;
+
+    /**
+     * @brief Print p50/p99/p999 of every stage to stderr
+     */
+    void ReportLatency() const;
+#endif
+
+    /**
+     * @brief Run the neighbor timers (retransmits, probes, failures)
+     * @param worker Worker running the timers (sends Host Unreachable for failed packets)
+     * @return Number of timers run
+     */
+    int RunNeighborTimers(Worker& worker);
+
+    /**
+     * @brief Take the published FIB for the frames about to be analyzed
+     * @param worker Worker starting a burst
+     *
+     * Route cache entries are checked against the combined generation of
+     * the FIB and the neighbor table. Both are read before any lookup, so
+     * that a change made during the burst makes the entries it fills miss
+     * next time.
+     */
+    void LoadFib(Worker& worker) {
+        worker.fib = fib.load(std::memory_order_acquire);
+        worker.route_generation = (static_cast<uint64_t>(worker.fib->Generation()) << 32) |
+                                  ip2mac_manager.Generation();
+    }
+
+    static const int ROUTE_LOOKUP = -2;  // ForwardIp() route argument: look the route up
+
+    /**
+     * @brief Forward an IPv4 packet (general path)
+     * @param worker Worker that received the packet
+     * @param data Data buffer
+     * @param size Data size
+     * @param route Next hop index from Fib::Lookup(), or ROUTE_LOOKUP
+     * @return Success or failure code
+     */
+    int ForwardIp(Worker& worker, u_char* data, int size, int route);
+
+    /**
+     * @brief Forward an IPv4 packet whose header has been checked
+     * @param worker Worker that received the packet
+     * @param data Data buffer
+     * @param size Data size
+     * @param ip_hdr IP header, TTL above 1, not addressed to us
+     * @param route Next hop index from Fib::Lookup(), or ROUTE_LOOKUP
+     * @return Success or failure code
+     */
+    int ForwardChecked(Worker& worker, u_char* data, int size, struct iphdr* ip_hdr, int route);
+
+    /**
+     * @brief Forward or queue a packet whose neighbor missed the lock-free lookup
+     * @param worker Worker that received the packet
+     * @param data Data buffer
+     * @param size Data size
+     * @param target_device Egress device
+     * @param next_hop Neighbor address
+     * @return Success or failure code
+     */
+    int ForwardUnresolved(Worker& worker, u_char* data, int size, int target_device, in_addr_t next_hop);
+
+    /**
+     * @brief Check whether an address belongs to one of our interfaces
+     * @param addr IP address
+     * @return true if the address is local
+     */
+    bool IsLocalAddress(in_addr_t addr) const;
+
+    /**
+     * @brief Build the forwarding table from the interfaces and configuration
+     * @param table Empty table to fill
+     * @return Success or failure code
+     */
+    int BuildFib(Fib& table);
+
+    /**
+     * @brief Load static routes from a file
+     * @param table Table to add the routes to
+     * @param path File path
+     * @return Success or failure code
+     */
+    int LoadRoutes(Fib& table, const std::string& path);
+
+    /**
+     * @brief Rebuild the forwarding table and publish it to the workers
+     * @return Success or failure code; on failure the current table is kept
+     */
+    int ReloadRoutes();
+
+    /**
+     * @brief Reload route_file whenever it changes, until the router stops
+     */
+    void WatchRoutes();
+
+    /**
+     * @brief Get the device number of an interface name
+     * @param name Interface name
+     * @return Device number or -1 if unknown
+     */
+    int DeviceNumber(const std::string& name) const;
+
+    /**
+     * @brief Get the worker serving a port's queue
+     * @param device_number Port
+     * @param queue Queue of the port
+     * @return Worker
+     */
+    Worker& WorkerOf(int device_number, int queue) {
+        return *workers[device_number * config.queues_per_port + queue];
+    }
+
+    /**
+     * @brief Get the CPU a worker thread is pinned to
+     * @param index Worker index
+     * @return CPU number or -1 if workers are not pinned
+     */
+    int WorkerCpu(size_t index) const;
+
+    /**
+     * @brief Close all engines and detach XDP programs
+     */
+    void CloseInterfaces();
 
     /**
      * @brief Disable IP forwarding
@@ -126,4 +526,4 @@ private:
     int DisableIpForward();
 };
 
-#endif // ROUTER_HPP
\ No newline at end of file
+#endif // ROUTER_HPP
@@ -0,0 +1,61 @@
+/**
+ * @file rx_batch.cpp
+ * @brief Implementation of batched packet reception
+ */
+
+#include "rx_batch.hpp"
+#include "async_log.hpp"
+#include <cerrno>
+#include <cstring>
+
+/**
+ * @brief Constructor
+ * @param capacity Maximum number of frames per Receive()
+ */
+RxBatch::RxBatch(size_t capacity)
+    : msgs(capacity), iovs(capacity), addrs(capacity),
+      slot_buf(capacity * RX_SLOT_SIZE) {
+    memset(msgs.data(), 0, msgs.size() * sizeof(struct mmsghdr));
+    for (size_t i = 0; i < capacity; i++) {
+        iovs[i].iov_base = slot_buf.data() + i * RX_SLOT_SIZE;
+        iovs[i].iov_len = RX_SLOT_SIZE;
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = &addrs[i];
+    }
+}
+
+/**
+ * @brief Destructor
+ */
+RxBatch::~RxBatch() {
+}
+
+/**
+ * @brief Receive as many frames as are queued, up to a limit
+ * @param soc Packet socket descriptor
+ * @param max Maximum number of frames (clamped to the capacity)
+ * @return Number of frames received or -1 on error
+ */
+int RxBatch::Receive(int soc, int max) {
+    size_t num = msgs.size();
+    if (max > 0 && static_cast<size_t>(max) < num) {
+        num = max;
+    }
+
+    // msg_namelen is an in/out field and has to be reset for every call
+    for (size_t i = 0; i < num; i++) {
+        msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_ll);
+    }
+
+    int ret = recvmmsg(soc, msgs.data(), num, MSG_DONTWAIT, nullptr);
+    if (ret < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            return 0;
+        }
+        LOG_ERROR_LIMITED("recvmmsg: %s\n", strerror(errno));
+        return -1;
+    }
+
+    return ret;
+}
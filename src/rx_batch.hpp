@@ -0,0 +1,82 @@
+/**
+ * @file rx_batch.hpp
+ * @brief Header file for batched packet reception
+ */
+
+#ifndef RX_BATCH_HPP
+#define RX_BATCH_HPP
+
+#include <linux/if_packet.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <vector>
+
+/**
+ * @brief Batch of frames received with a single recvmmsg() call
+ *
+ * Each slot owns a frame buffer. The buffers are overwritten by the next
+ * Receive(), so frames staged for transmission must be flushed first.
+ */
+class RxBatch {
+public:
+    /**
+     * @brief Constructor
+     * @param capacity Maximum number of frames per Receive()
+     */
+    RxBatch(size_t capacity = 32);
+
+    /**
+     * @brief Destructor
+     */
+    ~RxBatch();
+
+    RxBatch(const RxBatch&) = delete;
+    RxBatch& operator=(const RxBatch&) = delete;
+
+    /**
+     * @brief Receive as many frames as are queued, up to a limit
+     * @param soc Packet socket descriptor
+     * @param max Maximum number of frames (clamped to the capacity)
+     * @return Number of frames received or -1 on error
+     */
+    int Receive(int soc, int max);
+
+    /**
+     * @brief Get a received frame
+     * @param i Frame index
+     * @return Pointer to frame data
+     */
+    u_char* Data(int i) { return slot_buf.data() + static_cast<size_t>(i) * RX_SLOT_SIZE; }
+
+    /**
+     * @brief Get the length of a received frame
+     * @param i Frame index
+     * @return Frame length
+     */
+    int Length(int i) const { return msgs[i].msg_len; }
+
+    /**
+     * @brief Check whether a received frame was sent by this host
+     * @param i Frame index
+     * @return true if the frame is an outgoing copy
+     */
+    bool IsOutgoing(int i) const { return addrs[i].sll_pkttype == PACKET_OUTGOING; }
+
+    /**
+     * @brief Check whether a received frame did not fit in its slot
+     * @param i Frame index
+     * @return true if only part of the frame was received
+     */
+    bool IsTruncated(int i) const { return (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) != 0; }
+
+    static const int RX_SLOT_SIZE = 2048;   // Size of one frame buffer
+
+private:
+    std::vector<struct mmsghdr> msgs;        // Message headers
+    std::vector<struct iovec> iovs;          // One iovec per slot
+    std::vector<struct sockaddr_ll> addrs;   // Source address per slot
+    std::vector<u_char> slot_buf;            // Frame buffers
+};
+
+#endif // RX_BATCH_HPP
@@ -0,0 +1,152 @@
+/**
+ * @file rx_ring.cpp
+ * @brief Implementation of the PACKET_MMAP (TPACKET_V3) receive ring
+ */
+
+#include "rx_ring.hpp"
+#include <cstdio>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+/**
+ * @brief Constructor
+ */
+RxRing::RxRing() : map(nullptr), map_size(0), current(0), taken(0) {
+}
+
+/**
+ * @brief Destructor
+ */
+RxRing::~RxRing() {
+    Teardown();
+}
+
+/**
+ * @brief Attach a ring to a packet socket and map it
+ * @param soc Packet socket descriptor
+ * @param block_size Size of one block in bytes (multiple of the page size)
+ * @param block_num Number of blocks
+ * @param frame_size Nominal frame size in bytes
+ * @return Success or failure code
+ */
+int RxRing::Setup(int soc, unsigned int block_size, unsigned int block_num, unsigned int frame_size) {
+    int version = TPACKET_V3;
+    if (setsockopt(soc, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0) {
+        perror("setsockopt:PACKET_VERSION");
+        return -1;
+    }
+
+    struct tpacket_req3 req;
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = block_size;
+    req.tp_block_nr = block_num;
+    req.tp_frame_size = frame_size;
+    req.tp_frame_nr = (block_size / frame_size) * block_num;
+    req.tp_retire_blk_tov = 1;  // Retire partially filled blocks after 1ms
+    req.tp_feature_req_word = 0;
+
+    if (setsockopt(soc, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+        perror("setsockopt:PACKET_RX_RING");
+        return -1;
+    }
+
+    map_size = static_cast<size_t>(block_size) * block_num;
+    void* addr = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, soc, 0);
+    if (addr == MAP_FAILED) {
+        perror("mmap:PACKET_RX_RING");
+        map_size = 0;
+        return -1;
+    }
+    map = static_cast<u_char*>(addr);
+
+    blocks.resize(block_num);
+    for (unsigned int i = 0; i < block_num; i++) {
+        blocks[i] = reinterpret_cast<struct tpacket_block_desc*>(map + static_cast<size_t>(i) * block_size);
+    }
+    current = 0;
+    taken = 0;
+
+    return 0;
+}
+
+/**
+ * @brief Unmap the ring
+ */
+void RxRing::Teardown() {
+    if (map != nullptr) {
+        munmap(map, map_size);
+        map = nullptr;
+        map_size = 0;
+    }
+    blocks.clear();
+    current = 0;
+    taken = 0;
+}
+
+/**
+ * @brief Take the next block if the kernel has retired it
+ * @return Pointer to block descriptor or nullptr if it is still owned by the kernel
+ */
+struct tpacket_block_desc* RxRing::NextBlock() {
+    if (blocks.empty() || taken == blocks.size()) {
+        return nullptr;
+    }
+
+    struct tpacket_block_desc* block = blocks[(current + taken) % blocks.size()];
+    if ((__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0) {
+        return nullptr;
+    }
+
+    taken++;
+    return block;
+}
+
+/**
+ * @brief Return all taken blocks to the kernel
+ */
+void RxRing::ReleaseBlocks() {
+    for (; taken > 0; taken--) {
+        __atomic_store_n(&blocks[current]->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+        current = (current + 1) % blocks.size();
+    }
+}
+
+/**
+ * @brief Get the first packet of a block
+ * @param block Block descriptor
+ * @return Pointer to packet header
+ */
+struct tpacket3_hdr* RxRing::FirstPacket(struct tpacket_block_desc* block) {
+    return reinterpret_cast<struct tpacket3_hdr*>(
+        reinterpret_cast<u_char*>(block) + block->hdr.bh1.offset_to_first_pkt);
+}
+
+/**
+ * @brief Get the packet following another one in the same block
+ * @param pkt Packet header
+ * @return Pointer to next packet header
+ */
+struct tpacket3_hdr* RxRing::NextPacket(struct tpacket3_hdr* pkt) {
+    return reinterpret_cast<struct tpacket3_hdr*>(reinterpret_cast<u_char*>(pkt) + pkt->tp_next_offset);
+}
+
+/**
+ * @brief Get the Ethernet frame of a packet
+ * @param pkt Packet header
+ * @return Pointer to the start of the frame
+ */
+u_char* RxRing::PacketData(struct tpacket3_hdr* pkt) {
+    return reinterpret_cast<u_char*>(pkt) + pkt->tp_mac;
+}
+
+/**
+ * @brief Check whether a packet was sent by this host
+ * @param pkt Packet header
+ * @return true if the packet is an outgoing copy
+ */
+bool RxRing::IsOutgoing(struct tpacket3_hdr* pkt) {
+    const struct sockaddr_ll* sll = reinterpret_cast<const struct sockaddr_ll*>(
+        reinterpret_cast<u_char*>(pkt) + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+    return sll->sll_pkttype == PACKET_OUTGOING;
+}
@@ -0,0 +1,113 @@
+/**
+ * @file rx_ring.hpp
+ * @brief Header file for the PACKET_MMAP (TPACKET_V3) receive ring
+ */
+
+#ifndef RX_RING_HPP
+#define RX_RING_HPP
+
+#include <linux/if_packet.h>
+#include <sys/types.h>
+#include <vector>
+
+/**
+ * @brief Memory mapped TPACKET_V3 receive ring attached to a packet socket
+ *
+ * The kernel fills whole blocks of frames and hands them over by setting
+ * TP_STATUS_USER in the block header. Frames are read in place from the
+ * mapping; a block is returned to the kernel with ReleaseBlock().
+ */
+class RxRing {
+public:
+    /**
+     * @brief Constructor
+     */
+    RxRing();
+
+    /**
+     * @brief Destructor
+     */
+    ~RxRing();
+
+    RxRing(const RxRing&) = delete;
+    RxRing& operator=(const RxRing&) = delete;
+
+    /**
+     * @brief Attach a ring to a packet socket and map it
+     * @param soc Packet socket descriptor
+     * @param block_size Size of one block in bytes (multiple of the page size)
+     * @param block_num Number of blocks
+     * @param frame_size Nominal frame size in bytes
+     * @return Success or failure code
+     */
+    int Setup(int soc, unsigned int block_size, unsigned int block_num, unsigned int frame_size);
+
+    /**
+     * @brief Unmap the ring
+     */
+    void Teardown();
+
+    /**
+     * @brief Take the next block if the kernel has retired it
+     * @return Pointer to block descriptor or nullptr if it is still owned by the kernel
+     *
+     * Taken blocks stay valid until ReleaseBlocks(), so frames read from
+     * them can be referenced by a pending transmission.
+     */
+    struct tpacket_block_desc* NextBlock();
+
+    /**
+     * @brief Return all taken blocks to the kernel
+     */
+    void ReleaseBlocks();
+
+    /**
+     * @brief Get the first packet of a block
+     * @param block Block descriptor
+     * @return Pointer to packet header
+     */
+    static struct tpacket3_hdr* FirstPacket(struct tpacket_block_desc* block);
+
+    /**
+     * @brief Get the packet following another one in the same block
+     * @param pkt Packet header
+     * @return Pointer to next packet header
+     */
+    static struct tpacket3_hdr* NextPacket(struct tpacket3_hdr* pkt);
+
+    /**
+     * @brief Get the Ethernet frame of a packet
+     * @param pkt Packet header
+     * @return Pointer to the start of the frame
+     */
+    static u_char* PacketData(struct tpacket3_hdr* pkt);
+
+    /**
+     * @brief Check whether a packet was sent by this host
+     * @param pkt Packet header
+     * @return true if the packet is an outgoing copy
+     */
+    static bool IsOutgoing(struct tpacket3_hdr* pkt);
+
+    /**
+     * @brief Check whether a packet did not fit in its ring frame
+     * @param pkt Packet header
+     * @return true if only part of the packet was captured
+     */
+    static bool IsTruncated(struct tpacket3_hdr* pkt) { return pkt->tp_snaplen < pkt->tp_len; }
+
+    /**
+     * @brief Check whether the ring is mapped
+     * @return true if Setup() succeeded
+     */
+    bool IsMapped() const { return map != nullptr; }
+
+private:
+    u_char* map;                                   // Mapped ring memory
+    size_t map_size;                               // Size of the mapping
+    std::vector<struct tpacket_block_desc*> blocks; // Block descriptors
+    unsigned int current;                          // Index of the oldest taken block
+    unsigned int taken;                            // Number of blocks taken and not released
+};
+
+#endif // RX_RING_HPP
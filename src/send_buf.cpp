@@ -5,12 +5,13 @@
 
 #include "send_buf.hpp"
 #include <cstring>
-#include <ctime>
 
 /**
  * @brief Constructor
+ * @param pool Pool queued packets are stored in
  */
-SendBuf::SendBuf() {
+SendBuf::SendBuf(PacketPool* pool)
+    : pool(pool), max_packets(SEND_DATA_QUEUE_SIZE), max_bytes(SEND_DATA_QUEUE_SIZE * PacketPool::BUF_SIZE) {
 }
 
 /**
@@ -26,42 +27,57 @@ SendBuf::~SendBuf() {
  * @param addr IP address
  * @param data Data to append
  * @param size Size of data
+ * @param evicted Number of queued packets dropped to make room (output), or nullptr
  * @return Success or failure code
  */
-int SendBuf::AppendSendData(IP2MAC* ip2mac, int deviceNo, in_addr_t addr, unsigned char* data, int size) {
-    if (ip2mac == nullptr) {
-        return -1;
+int SendBuf::AppendSendData(IP2MAC* ip2mac, int deviceNo, in_addr_t addr, unsigned char* data, int size,
+                            int* evicted) {
+    (void)deviceNo;  // Suppress unused parameter warning
+    (void)addr;      // Suppress unused parameter warning
+    if (evicted != nullptr) {
+        *evicted = 0;
     }
 
-    DataBuf* buf = new DataBuf();
-    if (buf == nullptr) {
+    if (ip2mac == nullptr || size > PacketPool::BUF_SIZE || static_cast<unsigned long>(size) > max_bytes) {
         return -1;
     }
 
-    buf->size = size;
-    buf->data = new unsigned char[size];
-    if (buf->data == nullptr) {
-        delete buf;
-        return -1;
+    SendData& send_data = ip2mac->send_data;
+    send_data.pool = pool;
+
+    // Make room by dropping the oldest packets; the last buffer dropped is
+    // reused, so a full queue still takes the new packet when the pool is empty
+    int index = -1;
+    int dropped = 0;
+    while (send_data.data_num > 0 &&
+           (send_data.data_num >= max_packets || send_data.in_bucket_size + size > max_bytes)) {
+        uint32_t oldest = send_data.slots[send_data.head];
+        send_data.in_bucket_size -= pool->Length(oldest);
+        if (index >= 0) {
+            pool->Free(index);
+        }
+        index = static_cast<int>(oldest);
+        send_data.head = (send_data.head + 1) % SEND_DATA_QUEUE_SIZE;
+        send_data.data_num--;
+        dropped++;
+    }
+    if (evicted != nullptr) {
+        *evicted = dropped;
     }
 
-    memcpy(buf->data, data, size);
-    buf->time = time(nullptr);
-
-    // Insert into linked list
-    buf->next = nullptr;
-    buf->before = ip2mac->send_data.bottom;
-
-    if (ip2mac->send_data.bottom == nullptr) {
-        ip2mac->send_data.top = buf;
-        ip2mac->send_data.bottom = buf;
-    } else {
-        ip2mac->send_data.bottom->next = buf;
-        ip2mac->send_data.bottom = buf;
+    if (index < 0) {
+        index = pool->Alloc();
+        if (index < 0) {
+            return -1;
+        }
     }
+    memcpy(pool->Data(index), data, size);
+    pool->SetLength(index, size);
+    LATENCY_ONLY(pool->SetStamp(index, Tsc::Now()));
 
-    ip2mac->send_data.data_num++;
-    ip2mac->send_data.in_bucket_size += size;
+    send_data.slots[(send_data.head + send_data.data_num) % SEND_DATA_QUEUE_SIZE] = index;
+    send_data.data_num++;
+    send_data.in_bucket_size += size;
 
     return 1;
 }
@@ -69,36 +85,23 @@ int SendBuf::AppendSendData(IP2MAC* ip2mac, int deviceNo, in_addr_t addr, unsign
 /**
  * @brief Get data from send buffer
  * @param ip2mac Pointer to IP2MAC entry
- * @param size Pointer to store data size
- * @param data Pointer to store data pointer
+ * @param index Pointer to store the pool buffer index; the caller frees it
  * @return Success or failure code
  */
-int SendBuf::GetSendData(IP2MAC* ip2mac, int* size, unsigned char** data) {
+int SendBuf::GetSendData(IP2MAC* ip2mac, int* index) {
     if (ip2mac == nullptr) {
         return -1;
     }
 
-    if (ip2mac->send_data.top == nullptr) {
+    SendData& send_data = ip2mac->send_data;
+    if (send_data.data_num == 0) {
         return -1;
     }
 
-    DataBuf* buf = ip2mac->send_data.top;
-    *size = buf->size;
-    *data = buf->data;
-
-    ip2mac->send_data.top = buf->next;
-    if (ip2mac->send_data.top != nullptr) {
-        ip2mac->send_data.top->before = nullptr;
-    } else {
-        ip2mac->send_data.bottom = nullptr;
-    }
-
-    ip2mac->send_data.data_num--;
-    ip2mac->send_data.in_bucket_size -= buf->size;
-
-    // Transfer ownership of data to caller, prevent destruction in buf destructor
-    buf->data = nullptr;
-    delete buf;
+    *index = send_data.slots[send_data.head];
+    send_data.head = (send_data.head + 1) % SEND_DATA_QUEUE_SIZE;
+    send_data.data_num--;
+    send_data.in_bucket_size -= pool->Length(*index);
 
     return 1;
 }
@@ -113,27 +116,22 @@ int SendBuf::FreeSendData(IP2MAC* ip2mac) {
         return -1;
     }
 
-    DataBuf* ptr = ip2mac->send_data.top;
-    while (ptr != nullptr) {
-        DataBuf* next = ptr->next;
-        delete ptr;
-        ptr = next;
-    }
-
-    ip2mac->send_data.top = nullptr;
-    ip2mac->send_data.bottom = nullptr;
-    ip2mac->send_data.data_num = 0;
-    ip2mac->send_data.in_bucket_size = 0;
+    ip2mac->send_data.Clear();
 
     return 1;
 }
 
 /**
- * @brief Send buffered data
- * @return Success or failure code
+ * @brief Set the per-neighbor queue limits
+ * @param maxPackets Maximum number of queued packets (at most SEND_DATA_QUEUE_SIZE)
+ * @param maxBytes Maximum total size of queued packets
  */
-int SendBuf::BufferSend() {
-    // Implementation depends on IP2MAC table management
-    // Will be implemented when IP2MAC class is fully defined
-    return 1;
-}
\ No newline at end of file
+void SendBuf::SetLimits(unsigned long maxPackets, unsigned long maxBytes) {
+    max_packets = maxPackets;
+    if (max_packets < 1) {
+        max_packets = 1;
+    } else if (max_packets > SEND_DATA_QUEUE_SIZE) {
+        max_packets = SEND_DATA_QUEUE_SIZE;
+    }
+    max_bytes = maxBytes;
+}
@@ -11,13 +11,18 @@
 
 /**
  * @brief Class for managing send buffer data
+ *
+ * Packets waiting for ARP resolution are copied into PacketPool buffers and
+ * queued on their neighbor's bounded SendData ring, so queuing never
+ * touches the heap.
  */
 class SendBuf {
 public:
     /**
      * @brief Constructor
+     * @param pool Pool queued packets are stored in
      */
-    SendBuf();
+    SendBuf(PacketPool* pool);
 
     /**
      * @brief Destructor
@@ -31,18 +36,22 @@ public:
      * @param addr IP address
      * @param data Data to append
      * @param size Size of data
+     * @param evicted Number of queued packets dropped to make room (output), or nullptr
      * @return Success or failure code
+     *
+     * The neighbor's oldest packets are dropped until the new one fits
+     * within the queue limits.
      */
-    int AppendSendData(IP2MAC* ip2mac, int deviceNo, in_addr_t addr, unsigned char* data, int size);
+    int AppendSendData(IP2MAC* ip2mac, int deviceNo, in_addr_t addr, unsigned char* data, int size,
+                       int* evicted = nullptr);
 
     /**
      * @brief Get data from send buffer
      * @param ip2mac Pointer to IP2MAC entry
-     * @param size Pointer to store data size
-     * @param data Pointer to store data pointer
+     * @param index Pointer to store the pool buffer index; the caller frees it
      * @return Success or failure code
      */
-    int GetSendData(IP2MAC* ip2mac, int* size, unsigned char** data);
+    int GetSendData(IP2MAC* ip2mac, int* index);
 
     /**
      * @brief Free send data
@@ -52,10 +61,22 @@ public:
     int FreeSendData(IP2MAC* ip2mac);
 
     /**
-     * @brief Send buffered data
-     * @return Success or failure code
+     * @brief Set the per-neighbor queue limits
+     * @param maxPackets Maximum number of queued packets (at most SEND_DATA_QUEUE_SIZE)
+     * @param maxBytes Maximum total size of queued packets
      */
-    int BufferSend();
+    void SetLimits(unsigned long maxPackets, unsigned long maxBytes);
+
+    /**
+     * @brief Get the pool queued packets are stored in
+     * @return Packet pool
+     */
+    PacketPool* Pool() { return pool; }
+
+private:
+    PacketPool* pool;            // Pool queued packets are stored in
+    unsigned long max_packets;   // Queued packets per neighbor
+    unsigned long max_bytes;     // Queued bytes per neighbor
 };
 
 #endif // SEND_BUF_HPP
\ No newline at end of file
@@ -0,0 +1,115 @@
+/**
+ * @file spsc_ring.hpp
+ * @brief Lock-free single-producer single-consumer ring
+ */
+
+#ifndef SPSC_RING_HPP
+#define SPSC_RING_HPP
+
+#include <atomic>
+#include <cstddef>
+#include "memory_arena.hpp"
+
+/**
+ * @brief Bounded lock-free ring between exactly one producer and one consumer thread
+ *
+ * Elements are filled and consumed in place: the producer writes into
+ * ProducerSlot() and publishes it with ProducerCommit(); the consumer reads
+ * up to Available() elements with ConsumerSlot() and frees them with
+ * ConsumerRelease() once it no longer references them.
+ *
+ * @tparam T Element type
+ */
+template <typename T>
+class SpscRing {
+public:
+    /**
+     * @brief Constructor
+     * @param capacity Number of elements, rounded up to a power of two
+     * @param name Name the elements are reported under by MemoryArena (a string literal)
+     * @param node Preferred NUMA node of the elements, -1 for the default policy
+     */
+    explicit SpscRing(size_t capacity, const char* name = "spsc ring", int node = -1)
+        : head(0), cached_tail(0), tail(0), cached_head(0) {
+        size_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        slots.Allocate(size, name, node);
+        mask = size - 1;
+    }
+
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    /**
+     * @brief Get the next free element (producer only)
+     * @return Pointer to element or nullptr if the ring is full
+     */
+    T* ProducerSlot() {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h - cached_tail > mask) {
+            cached_tail = tail.load(std::memory_order_acquire);
+            if (h - cached_tail > mask) {
+                return nullptr;
+            }
+        }
+        return &slots[h & mask];
+    }
+
+    /**
+     * @brief Publish the element returned by ProducerSlot() (producer only)
+     */
+    void ProducerCommit() {
+        head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    /**
+     * @brief Get the number of elements ready to be consumed (consumer only)
+     * @return Number of elements
+     */
+    size_t Available() {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (cached_head == t) {
+            cached_head = head.load(std::memory_order_acquire);
+        }
+        return cached_head - t;
+    }
+
+    /**
+     * @brief Get a ready element (consumer only)
+     * @param i Offset from the oldest element, less than Available()
+     * @return Pointer to element
+     */
+    T* ConsumerSlot(size_t i) {
+        return &slots[(tail.load(std::memory_order_relaxed) + i) & mask];
+    }
+
+    /**
+     * @brief Free the oldest elements (consumer only)
+     * @param n Number of elements
+     */
+    void ConsumerRelease(size_t n) {
+        tail.store(tail.load(std::memory_order_relaxed) + n, std::memory_order_release);
+    }
+
+    /**
+     * @brief Check whether the ring looks empty (any thread)
+     * @return true if there is nothing to consume
+     */
+    bool Empty() const {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+
+private:
+    ArenaArray<T> slots;                            // Elements
+    size_t mask;                                    // Capacity - 1
+
+    // Producer and consumer indexes live on separate cache lines
+    alignas(64) std::atomic<size_t> head;           // Next element to produce
+    size_t cached_tail;                             // Producer's copy of tail
+    alignas(64) std::atomic<size_t> tail;           // Next element to consume
+    size_t cached_head;                             // Consumer's copy of head
+};
+
+#endif // SPSC_RING_HPP
@@ -0,0 +1,171 @@
+/**
+ * @file stats.cpp
+ * @brief Implementation of packet counters and their Unix socket export
+ */
+
+#include "stats.hpp"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Names of the drop reasons, by DropReason
+static const char* const DROP_REASON_NAMES[DROP_REASON_NUM] = {
+    "short_frame",
+    "truncated",
+    "dhost_mismatch",
+    "ethertype",
+    "bad_header",
+    "bad_checksum",
+    "ttl_expired",
+    "local",
+    "no_route",
+    "neighbor",
+    "pending_full",
+    "tx",
+};
+
+/**
+ * @brief Constructor
+ */
+WorkerStats::WorkerStats()
+    : rx_packets(0), rx_bytes(0), tx_packets(0), tx_bytes(0), icmp_sent(0), icmp_ratelimited(0) {
+    for (int i = 0; i < DROP_REASON_NUM; i++) {
+        drops[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief Add another worker's counters to this one
+ * @param other Counters to add
+ */
+void WorkerStats::Accumulate(const WorkerStats& other) {
+    Add(rx_packets, other.rx_packets.load(std::memory_order_relaxed));
+    Add(rx_bytes, other.rx_bytes.load(std::memory_order_relaxed));
+    Add(tx_packets, other.tx_packets.load(std::memory_order_relaxed));
+    Add(tx_bytes, other.tx_bytes.load(std::memory_order_relaxed));
+    for (int i = 0; i < DROP_REASON_NUM; i++) {
+        Add(drops[i], other.drops[i].load(std::memory_order_relaxed));
+    }
+    Add(icmp_sent, other.icmp_sent.load(std::memory_order_relaxed));
+    Add(icmp_ratelimited, other.icmp_ratelimited.load(std::memory_order_relaxed));
+}
+
+/**
+ * @brief Get the name of a drop reason
+ * @param reason Drop reason
+ * @return Name used in the export
+ */
+const char* WorkerStats::DropReasonName(int reason) {
+    return (reason >= 0 && reason < DROP_REASON_NUM) ? DROP_REASON_NAMES[reason] : "unknown";
+}
+
+/**
+ * @brief Constructor
+ */
+StatsServer::StatsServer() : listen_fd(-1) {
+}
+
+/**
+ * @brief Destructor
+ */
+StatsServer::~StatsServer() {
+    Close();
+}
+
+/**
+ * @brief Listen on a socket path, replacing a stale socket file
+ * @param path Socket path
+ * @return Success or failure code
+ */
+int StatsServer::Open(const std::string& path) {
+    struct sockaddr_un addr;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "stats socket path too long: %s\n", path.c_str());
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket:stats");
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.c_str(), path.size());
+    unlink(path.c_str());
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("bind:stats");
+        close(fd);
+        return -1;
+    }
+    if (listen(fd, 8) < 0) {
+        perror("listen:stats");
+        close(fd);
+        unlink(path.c_str());
+        return -1;
+    }
+
+    listen_fd = fd;
+    this->path = path;
+    return 0;
+}
+
+/**
+ * @brief Stop listening and remove the socket file
+ */
+void StatsServer::Close() {
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        unlink(path.c_str());
+        listen_fd = -1;
+    }
+}
+
+/**
+ * @brief Wait for a connection and answer it
+ * @param timeout_ms Time to wait
+ * @param render Renders the snapshot once a client has connected
+ * @param stop_fd Descriptor that ends the wait early once readable, -1 for none
+ * @return 1 if a client was answered, 0 on timeout or stop, -1 on error
+ */
+int StatsServer::ServeOne(int timeout_ms, const std::function<std::string()>& render, int stop_fd) {
+    struct pollfd targets[2] = {};
+    targets[0].fd = listen_fd;
+    targets[0].events = POLLIN;
+    // poll() skips a negative descriptor
+    targets[1].fd = stop_fd;
+    targets[1].events = POLLIN;
+
+    int ready = poll(targets, 2, timeout_ms);
+    if (ready <= 0) {
+        return (ready < 0 && errno != EINTR) ? -1 : 0;
+    }
+    if (!(targets[0].revents & POLLIN)) {
+        return 0;
+    }
+
+    int client = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (client < 0) {
+        return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+    }
+
+    // A client that stops reading only delays the next snapshot
+    struct timeval tv = {1, 0};
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    std::string text = render();
+    size_t off = 0;
+    while (off < text.size()) {
+        ssize_t n = send(client, text.data() + off, text.size() - off, MSG_NOSIGNAL);
+        if (n <= 0) {
+            break;
+        }
+        off += n;
+    }
+    close(client);
+    return 1;
+}
@@ -0,0 +1,141 @@
+/**
+ * @file stats.hpp
+ * @brief Header file for packet counters and their Unix socket export
+ */
+
+#ifndef STATS_HPP
+#define STATS_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+/**
+ * @brief Why a frame was dropped
+ */
+enum DropReason {
+    DROP_SHORT_FRAME,       // Shorter than the headers it claims to carry
+    DROP_TRUNCATED,         // Larger than the receive buffer
+    DROP_DHOST_MISMATCH,    // Not addressed to the port's MAC address
+    DROP_ETHERTYPE,         // Neither IPv4 nor ARP
+    DROP_BAD_HEADER,        // Bad IP header or total length
+    DROP_BAD_CHECKSUM,      // Bad IP header checksum
+    DROP_TTL_EXPIRED,       // TTL exhausted (Time Exceeded sent)
+    DROP_LOCAL,             // Addressed to the router itself
+    DROP_NO_ROUTE,          // No matching route (Destination Unreachable sent)
+    DROP_NEIGHBOR,          // Neighbor table error
+    DROP_PENDING_FULL,      // No room to queue the packet for ARP, or pushed out of a queue or table
+    DROP_TX,                // Could not be staged, handed to another port or sent
+    DROP_REASON_NUM
+};
+
+/**
+ * @brief Counters of one worker, written by that worker only
+ *
+ * Every counter has a single writer, so an increment is a relaxed load and
+ * store rather than a locked read-modify-write; other threads may read the
+ * counters at any time. The class is cache-line aligned so that two
+ * workers' counters never share a line.
+ */
+class alignas(64) WorkerStats {
+public:
+    std::atomic<uint64_t> rx_packets;                 // Frames received
+    std::atomic<uint64_t> rx_bytes;                   // Bytes received
+    std::atomic<uint64_t> tx_packets;                 // Frames sent
+    std::atomic<uint64_t> tx_bytes;                   // Bytes sent
+    std::atomic<uint64_t> drops[DROP_REASON_NUM];     // Frames dropped, by reason
+    std::atomic<uint64_t> icmp_sent;                  // ICMP errors generated
+    std::atomic<uint64_t> icmp_ratelimited;           // ICMP errors suppressed by the rate limit
+
+    /**
+     * @brief Constructor
+     */
+    WorkerStats();
+
+    /**
+     * @brief Add to a counter owned by the calling thread
+     * @param counter Counter
+     * @param n Amount
+     */
+    static void Add(std::atomic<uint64_t>& counter, uint64_t n) {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Count dropped frames
+     * @param reason Drop reason
+     * @param n Number of frames
+     */
+    void Drop(DropReason reason, uint64_t n = 1) { Add(drops[reason], n); }
+
+    /**
+     * @brief Add another worker's counters to this one
+     * @param other Counters to add
+     */
+    void Accumulate(const WorkerStats& other);
+
+    /**
+     * @brief Get the name of a drop reason
+     * @param reason Drop reason
+     * @return Name used in the export
+     */
+    static const char* DropReasonName(int reason);
+};
+
+/**
+ * @brief Unix stream socket that answers every connection with a snapshot
+ *
+ * A scraper connects (e.g. socat - UNIX-CONNECT:path), reads the text
+ * until EOF and is disconnected. The caller renders the snapshot, so the
+ * forwarding threads are never stopped.
+ */
+class StatsServer {
+public:
+    /**
+     * @brief Constructor
+     */
+    StatsServer();
+
+    /**
+     * @brief Destructor
+     */
+    ~StatsServer();
+
+    StatsServer(const StatsServer&) = delete;
+    StatsServer& operator=(const StatsServer&) = delete;
+
+    /**
+     * @brief Listen on a socket path, replacing a stale socket file
+     * @param path Socket path
+     * @return Success or failure code
+     */
+    int Open(const std::string& path);
+
+    /**
+     * @brief Stop listening and remove the socket file
+     */
+    void Close();
+
+    /**
+     * @brief Wait for a connection and answer it
+     * @param timeout_ms Time to wait
+     * @param render Renders the snapshot once a client has connected
+     * @param stop_fd Descriptor that ends the wait early once readable, -1 for none
+     * @return 1 if a client was answered, 0 on timeout or stop, -1 on error
+     */
+    int ServeOne(int timeout_ms, const std::function<std::string()>& render, int stop_fd = -1);
+
+    /**
+     * @brief Check whether the server is listening
+     * @return true if listening
+     */
+    bool IsOpen() const { return listen_fd >= 0; }
+
+private:
+    int listen_fd;       // Listening socket, -1 if closed
+    std::string path;    // Socket path
+};
+
+#endif // STATS_HPP
@@ -0,0 +1,125 @@
+/**
+ * @file timer_wheel.cpp
+ * @brief Implementation of the hashed timer wheel
+ */
+
+#include "timer_wheel.hpp"
+#include <ctime>
+
+/**
+ * @brief Constructor
+ * @param capacity Number of timer ids
+ * @param slot_num Number of slots, rounded up to a power of two
+ * @param tick_ms Time covered by one slot in milliseconds
+ */
+TimerWheel::TimerWheel(size_t capacity, size_t slot_num, uint64_t tick_ms)
+    : prev(capacity, -1), next(capacity, -1), slot_of(capacity, -1), expires(capacity, 0),
+      tick_ms(tick_ms > 0 ? tick_ms : 1) {
+    size_t size = 1;
+    while (size < slot_num) {
+        size <<= 1;
+    }
+    slot_head.assign(size, -1);
+    slot_mask = size - 1;
+    current_tick = NowMs() / this->tick_ms;
+}
+
+/**
+ * @brief Destructor
+ */
+TimerWheel::~TimerWheel() {
+}
+
+/**
+ * @brief Arm a timer, replacing any pending one for the id
+ * @param id Timer id
+ * @param expires_ms Expiry in NowMs() time
+ */
+void TimerWheel::Schedule(int id, uint64_t expires_ms) {
+    Cancel(id);
+
+    // Round up so that a timer never fires early, and never file it in a
+    // slot that Advance() has already passed
+    uint64_t tick = (expires_ms + tick_ms - 1) / tick_ms;
+    if (tick <= current_tick) {
+        tick = current_tick + 1;
+    }
+
+    int slot = static_cast<int>(tick & slot_mask);
+    expires[id] = tick;
+    slot_of[id] = slot;
+    prev[id] = -1;
+    next[id] = slot_head[slot];
+    if (slot_head[slot] >= 0) {
+        prev[slot_head[slot]] = id;
+    }
+    slot_head[slot] = id;
+}
+
+/**
+ * @brief Cancel a timer
+ * @param id Timer id (ignored if not pending)
+ */
+void TimerWheel::Cancel(int id) {
+    int slot = slot_of[id];
+    if (slot < 0) {
+        return;
+    }
+
+    if (prev[id] >= 0) {
+        next[prev[id]] = next[id];
+    } else {
+        slot_head[slot] = next[id];
+    }
+    if (next[id] >= 0) {
+        prev[next[id]] = prev[id];
+    }
+    prev[id] = -1;
+    next[id] = -1;
+    slot_of[id] = -1;
+}
+
+/**
+ * @brief Collect the timers that expired up to a point in time
+ * @param now_ms Current NowMs() time
+ * @param expired Expired ids (appended; they are no longer pending)
+ * @return Number of expired timers
+ */
+int TimerWheel::Advance(uint64_t now_ms, std::vector<int>* expired) {
+    uint64_t now_tick = now_ms / tick_ms;
+    int count = 0;
+
+    // One revolution visits every slot, however long we were away
+    uint64_t first = current_tick + 1;
+    if (now_tick > current_tick + slot_mask + 1) {
+        first = now_tick - slot_mask;
+    }
+
+    for (uint64_t tick = first; tick <= now_tick; tick++) {
+        int id = slot_head[tick & slot_mask];
+        while (id >= 0) {
+            int following = next[id];
+            if (expires[id] <= now_tick) {
+                Cancel(id);
+                expired->push_back(id);
+                count++;
+            }
+            id = following;
+        }
+    }
+
+    if (now_tick > current_tick) {
+        current_tick = now_tick;
+    }
+    return count;
+}
+
+/**
+ * @brief Get the monotonic time in milliseconds
+ * @return Milliseconds since an arbitrary point
+ */
+uint64_t TimerWheel::NowMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
@@ -0,0 +1,81 @@
+/**
+ * @file timer_wheel.hpp
+ * @brief Header file for the hashed timer wheel
+ */
+
+#ifndef TIMER_WHEEL_HPP
+#define TIMER_WHEEL_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief Hashed timer wheel over a fixed set of timer ids
+ *
+ * Every id in [0, capacity) owns at most one pending timer. Timers are kept
+ * on intrusive per-slot lists, so scheduling and cancelling are O(1) and
+ * Advance() only visits the slots that elapsed. Timers further out than one
+ * revolution stay in their slot until a later revolution reaches them.
+ */
+class TimerWheel {
+public:
+    /**
+     * @brief Constructor
+     * @param capacity Number of timer ids
+     * @param slot_num Number of slots, rounded up to a power of two
+     * @param tick_ms Time covered by one slot in milliseconds
+     */
+    TimerWheel(size_t capacity, size_t slot_num = 256, uint64_t tick_ms = 100);
+
+    /**
+     * @brief Destructor
+     */
+    ~TimerWheel();
+
+    /**
+     * @brief Arm a timer, replacing any pending one for the id
+     * @param id Timer id
+     * @param expires_ms Expiry in NowMs() time
+     */
+    void Schedule(int id, uint64_t expires_ms);
+
+    /**
+     * @brief Cancel a timer
+     * @param id Timer id (ignored if not pending)
+     */
+    void Cancel(int id);
+
+    /**
+     * @brief Check whether a timer is pending
+     * @param id Timer id
+     * @return true if pending
+     */
+    bool IsScheduled(int id) const { return slot_of[id] >= 0; }
+
+    /**
+     * @brief Collect the timers that expired up to a point in time
+     * @param now_ms Current NowMs() time
+     * @param expired Expired ids (appended; they are no longer pending)
+     * @return Number of expired timers
+     */
+    int Advance(uint64_t now_ms, std::vector<int>* expired);
+
+    /**
+     * @brief Get the monotonic time in milliseconds
+     * @return Milliseconds since an arbitrary point
+     */
+    static uint64_t NowMs();
+
+private:
+    std::vector<int> slot_head;       // First timer of each slot, -1 if empty
+    std::vector<int> prev;            // Previous timer in the same slot, -1 if first
+    std::vector<int> next;            // Next timer in the same slot, -1 if last
+    std::vector<int> slot_of;         // Slot of each pending timer, -1 if not pending
+    std::vector<uint64_t> expires;    // Expiry tick of each pending timer
+    size_t slot_mask;                 // Number of slots - 1
+    uint64_t tick_ms;                 // Milliseconds per tick
+    uint64_t current_tick;            // Last tick processed by Advance()
+};
+
+#endif // TIMER_WHEEL_HPP
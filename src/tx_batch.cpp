@@ -0,0 +1,145 @@
+/**
+ * @file tx_batch.cpp
+ * @brief Implementation of batched packet transmission
+ */
+
+#include "tx_batch.hpp"
+#include "async_log.hpp"
+#include <cerrno>
+#include <cstring>
+
+/**
+ * @brief Constructor
+ * @param capacity Number of TX slots
+ */
+TxBatch::TxBatch(size_t capacity)
+    : soc(-1), count(0), unreported_frames(0), unreported_bytes(0), unreported_rejected(0),
+      msgs(capacity), iovs(capacity),
+      slot_buf(capacity * TX_SLOT_SIZE) {
+    memset(msgs.data(), 0, msgs.size() * sizeof(struct mmsghdr));
+    for (size_t i = 0; i < capacity; i++) {
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+}
+
+/**
+ * @brief Destructor
+ */
+TxBatch::~TxBatch() {
+}
+
+/**
+ * @brief Set the socket frames are sent on
+ * @param soc Socket descriptor
+ */
+void TxBatch::Attach(int soc) {
+    this->soc = soc;
+    count = 0;
+}
+
+/**
+ * @brief Stage a frame held in a caller buffer
+ * @param data Frame data (must stay valid until the next Flush())
+ * @param len Frame length
+ * @return Success or failure code
+ */
+int TxBatch::Stage(u_char* data, int len) {
+    if (count == msgs.size() && Flush() < 0) {
+        return -1;
+    }
+
+    iovs[count].iov_base = data;
+    iovs[count].iov_len = len;
+    count++;
+
+    return 1;
+}
+
+/**
+ * @brief Reserve slot-owned storage for a frame built in place
+ * @return Pointer to TX_SLOT_SIZE bytes of storage
+ */
+u_char* TxBatch::Reserve() {
+    if (count == msgs.size()) {
+        Flush();
+    }
+
+    return slot_buf.data() + count * TX_SLOT_SIZE;
+}
+
+/**
+ * @brief Stage the frame previously written into Reserve() storage
+ * @param len Frame length
+ * @return Success or failure code
+ */
+int TxBatch::Commit(int len) {
+    if (count == msgs.size() || len > TX_SLOT_SIZE) {
+        return -1;
+    }
+
+    iovs[count].iov_base = slot_buf.data() + count * TX_SLOT_SIZE;
+    iovs[count].iov_len = len;
+    count++;
+
+    return 1;
+}
+
+/**
+ * @brief Send all staged frames
+ * @param frames Number of frames the kernel accepted (output, optional)
+ * @param bytes Bytes of the frames the kernel accepted (output, optional)
+ * @param rejected Number of frames the kernel rejected (output, optional)
+ * @return Number of frames sent or -1 on error
+ *
+ * The counts include the frames sent by Stage() and Reserve() when the
+ * batch was full, since the last call that asked for them.
+ */
+int TxBatch::Flush(size_t* frames, size_t* bytes, size_t* rejected) {
+    size_t sent = 0;
+    size_t accepted = 0;
+    size_t dropped = 0;
+    size_t sent_bytes = 0;
+    int result = 0;
+
+    while (sent < count) {
+        int ret = sendmmsg(soc, &msgs[sent], count - sent, 0);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // Drop the frame the kernel rejected and carry on with the rest
+            LOG_ERROR_LIMITED("sendmmsg: %s\n", strerror(errno));
+            result = -1;
+            sent++;
+            dropped++;
+            continue;
+        }
+        for (int i = 0; i < ret; i++) {
+            sent_bytes += iovs[sent + i].iov_len;
+        }
+        sent += ret;
+        accepted += ret;
+        if (result >= 0) {
+            result += ret;
+        }
+    }
+
+    count = 0;
+    unreported_frames += accepted;
+    unreported_bytes += sent_bytes;
+    unreported_rejected += dropped;
+    if (frames != nullptr) {
+        *frames = unreported_frames;
+        unreported_frames = 0;
+    }
+    if (bytes != nullptr) {
+        *bytes = unreported_bytes;
+        unreported_bytes = 0;
+    }
+    if (rejected != nullptr) {
+        *rejected = unreported_rejected;
+        unreported_rejected = 0;
+    }
+    return result;
+}
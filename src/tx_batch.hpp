@@ -0,0 +1,95 @@
+/**
+ * @file tx_batch.hpp
+ * @brief Header file for batched packet transmission
+ */
+
+#ifndef TX_BATCH_HPP
+#define TX_BATCH_HPP
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <vector>
+
+/**
+ * @brief Batch of frames transmitted with a single sendmmsg() call
+ *
+ * Frames are staged into TX slots and sent together by Flush(). A staged
+ * frame is referenced, not copied, so its buffer must stay valid until the
+ * next Flush(). Frames built by the router itself (ICMP errors) are written
+ * into slot-owned storage obtained with Reserve().
+ */
+class TxBatch {
+public:
+    /**
+     * @brief Constructor
+     * @param capacity Number of TX slots
+     */
+    TxBatch(size_t capacity = 64);
+
+    /**
+     * @brief Destructor
+     */
+    ~TxBatch();
+
+    TxBatch(const TxBatch&) = delete;
+    TxBatch& operator=(const TxBatch&) = delete;
+
+    /**
+     * @brief Set the socket frames are sent on
+     * @param soc Socket descriptor
+     */
+    void Attach(int soc);
+
+    /**
+     * @brief Stage a frame held in a caller buffer
+     * @param data Frame data (must stay valid until the next Flush())
+     * @param len Frame length
+     * @return Success or failure code
+     */
+    int Stage(u_char* data, int len);
+
+    /**
+     * @brief Reserve slot-owned storage for a frame built in place
+     * @return Pointer to TX_SLOT_SIZE bytes of storage
+     */
+    u_char* Reserve();
+
+    /**
+     * @brief Stage the frame previously written into Reserve() storage
+     * @param len Frame length
+     * @return Success or failure code
+     */
+    int Commit(int len);
+
+    /**
+     * @brief Send all staged frames
+     * @param frames Frames the kernel accepted, including those of implicit
+     *               flushes since the last report (output, optional)
+     * @param bytes Bytes of those frames (output, optional)
+     * @param rejected Frames the kernel rejected, including those of implicit
+     *                 flushes since the last report (output, optional)
+     * @return Number of frames sent or -1 on error
+     */
+    int Flush(size_t* frames = nullptr, size_t* bytes = nullptr, size_t* rejected = nullptr);
+
+    /**
+     * @brief Get the number of staged frames
+     * @return Number of staged frames
+     */
+    size_t Pending() const { return count; }
+
+    static const int TX_SLOT_SIZE = 2048;   // Size of slot-owned storage
+
+private:
+    int soc;                             // Socket descriptor
+    size_t count;                        // Number of staged frames
+    size_t unreported_frames;            // Frames sent but not yet reported by Flush()
+    size_t unreported_bytes;             // Bytes of unreported_frames
+    size_t unreported_rejected;          // Frames rejected but not yet reported by Flush()
+    std::vector<struct mmsghdr> msgs;    // Message headers
+    std::vector<struct iovec> iovs;      // One iovec per slot
+    std::vector<u_char> slot_buf;        // Slot-owned storage
+};
+
+#endif // TX_BATCH_HPP
@@ -0,0 +1,731 @@
+/**
+ * @file xdp_io.cpp
+ * @brief Implementation of the AF_XDP packet I/O engine
+ */
+
+#include "xdp_io.hpp"
+#include "async_log.hpp"
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <linux/if_link.h>
+#include <linux/if_packet.h>
+#include <net/ethernet.h>
+#include <net/if.h>
+#include <netinet/ip.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+// Frames handed out by RxBurst() per loop iteration
+static const int XDP_RX_PER_POLL = 64;
+
+// Frames read from the ARP socket per loop iteration
+static const int XDP_CONTROL_BURST = 8;
+
+// sendto() calls per TxBurst() when the kernel transmits in small batches
+static const int XDP_KICK_MAX = 64;
+
+/**
+ * @brief Call bpf(2)
+ * @param cmd Command
+ * @param attr Attributes
+ * @return Result of the command
+ */
+static int Bpf(int cmd, union bpf_attr* attr) {
+    return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+/**
+ * @brief Read a ring index written by the other side
+ * @param index Index in the mapping
+ * @return Index value
+ */
+static inline uint32_t LoadIndex(const uint32_t* index) {
+    return __atomic_load_n(index, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief Publish a ring index to the other side
+ * @param index Index in the mapping
+ * @param value Index value
+ */
+static inline void StoreIndex(uint32_t* index, uint32_t value) {
+    __atomic_store_n(index, value, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief XdpProgram constructor
+ */
+XdpProgram::XdpProgram() : map_fd(-1), prog_fd(-1), link_fd(-1), driver_mode(false) {
+}
+
+/**
+ * @brief XdpProgram destructor
+ */
+XdpProgram::~XdpProgram() {
+    Detach();
+}
+
+/**
+ * @brief Load the program
+ * @param local_addrs Addresses whose frames go to the kernel
+ * @return Program file descriptor or -1 on error
+ */
+int XdpProgram::Load(const std::vector<in_addr_t>& local_addrs) {
+    static const int16_t IP_DADDR = sizeof(struct ether_header) + offsetof(struct iphdr, daddr);
+
+    // IPv4 frames not addressed to us: bpf_redirect_map(map, rx_queue_index, XDP_PASS)
+    std::vector<struct bpf_insn> insns = {
+        {BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_1, offsetof(struct xdp_md, data), 0},
+        {BPF_LDX | BPF_MEM | BPF_W, BPF_REG_3, BPF_REG_1, offsetof(struct xdp_md, data_end), 0},
+        {BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_4, BPF_REG_2, 0, 0},
+        {BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_4, 0, 0, IP_DADDR + 4},
+        {BPF_JMP | BPF_JGT | BPF_X, BPF_REG_4, BPF_REG_3, 0, 0},          // -> pass
+        {BPF_LDX | BPF_MEM | BPF_H, BPF_REG_4, BPF_REG_2, offsetof(struct ether_header, ether_type), 0},
+        {BPF_JMP | BPF_JNE | BPF_K, BPF_REG_4, 0, 0, htons(ETHERTYPE_IP)}, // -> pass
+        {BPF_LDX | BPF_MEM | BPF_W, BPF_REG_4, BPF_REG_2, IP_DADDR, 0},
+    };
+    for (in_addr_t addr : local_addrs) {
+        // 32-bit compare: the immediate would be sign extended otherwise
+        insns.push_back({BPF_JMP32 | BPF_JEQ | BPF_K, BPF_REG_4, 0, 0, static_cast<int32_t>(addr)});  // -> pass
+    }
+    insns.push_back({BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_1, offsetof(struct xdp_md, rx_queue_index), 0});
+    insns.push_back({BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, map_fd});
+    insns.push_back({0, 0, 0, 0, 0});
+    insns.push_back({BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_3, 0, 0, XDP_PASS});
+    insns.push_back({BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map});
+    insns.push_back({BPF_JMP | BPF_EXIT, 0, 0, 0, 0});
+    int pass = static_cast<int>(insns.size());
+    insns.push_back({BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, XDP_PASS});
+    insns.push_back({BPF_JMP | BPF_EXIT, 0, 0, 0, 0});
+
+    // Point every conditional jump at the pass label
+    for (int i = 0; i < pass; i++) {
+        uint8_t op = BPF_OP(insns[i].code);
+        uint8_t cls = BPF_CLASS(insns[i].code);
+        if ((cls == BPF_JMP || cls == BPF_JMP32) && op != BPF_CALL && op != BPF_EXIT) {
+            insns[i].off = static_cast<int16_t>(pass - i - 1);
+        }
+    }
+
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.expected_attach_type = BPF_XDP;
+    attr.insns = reinterpret_cast<uint64_t>(insns.data());
+    attr.insn_cnt = insns.size();
+    attr.license = reinterpret_cast<uint64_t>("GPL");
+
+    int prog = Bpf(BPF_PROG_LOAD, &attr);
+    if (prog < 0) {
+        perror("bpf:BPF_PROG_LOAD");
+        return -1;
+    }
+    return prog;
+}
+
+/**
+ * @brief Load the program and attach it to a device
+ * @param device Device name
+ * @param queues Number of receive queues with a socket
+ * @param local_addrs Addresses whose frames go to the kernel
+ * @return Success or failure code
+ */
+int XdpProgram::Attach(const std::string& device, int queues, const std::vector<in_addr_t>& local_addrs) {
+    unsigned int ifindex = if_nametoindex(device.c_str());
+    if (ifindex == 0) {
+        perror("if_nametoindex");
+        return -1;
+    }
+
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type = BPF_MAP_TYPE_XSKMAP;
+    attr.key_size = sizeof(uint32_t);
+    attr.value_size = sizeof(uint32_t);
+    attr.max_entries = queues;
+    map_fd = Bpf(BPF_MAP_CREATE, &attr);
+    if (map_fd < 0) {
+        perror("bpf:BPF_MAP_CREATE");
+        return -1;
+    }
+
+    prog_fd = Load(local_addrs);
+    if (prog_fd < 0) {
+        Detach();
+        return -1;
+    }
+
+    // A link detaches the program when the router exits, however it exits
+    static const uint32_t modes[] = {XDP_FLAGS_DRV_MODE, XDP_FLAGS_SKB_MODE};
+    for (uint32_t mode : modes) {
+        memset(&attr, 0, sizeof(attr));
+        attr.link_create.prog_fd = prog_fd;
+        attr.link_create.target_ifindex = ifindex;
+        attr.link_create.attach_type = BPF_XDP;
+        attr.link_create.flags = mode;
+        link_fd = Bpf(BPF_LINK_CREATE, &attr);
+        if (link_fd >= 0) {
+            driver_mode = (mode == XDP_FLAGS_DRV_MODE);
+            return 0;
+        }
+    }
+
+    perror("bpf:BPF_LINK_CREATE");
+    Detach();
+    return -1;
+}
+
+/**
+ * @brief Steer a receive queue to a socket
+ * @param queue Receive queue
+ * @param xsk AF_XDP socket bound to the queue
+ * @return Success or failure code
+ */
+int XdpProgram::Register(int queue, int xsk) {
+    uint32_t key = queue;
+    uint32_t value = xsk;
+
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = map_fd;
+    attr.key = reinterpret_cast<uint64_t>(&key);
+    attr.value = reinterpret_cast<uint64_t>(&value);
+    attr.flags = BPF_ANY;
+    if (Bpf(BPF_MAP_UPDATE_ELEM, &attr) < 0) {
+        perror("bpf:BPF_MAP_UPDATE_ELEM");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Detach the program and close its maps
+ */
+void XdpProgram::Detach() {
+    if (link_fd >= 0) {
+        close(link_fd);
+        link_fd = -1;
+    }
+    if (prog_fd >= 0) {
+        close(prog_fd);
+        prog_fd = -1;
+    }
+    if (map_fd >= 0) {
+        close(map_fd);
+        map_fd = -1;
+    }
+}
+
+/**
+ * @brief XdpPacketIO constructor
+ * @param umem Buffers shared by every engine
+ * @param fill_frames Buffers kept in the fill ring (at most RING_SIZE)
+ * @param stats Counters of the worker using the engine (drops)
+ */
+XdpPacketIO::XdpPacketIO(PacketPool* umem, uint32_t fill_frames, WorkerStats* stats)
+    : umem(umem), fill_frames(fill_frames < RING_SIZE ? fill_frames : RING_SIZE), stats(stats),
+      fd(-1), control_fd(-1), fill_outstanding(0), tx_staged(0), tx_staged_bytes(0), reserved(-1),
+      rx_taken(0), control_done(false), state(new uint8_t[umem->Capacity()]()),
+      control_batch(XDP_CONTROL_BURST) {
+    memset(&rx, 0, sizeof(rx));
+    memset(&tx, 0, sizeof(tx));
+    memset(&fill, 0, sizeof(fill));
+    memset(&comp, 0, sizeof(comp));
+    rx_held.reserve(XDP_RX_PER_POLL);
+}
+
+/**
+ * @brief XdpPacketIO destructor
+ *
+ * Buffers still in the rings are not returned; the pool is torn down
+ * together with the engines.
+ */
+XdpPacketIO::~XdpPacketIO() {
+    for (Ring* ring : {&rx, &tx, &fill, &comp}) {
+        if (ring->map != nullptr) {
+            munmap(ring->map, ring->map_size);
+        }
+    }
+    if (reserved >= 0) {
+        umem->Free(reserved);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (control_fd >= 0) {
+        close(control_fd);
+    }
+}
+
+/**
+ * @brief Map one ring
+ * @param ring Ring to fill in
+ * @param offsets Offsets reported by XDP_MMAP_OFFSETS
+ * @param desc_size Size of one descriptor
+ * @param pgoff Page offset selecting the ring
+ * @return Success or failure code
+ */
+int XdpPacketIO::MapRing(Ring* ring, const struct xdp_ring_offset& offsets, size_t desc_size, off_t pgoff) {
+    ring->map_size = offsets.desc + RING_SIZE * desc_size;
+    ring->map = mmap(nullptr, ring->map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, pgoff);
+    if (ring->map == MAP_FAILED) {
+        perror("mmap:xsk ring");
+        ring->map = nullptr;
+        return -1;
+    }
+
+    u_char* base = static_cast<u_char*>(ring->map);
+    ring->producer = reinterpret_cast<uint32_t*>(base + offsets.producer);
+    ring->consumer = reinterpret_cast<uint32_t*>(base + offsets.consumer);
+    ring->flags = reinterpret_cast<uint32_t*>(base + offsets.flags);
+    ring->descs = base + offsets.desc;
+    ring->mask = RING_SIZE - 1;
+    ring->head = 0;
+    ring->tail = 0;
+    return 0;
+}
+
+/**
+ * @brief Open the socket and bind it to a device queue
+ * @param device Device name
+ * @param queue Receive queue
+ * @param program Program of the device, which the socket is registered with
+ * @param umem_fd Socket the UMEM is registered on, -1 to register it on this one
+ * @param control Open the ARP socket as well
+ * @return Success or failure code
+ */
+int XdpPacketIO::Open(const std::string& device, int queue, XdpProgram* program, int umem_fd, bool control) {
+    unsigned int ifindex = if_nametoindex(device.c_str());
+    if (ifindex == 0) {
+        perror("if_nametoindex");
+        return -1;
+    }
+
+    fd = socket(AF_XDP, SOCK_RAW, 0);
+    if (fd < 0) {
+        perror("socket:AF_XDP");
+        return -1;
+    }
+
+    if (umem_fd < 0) {
+        struct xdp_umem_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.addr = reinterpret_cast<uint64_t>(umem->Base());
+        reg.len = umem->Capacity() * PacketPool::BUF_SIZE;
+        reg.chunk_size = PacketPool::BUF_SIZE;
+        reg.headroom = 0;
+        if (setsockopt(fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) < 0) {
+            perror("setsockopt:XDP_UMEM_REG");
+            return -1;
+        }
+    }
+
+    // Every socket has its own fill and completion rings, even on a shared UMEM
+    uint32_t size = RING_SIZE;
+    static const int ring_opts[] = {XDP_UMEM_FILL_RING, XDP_UMEM_COMPLETION_RING, XDP_RX_RING, XDP_TX_RING};
+    for (int opt : ring_opts) {
+        if (setsockopt(fd, SOL_XDP, opt, &size, sizeof(size)) < 0) {
+            perror("setsockopt:xsk ring");
+            return -1;
+        }
+    }
+
+    struct xdp_mmap_offsets off;
+    socklen_t optlen = sizeof(off);
+    if (getsockopt(fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) < 0) {
+        perror("getsockopt:XDP_MMAP_OFFSETS");
+        return -1;
+    }
+    if (MapRing(&rx, off.rx, sizeof(struct xdp_desc), XDP_PGOFF_RX_RING) < 0 ||
+        MapRing(&tx, off.tx, sizeof(struct xdp_desc), XDP_PGOFF_TX_RING) < 0 ||
+        MapRing(&fill, off.fr, sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING) < 0 ||
+        MapRing(&comp, off.cr, sizeof(uint64_t), XDP_UMEM_PGOFF_COMPLETION_RING) < 0) {
+        return -1;
+    }
+    // The TX ring starts out empty: all of it is ours
+    tx.tail = RING_SIZE;
+
+    // Buffers to receive into before the first frame arrives
+    Refill();
+
+    // Sharing sockets inherit the wakeup and copy mode flags of the owner
+    struct sockaddr_xdp sxdp;
+    memset(&sxdp, 0, sizeof(sxdp));
+    sxdp.sxdp_family = AF_XDP;
+    sxdp.sxdp_ifindex = ifindex;
+    sxdp.sxdp_queue_id = queue;
+    if (umem_fd >= 0) {
+        sxdp.sxdp_flags = XDP_SHARED_UMEM;
+        sxdp.sxdp_shared_umem_fd = umem_fd;
+    } else {
+        sxdp.sxdp_flags = XDP_USE_NEED_WAKEUP;
+    }
+    if (bind(fd, reinterpret_cast<struct sockaddr*>(&sxdp), sizeof(sxdp)) < 0) {
+        perror("bind:AF_XDP");
+        return -1;
+    }
+
+    if (program->Register(queue, fd) < 0) {
+        return -1;
+    }
+
+    if (control) {
+        control_fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ARP));
+        if (control_fd < 0) {
+            perror("socket:ETH_P_ARP");
+            return -1;
+        }
+        struct sockaddr_ll sll;
+        memset(&sll, 0, sizeof(sll));
+        sll.sll_family = AF_PACKET;
+        sll.sll_protocol = htons(ETH_P_ARP);
+        sll.sll_ifindex = ifindex;
+        if (bind(control_fd, reinterpret_cast<struct sockaddr*>(&sll), sizeof(sll)) < 0) {
+            perror("bind:ETH_P_ARP");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Check whether the socket transmits from the UMEM without copying
+ * @return true in zero-copy mode, false in copy mode
+ */
+bool XdpPacketIO::IsZeroCopy() const {
+    struct xdp_options opts;
+    socklen_t optlen = sizeof(opts);
+    if (getsockopt(fd, SOL_XDP, XDP_OPTIONS, &opts, &optlen) < 0) {
+        return false;
+    }
+    return (opts.flags & XDP_OPTIONS_ZEROCOPY) != 0;
+}
+
+/**
+ * @brief Top the fill ring up from the pool
+ */
+void XdpPacketIO::Refill() {
+    uint64_t* addrs = static_cast<uint64_t*>(fill.descs);
+    while (fill_outstanding < fill_frames) {
+        int index = umem->Alloc();
+        if (index < 0) {
+            break;
+        }
+        addrs[fill.head++ & fill.mask] = static_cast<uint64_t>(index) * PacketPool::BUF_SIZE;
+        fill_outstanding++;
+    }
+    StoreIndex(fill.producer, fill.head);
+}
+
+/**
+ * @brief Return the buffers of completed transmissions to the pool
+ */
+void XdpPacketIO::Reap() {
+    uint32_t end = LoadIndex(comp.producer);
+    if (end == comp.head) {
+        return;
+    }
+
+    const uint64_t* addrs = static_cast<const uint64_t*>(comp.descs);
+    for (; comp.head != end; comp.head++) {
+        umem->Free(static_cast<int>(addrs[comp.head & comp.mask] / PacketPool::BUF_SIZE));
+    }
+    StoreIndex(comp.consumer, comp.head);
+}
+
+/**
+ * @brief Receive frames from the ARP socket
+ * @param frames Frame pointers (output)
+ * @param sizes Frame lengths (output)
+ * @param max Maximum number of frames
+ * @return Number of frames received
+ */
+int XdpPacketIO::ReceiveControl(u_char** frames, int* sizes, int max) {
+    int received = control_batch.Receive(control_fd, max);
+    if (received < 0) {
+        LOG_ERROR_LIMITED("recvmmsg:arp: %s\n", strerror(errno));
+        return 0;
+    }
+
+    int n = 0;
+    for (int i = 0; i < received; i++) {
+        if (control_batch.IsTruncated(i)) {
+            stats->Drop(DROP_TRUNCATED);
+        } else if (!control_batch.IsOutgoing(i)) {
+            // Our own ARP requests, looped back to the socket, are skipped
+            frames[n] = control_batch.Data(i);
+            sizes[n] = control_batch.Length(i);
+            n++;
+        }
+    }
+    return n;
+}
+
+/**
+ * @brief Receive frames
+ * @param frames Frame pointers (output)
+ * @param sizes Frame lengths (output)
+ * @param max Maximum number of frames
+ * @return Number of frames received, 0 when none are left for this loop
+ *         iteration
+ *
+ * The ARP socket is read once per loop iteration, before the XDP RX ring,
+ * which hands out up to XDP_RX_PER_POLL frames.
+ */
+int XdpPacketIO::RxBurst(u_char** frames, int* sizes, int max) {
+    int n = 0;
+    if (!control_done && control_fd >= 0) {
+        control_done = true;
+        n = ReceiveControl(frames, sizes, max);
+        if (n > 0) {
+            return n;
+        }
+    }
+
+    uint32_t available = LoadIndex(rx.producer) - rx.head;
+    uint32_t take = static_cast<uint32_t>(max);
+    if (take > static_cast<uint32_t>(XDP_RX_PER_POLL - rx_taken)) {
+        take = XDP_RX_PER_POLL - rx_taken;
+    }
+    if (take > available) {
+        take = available;
+    }
+    if (take == 0) {
+        return 0;
+    }
+
+    const struct xdp_desc* descs = static_cast<const struct xdp_desc*>(rx.descs);
+    u_char* base = umem->Base();
+    for (uint32_t i = 0; i < take; i++) {
+        const struct xdp_desc& desc = descs[rx.head++ & rx.mask];
+        uint32_t index = static_cast<uint32_t>(desc.addr / PacketPool::BUF_SIZE);
+        frames[i] = base + desc.addr;
+        sizes[i] = desc.len;
+        state[index] = FRAME_HELD;
+        rx_held.push_back(index);
+    }
+    // The descriptors are copied out; their buffers stay ours until Free()
+    StoreIndex(rx.consumer, rx.head);
+    fill_outstanding -= take;
+    rx_taken += take;
+
+    return take;
+}
+
+/**
+ * @brief Get a free TX descriptor, reaping and kicking if the ring is full
+ * @return true if a descriptor is available
+ */
+bool XdpPacketIO::TxSlot() {
+    if (tx.head != tx.tail) {
+        return true;
+    }
+    // tail is the consumer index plus the ring size: the first entry we may not write
+    tx.tail = LoadIndex(tx.consumer) + RING_SIZE;
+    if (tx.head != tx.tail) {
+        return true;
+    }
+    Kick();
+    tx.tail = LoadIndex(tx.consumer) + RING_SIZE;
+    return tx.head != tx.tail;
+}
+
+/**
+ * @brief Write a TX descriptor
+ * @param addr UMEM address
+ * @param len Frame length
+ */
+void XdpPacketIO::TxPush(uint64_t addr, int len) {
+    struct xdp_desc* descs = static_cast<struct xdp_desc*>(tx.descs);
+    struct xdp_desc& desc = descs[tx.head++ & tx.mask];
+    desc.addr = addr;
+    desc.len = len;
+    desc.options = 0;
+    tx_staged++;
+    tx_staged_bytes += len;
+}
+
+/**
+ * @brief Stage a frame for transmission
+ * @param data Frame data
+ * @param len Frame length
+ * @return Success or failure code
+ *
+ * A UMEM frame is sent where it is. Anything else is copied into a pool
+ * buffer, which returns to the pool once it has been sent.
+ */
+int XdpPacketIO::Stage(u_char* data, int len) {
+    if (len <= 0 || len > PacketPool::BUF_SIZE || !TxSlot()) {
+        return -1;
+    }
+
+    int index = umem->Index(data);
+    if (index >= 0) {
+        if (state[index] == FRAME_HELD) {
+            state[index] = FRAME_TAKEN;
+        }
+        TxPush(static_cast<uint64_t>(data - umem->Base()), len);
+        return 1;
+    }
+
+    index = umem->Alloc();
+    if (index < 0) {
+        LOG_DEBUG_LIMITED("xdp:umem exhausted\n");
+        return -1;
+    }
+    memcpy(umem->Data(index), data, len);
+    TxPush(static_cast<uint64_t>(index) * PacketPool::BUF_SIZE, len);
+    return 1;
+}
+
+/**
+ * @brief Reserve engine-owned storage for a frame built in place
+ * @return Pointer to a pool buffer or nullptr if the pool is exhausted
+ */
+u_char* XdpPacketIO::Reserve() {
+    if (reserved < 0) {
+        reserved = umem->Alloc();
+        if (reserved < 0) {
+            return nullptr;
+        }
+    }
+    return umem->Data(reserved);
+}
+
+/**
+ * @brief Stage the frame previously written into Reserve() storage
+ * @param len Frame length
+ * @return Success or failure code
+ */
+int XdpPacketIO::Commit(int len) {
+    if (reserved < 0) {
+        return -1;
+    }
+    if (len <= 0 || len > PacketPool::BUF_SIZE || !TxSlot()) {
+        umem->Free(reserved);
+        reserved = -1;
+        return -1;
+    }
+    TxPush(static_cast<uint64_t>(reserved) * PacketPool::BUF_SIZE, len);
+    reserved = -1;
+    return 1;
+}
+
+/**
+ * @brief Publish the staged descriptors and make the kernel send them
+ *
+ * In copy mode each sendto() transmits a bounded batch synchronously, so
+ * the kernel is kicked again as long as it makes progress.
+ */
+void XdpPacketIO::Kick() {
+    StoreIndex(tx.producer, tx.head);
+
+    for (int i = 0; i < XDP_KICK_MAX; i++) {
+        uint32_t consumed = LoadIndex(tx.consumer);
+        if (consumed == tx.head || !(LoadIndex(tx.flags) & XDP_RING_NEED_WAKEUP)) {
+            break;
+        }
+        if (sendto(fd, nullptr, 0, MSG_DONTWAIT, nullptr, 0) < 0 &&
+            errno != EAGAIN && errno != EBUSY && errno != ENOBUFS) {
+            LOG_ERROR_LIMITED("sendto:AF_XDP: %s\n", strerror(errno));
+            break;
+        }
+        if (LoadIndex(tx.consumer) == consumed) {
+            break;
+        }
+    }
+
+    Reap();
+}
+
+/**
+ * @brief Send all staged frames
+ * @param frames Frames handed to the kernel (output, optional)
+ * @param bytes Bytes of those frames (output, optional)
+ * @param rejected Frames refused (output, optional); always 0, a staged descriptor is never taken back
+ * @return Number of frames sent
+ */
+int XdpPacketIO::TxBurst(size_t* frames, size_t* bytes, size_t* rejected) {
+    size_t sent = tx_staged;
+    if (frames != nullptr) {
+        *frames = tx_staged;
+    }
+    if (bytes != nullptr) {
+        *bytes = tx_staged_bytes;
+    }
+    if (rejected != nullptr) {
+        *rejected = 0;
+    }
+    tx_staged = 0;
+    tx_staged_bytes = 0;
+
+    Kick();
+    return static_cast<int>(sent);
+}
+
+/**
+ * @brief Give the frames received since the last call back to the engine
+ *
+ * Received frames that were neither staged nor detached go straight back
+ * to the fill ring; the ring is then topped up from the pool to replace
+ * the others.
+ */
+void XdpPacketIO::Free() {
+    uint64_t* addrs = static_cast<uint64_t*>(fill.descs);
+    for (uint32_t index : rx_held) {
+        if (state[index] == FRAME_HELD) {
+            addrs[fill.head++ & fill.mask] = static_cast<uint64_t>(index) * PacketPool::BUF_SIZE;
+            fill_outstanding++;
+        }
+        state[index] = FRAME_FREE;
+    }
+    rx_held.clear();
+    Refill();
+
+    if (LoadIndex(fill.flags) & XDP_RING_NEED_WAKEUP) {
+        recvfrom(fd, nullptr, 0, MSG_DONTWAIT, nullptr, nullptr);
+    }
+    Reap();
+
+    rx_taken = 0;
+    control_done = false;
+}
+
+/**
+ * @brief Take a received frame out of the engine
+ * @param data Frame returned by RxBurst()
+ * @return true if the frame now belongs to the caller
+ */
+bool XdpPacketIO::Detach(u_char* data) {
+    int index = umem->Index(data);
+    if (index < 0 || state[index] != FRAME_HELD) {
+        return false;
+    }
+    state[index] = FRAME_TAKEN;
+    return true;
+}
+
+/**
+ * @brief Return a frame taken with Detach() that will not be sent
+ * @param data Frame data
+ */
+void XdpPacketIO::Release(u_char* data) {
+    int index = umem->Index(data);
+    if (index >= 0) {
+        umem->Free(index);
+    }
+}
@@ -0,0 +1,241 @@
+/**
+ * @file xdp_io.hpp
+ * @brief Header file for the AF_XDP packet I/O engine
+ */
+
+#ifndef XDP_IO_HPP
+#define XDP_IO_HPP
+
+#include <linux/if_xdp.h>
+#include <netinet/in.h>
+#include <sys/types.h>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "packet_io.hpp"
+#include "packet_pool.hpp"
+#include "rx_batch.hpp"
+#include "stats.hpp"
+
+/**
+ * @brief XDP program steering a device's IPv4 frames to AF_XDP sockets
+ *
+ * Every IPv4 frame that is not addressed to one of the router's own
+ * addresses is redirected to the socket registered for the receive queue
+ * it arrived on. Everything else, ARP in particular, is passed on to the
+ * kernel, so the host keeps answering for its addresses.
+ */
+class XdpProgram {
+public:
+    /**
+     * @brief Constructor
+     */
+    XdpProgram();
+
+    /**
+     * @brief Destructor (detaches the program)
+     */
+    ~XdpProgram();
+
+    XdpProgram(const XdpProgram&) = delete;
+    XdpProgram& operator=(const XdpProgram&) = delete;
+
+    /**
+     * @brief Load the program and attach it to a device
+     * @param device Device name
+     * @param queues Number of receive queues with a socket
+     * @param local_addrs Addresses whose frames go to the kernel
+     * @return Success or failure code
+     *
+     * Driver mode is tried first, then generic (skb) mode.
+     */
+    int Attach(const std::string& device, int queues, const std::vector<in_addr_t>& local_addrs);
+
+    /**
+     * @brief Steer a receive queue to a socket
+     * @param queue Receive queue
+     * @param xsk AF_XDP socket bound to the queue
+     * @return Success or failure code
+     */
+    int Register(int queue, int xsk);
+
+    /**
+     * @brief Detach the program and close its maps
+     */
+    void Detach();
+
+    /**
+     * @brief Check whether the program runs in the driver
+     * @return true for driver mode, false for generic (skb) mode
+     */
+    bool IsDriverMode() const { return driver_mode; }
+
+private:
+    int map_fd;                          // XSKMAP of sockets by receive queue
+    int prog_fd;                         // Loaded program
+    int link_fd;                         // Attachment to the device (detaches on close)
+    bool driver_mode;                    // Attached in driver mode
+
+    /**
+     * @brief Load the program
+     * @param local_addrs Addresses whose frames go to the kernel
+     * @return Program file descriptor or -1 on error
+     */
+    int Load(const std::vector<in_addr_t>& local_addrs);
+};
+
+/**
+ * @brief Engine over an AF_XDP socket
+ *
+ * All sockets share one UMEM, the buffers of a PacketPool, and each has
+ * its own fill and completion rings. A received frame is a UMEM buffer, so
+ * forwarding it, to its own port or through Detach() to another port's
+ * engine, only writes a TX descriptor; frames from outside the UMEM are
+ * copied into a buffer first. Buffers return to the pool when their
+ * transmission completes and to the fill ring when Free() finds them
+ * unused. Queue 0 of a port also owns an ETH_P_ARP packet socket, as ARP
+ * is left to the kernel by XdpProgram; received ARP frames are returned by
+ * RxBurst() with the others.
+ */
+class XdpPacketIO : public PacketIO {
+public:
+    static const uint32_t RING_SIZE = 2048;      // Entries of each of the four rings
+
+    /**
+     * @brief Constructor
+     * @param umem Buffers shared by every engine
+     * @param fill_frames Buffers kept in the fill ring (at most RING_SIZE)
+     * @param stats Counters of the worker using the engine (drops)
+     */
+    XdpPacketIO(PacketPool* umem, uint32_t fill_frames, WorkerStats* stats);
+
+    /**
+     * @brief Destructor
+     */
+    ~XdpPacketIO() override;
+
+    XdpPacketIO(const XdpPacketIO&) = delete;
+    XdpPacketIO& operator=(const XdpPacketIO&) = delete;
+
+    /**
+     * @brief Open the socket and bind it to a device queue
+     * @param device Device name
+     * @param queue Receive queue
+     * @param program Program of the device, which the socket is registered with
+     * @param umem_fd Socket the UMEM is registered on, -1 to register it on this one
+     * @param control Open the ARP socket as well
+     * @return Success or failure code
+     */
+    int Open(const std::string& device, int queue, XdpProgram* program, int umem_fd, bool control);
+
+    /**
+     * @brief Check whether the socket transmits from the UMEM without copying
+     * @return true in zero-copy mode, false in copy mode
+     */
+    bool IsZeroCopy() const;
+
+    int Fd() const override { return fd; }
+    int ControlFd() const override { return control_fd; }
+    int RxBurst(u_char** frames, int* sizes, int max) override;
+    int Stage(u_char* data, int len) override;
+    u_char* Reserve() override;
+    int Commit(int len) override;
+    int TxBurst(size_t* frames = nullptr, size_t* bytes = nullptr, size_t* rejected = nullptr) override;
+    size_t Pending() const override { return tx_staged; }
+    void Free() override;
+    bool Detach(u_char* data) override;
+    void Release(u_char* data) override;
+    const char* Name() const override { return "xdp"; }
+
+private:
+    /**
+     * @brief One of the rings shared with the kernel
+     */
+    class Ring {
+    public:
+        uint32_t* producer;              // Producer index in the mapping
+        uint32_t* consumer;              // Consumer index in the mapping
+        uint32_t* flags;                 // Ring flags (XDP_RING_NEED_WAKEUP)
+        void* descs;                     // Descriptor array
+        uint32_t mask;                   // Entries - 1
+        uint32_t head;                   // Our index: next to produce or consume
+        uint32_t tail;                   // Last seen index of the other side
+        void* map;                       // Mapping
+        size_t map_size;                 // Mapping length
+    };
+
+    enum FrameState : uint8_t {
+        FRAME_FREE,                      // Not received by this engine
+        FRAME_HELD,                      // Received, back to the fill ring in Free()
+        FRAME_TAKEN                      // Received, then staged or detached
+    };
+
+    PacketPool* umem;                    // Buffers shared by every engine
+    uint32_t fill_frames;                // Buffers kept in the fill ring
+    WorkerStats* stats;                  // Counters of the worker using the engine
+    int fd;                              // AF_XDP socket
+    int control_fd;                      // ETH_P_ARP packet socket, -1 if none
+    Ring rx;                             // Received frames (kernel to us)
+    Ring tx;                             // Frames to send (us to kernel)
+    Ring fill;                           // Buffers to receive into (us to kernel)
+    Ring comp;                           // Sent buffers (kernel to us)
+    uint32_t fill_outstanding;           // Buffers in the fill ring or being received into
+    size_t tx_staged;                    // Descriptors written but not yet published
+    size_t tx_staged_bytes;              // Bytes of tx_staged
+    int reserved;                        // Buffer handed out by Reserve(), -1 if none
+    int rx_taken;                        // Frames handed out since Free()
+    bool control_done;                   // ARP socket read since Free()
+    std::vector<uint32_t> rx_held;       // Buffers handed out since Free()
+    std::unique_ptr<uint8_t[]> state;    // FrameState of every UMEM buffer
+    RxBatch control_batch;               // Frames of the ARP socket
+
+    /**
+     * @brief Map one ring
+     * @param ring Ring to fill in
+     * @param offsets Offsets reported by XDP_MMAP_OFFSETS
+     * @param desc_size Size of one descriptor
+     * @param pgoff Page offset selecting the ring
+     * @return Success or failure code
+     */
+    int MapRing(Ring* ring, const struct xdp_ring_offset& offsets, size_t desc_size, off_t pgoff);
+
+    /**
+     * @brief Top the fill ring up from the pool
+     */
+    void Refill();
+
+    /**
+     * @brief Return the buffers of completed transmissions to the pool
+     */
+    void Reap();
+
+    /**
+     * @brief Get a free TX descriptor, reaping and kicking if the ring is full
+     * @return true if a descriptor is available
+     */
+    bool TxSlot();
+
+    /**
+     * @brief Write a TX descriptor
+     * @param addr UMEM address
+     * @param len Frame length
+     */
+    void TxPush(uint64_t addr, int len);
+
+    /**
+     * @brief Publish the staged descriptors and make the kernel send them
+     */
+    void Kick();
+
+    /**
+     * @brief Receive frames from the ARP socket
+     * @param frames Frame pointers (output)
+     * @param sizes Frame lengths (output)
+     * @param max Maximum number of frames
+     * @return Number of frames received
+     */
+    int ReceiveControl(u_char** frames, int* sizes, int max);
+};
+
+#endif // XDP_IO_HPP
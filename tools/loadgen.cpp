@@ -0,0 +1,425 @@
+/**
+ * @file loadgen.cpp
+ * @brief Traffic generator and sink for end-to-end router benchmarks
+ *
+ * loadgen send blasts UDP frames out of a raw socket, loadgen recv counts
+ * the ones that come back out of the router and measures their latency
+ * from a timestamp in the payload, and loadgen stats prints the router's
+ * counters. tools/loadtest.sh runs the three around ./router in network
+ * namespaces joined by veth pairs.
+ */
+
+#include <arpa/inet.h>
+#include <linux/if_packet.h>
+#include <net/ethernet.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <vector>
+#include "latency.hpp"
+#include "netutil.hpp"
+#include "rx_batch.hpp"
+
+static const uint32_t PAYLOAD_MAGIC = 0x4c47454e;   // "LGEN"
+static const uint16_t SOURCE_PORT = 9000;           // First UDP source port (one per flow)
+static const uint16_t DEST_PORT = 9;                // UDP destination port (discard)
+static const int MAX_BURST = 64;                    // Frames per sendmmsg()/recvmmsg()
+static const int MIN_FRAME = 60;                    // Shortest frame (Ethernet minimum without FCS)
+static const int MAX_FRAME = 1514;                  // Longest frame
+
+/**
+ * @brief Payload written after the UDP header of every frame
+ */
+struct LoadgenPayload {
+    uint32_t magic;     // PAYLOAD_MAGIC
+    uint32_t flow;      // Flow number
+    uint64_t tx_ns;     // CLOCK_MONOTONIC at transmission
+} __attribute__((packed));
+
+static volatile sig_atomic_t g_stop = 0;   // Set by the signal handler
+
+/**
+ * @brief Signal handler function
+ * @param sig Signal number
+ */
+static void StopHandler(int sig) {
+    (void)sig;
+    g_stop = 1;
+}
+
+/**
+ * @brief Read CLOCK_MONOTONIC
+ * @return Nanoseconds
+ *
+ * Network namespaces share the monotonic clock, so a sender and a receiver
+ * on the same host compare their timestamps directly.
+ */
+static uint64_t NowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * @brief Print usage
+ * @param prog Program name
+ */
+static void Usage(const char* prog) {
+    fprintf(stderr,
+            "Usage: %s send -i dev -m dst_mac -s src_ip -d dst_net [-l size] [-f flows] [-t ttl1_percent]\n"
+            "                [-r seconds] [-b burst] [-p pps]\n"
+            "       %s recv -i dev [-r seconds]\n"
+            "       %s stats socket_path\n",
+            prog, prog, prog);
+}
+
+/**
+ * @brief Parse a MAC address
+ * @param text Address as aa:bb:cc:dd:ee:ff
+ * @param mac Parsed address (output)
+ * @return Success or failure code
+ */
+static int ParseMac(const char* text, u_char mac[6]) {
+    unsigned int b[6];
+    if (sscanf(text, "%x:%x:%x:%x:%x:%x", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5]) != 6) {
+        return -1;
+    }
+    for (int i = 0; i < 6; i++) {
+        mac[i] = static_cast<u_char>(b[i]);
+    }
+    return 0;
+}
+
+/**
+ * @brief Get the MAC address of an interface
+ * @param device Interface name
+ * @param mac Address (output)
+ * @return Success or failure code
+ */
+static int DeviceMac(const std::string& device, u_char mac[6]) {
+    struct in_addr addr, subnet, netmask;
+    return NetworkUtil::GetDeviceInfo(device, mac, &addr, &subnet, &netmask);
+}
+
+/**
+ * @brief Build the frame of one flow
+ * @param frame Frame buffer of size bytes (output)
+ * @param size Frame length
+ * @param dhost Destination MAC address (the router's port)
+ * @param shost Source MAC address
+ * @param src Source address
+ * @param dst Destination address
+ * @param flow Flow number
+ * @param ttl TTL
+ */
+static void BuildFrame(u_char* frame, int size, const u_char dhost[6], const u_char shost[6],
+                       in_addr_t src, in_addr_t dst, uint32_t flow, int ttl) {
+    memset(frame, 0, size);
+    struct ether_header* eth = (struct ether_header*)frame;
+    memcpy(eth->ether_dhost, dhost, 6);
+    memcpy(eth->ether_shost, shost, 6);
+    eth->ether_type = htons(ETHERTYPE_IP);
+
+    struct iphdr* ip = (struct iphdr*)(frame + sizeof(struct ether_header));
+    ip->version = 4;
+    ip->ihl = 5;
+    ip->tot_len = htons(size - sizeof(struct ether_header));
+    ip->id = htons(static_cast<uint16_t>(flow));
+    ip->ttl = ttl;
+    ip->protocol = IPPROTO_UDP;
+    ip->saddr = src;
+    ip->daddr = dst;
+    ip->check = NetworkUtil::Checksum((unsigned char*)ip, sizeof(struct iphdr));
+
+    // No UDP checksum, so the timestamp can be written without updating it
+    struct udphdr* udp = (struct udphdr*)(ip + 1);
+    udp->source = htons(SOURCE_PORT + (flow & 0x3fff));
+    udp->dest = htons(DEST_PORT);
+    udp->len = htons(size - sizeof(struct ether_header) - sizeof(struct iphdr));
+
+    LoadgenPayload* payload = (LoadgenPayload*)(udp + 1);
+    payload->magic = htonl(PAYLOAD_MAGIC);
+    payload->flow = flow;
+}
+
+/**
+ * @brief Send frames until the duration has passed
+ * @param argc Argument count
+ * @param argv Argument values
+ * @return Exit code
+ */
+static int RunSend(int argc, char* argv[]) {
+    std::string device;
+    u_char dhost[6];
+    bool have_dhost = false;
+    in_addr_t src = 0;
+    in_addr_t dst_net = 0;
+    int size = 64;
+    int flows = 1;
+    int ttl1_percent = 0;
+    double seconds = 5.0;
+    int burst = 32;
+    double pps = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "i:m:s:d:l:f:t:r:b:p:")) != -1) {
+        switch (opt) {
+        case 'i': device = optarg; break;
+        case 'm': have_dhost = (ParseMac(optarg, dhost) == 0); break;
+        case 's': src = inet_addr(optarg); break;
+        case 'd': dst_net = inet_addr(optarg); break;
+        case 'l': size = atoi(optarg); break;
+        case 'f': flows = atoi(optarg); break;
+        case 't': ttl1_percent = atoi(optarg); break;
+        case 'r': seconds = atof(optarg); break;
+        case 'b': burst = atoi(optarg); break;
+        case 'p': pps = atof(optarg); break;
+        default: Usage(argv[0]); return 1;
+        }
+    }
+    if (device.empty() || !have_dhost || src == 0 || dst_net == 0 || size < MIN_FRAME || size > MAX_FRAME ||
+        flows < 1 || ttl1_percent < 0 || ttl1_percent > 100 || burst < 1 || burst > MAX_BURST) {
+        Usage(argv[0]);
+        return 1;
+    }
+
+    int soc = NetworkUtil::InitRawSocket(device, 0, 1);
+    if (soc < 0) {
+        return 1;
+    }
+    // Straight to the driver: the qdisc would only add locking
+    int one = 1;
+    setsockopt(soc, SOL_PACKET, PACKET_QDISC_BYPASS, &one, sizeof(one));
+    u_char shost[6];
+    if (DeviceMac(device, shost) < 0) {
+        perror("GetDeviceInfo");
+        return 1;
+    }
+
+    // One template per flow and TTL; flows spread over dst_net's host part
+    std::vector<u_char> templates(static_cast<size_t>(flows) * 2 * size);
+    for (int f = 0; f < flows; f++) {
+        in_addr_t dst = htonl(ntohl(dst_net) + 1 + f);
+        BuildFrame(&templates[(f * 2) * size], size, dhost, shost, src, dst, f, 64);
+        BuildFrame(&templates[(f * 2 + 1) * size], size, dhost, shost, src, dst, f, 1);
+    }
+
+    std::vector<u_char> slots(static_cast<size_t>(burst) * size);
+    struct mmsghdr msgs[MAX_BURST];
+    struct iovec iovs[MAX_BURST];
+    memset(msgs, 0, sizeof(msgs));
+    for (int i = 0; i < burst; i++) {
+        iovs[i].iov_base = &slots[i * size];
+        iovs[i].iov_len = size;
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    const size_t payload_off = sizeof(struct ether_header) + sizeof(struct iphdr) + sizeof(struct udphdr);
+    uint64_t seq = 0;
+    uint64_t sent = 0;
+    uint64_t ttl1_sent = 0;
+    uint64_t rejected = 0;
+    uint64_t start = NowNs();
+    uint64_t end = start + static_cast<uint64_t>(seconds * 1e9);
+    uint64_t now = start;
+
+    while (!g_stop && now < end) {
+        // Pace by sleeping until the schedule has caught up with the frames sent
+        if (pps > 0) {
+            uint64_t due = start + static_cast<uint64_t>(sent * 1e9 / pps);
+            if (due > now) {
+                struct timespec ts = {static_cast<time_t>((due - now) / 1000000000ULL),
+                                      static_cast<long>((due - now) % 1000000000ULL)};
+                nanosleep(&ts, nullptr);
+            }
+        }
+
+        now = NowNs();
+        bool ttl1[MAX_BURST];
+        for (int i = 0; i < burst; i++, seq++) {
+            int flow = static_cast<int>(seq % flows);
+            ttl1[i] = static_cast<int>((seq / flows) % 100) < ttl1_percent;
+            u_char* slot = &slots[i * size];
+            memcpy(slot, &templates[(flow * 2 + (ttl1[i] ? 1 : 0)) * size], size);
+            ((LoadgenPayload*)(slot + payload_off))->tx_ns = now;
+        }
+
+        int ret = sendmmsg(soc, msgs, burst, 0);
+        if (ret < 0) {
+            if (errno != ENOBUFS && errno != EAGAIN && errno != EINTR) {
+                perror("sendmmsg");
+                break;
+            }
+            // Rejected frames are not counted as sent
+            ret = 0;
+        }
+        for (int i = 0; i < ret; i++) {
+            ttl1_sent += ttl1[i];
+        }
+        sent += ret;
+        rejected += burst - ret;
+        now = NowNs();
+    }
+
+    double elapsed = (now - start) / 1e9;
+    printf("sent=%llu ttl1_sent=%llu rejected=%llu seconds=%.3f mpps=%.3f\n",
+           static_cast<unsigned long long>(sent), static_cast<unsigned long long>(ttl1_sent),
+           static_cast<unsigned long long>(rejected), elapsed, elapsed > 0 ? sent / elapsed / 1e6 : 0.0);
+    close(soc);
+    return 0;
+}
+
+/**
+ * @brief Count received frames and their latency until the duration has passed
+ * @param argc Argument count
+ * @param argv Argument values
+ * @return Exit code
+ */
+static int RunRecv(int argc, char* argv[]) {
+    std::string device;
+    double seconds = 5.0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "i:r:")) != -1) {
+        switch (opt) {
+        case 'i': device = optarg; break;
+        case 'r': seconds = atof(optarg); break;
+        default: Usage(argv[0]); return 1;
+        }
+    }
+    if (device.empty()) {
+        Usage(argv[0]);
+        return 1;
+    }
+
+    int soc = NetworkUtil::InitRawSocket(device, 0, 1);
+    if (soc < 0) {
+        return 1;
+    }
+    int rcvbuf = 32 * 1024 * 1024;
+    setsockopt(soc, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf));
+
+    RxBatch batch(MAX_BURST);
+    std::unique_ptr<LatencyHistogram> latency(new LatencyHistogram());
+    const size_t payload_off = sizeof(struct ether_header) + sizeof(struct iphdr) + sizeof(struct udphdr);
+    uint64_t received = 0;
+    uint64_t bytes = 0;
+    uint64_t first_ns = 0;
+    uint64_t last_ns = 0;
+    uint64_t end = NowNs() + static_cast<uint64_t>(seconds * 1e9);
+
+    struct pollfd target;
+    target.fd = soc;
+    target.events = POLLIN;
+    while (!g_stop && NowNs() < end) {
+        if (poll(&target, 1, 100) <= 0) {
+            continue;
+        }
+        int n;
+        while ((n = batch.Receive(soc, MAX_BURST)) > 0) {
+            uint64_t now = NowNs();
+            for (int i = 0; i < n; i++) {
+                if (batch.IsOutgoing(i) || batch.Length(i) < static_cast<int>(payload_off + sizeof(LoadgenPayload))) {
+                    continue;
+                }
+                const LoadgenPayload* payload = (const LoadgenPayload*)(batch.Data(i) + payload_off);
+                if (payload->magic != htonl(PAYLOAD_MAGIC)) {
+                    continue;
+                }
+                if (received == 0) {
+                    first_ns = now;
+                }
+                received++;
+                bytes += batch.Length(i);
+                latency->Record(now > payload->tx_ns ? now - payload->tx_ns : 0);
+            }
+            last_ns = now;
+        }
+    }
+
+    // Rate over the span frames arrived in, so a late start does not count
+    double span = (last_ns > first_ns) ? (last_ns - first_ns) / 1e9 : 0.0;
+    printf("received=%llu bytes=%llu seconds=%.3f mpps=%.3f p50_us=%.1f p99_us=%.1f p999_us=%.1f\n",
+           static_cast<unsigned long long>(received), static_cast<unsigned long long>(bytes), span,
+           span > 0 ? received / span / 1e6 : 0.0, latency->Quantile(0.5) / 1e3,
+           latency->Quantile(0.99) / 1e3, latency->Quantile(0.999) / 1e3);
+    close(soc);
+    return 0;
+}
+
+/**
+ * @brief Print the router's counters
+ * @param path Stats socket path
+ * @return Exit code
+ */
+static int RunStats(const char* path) {
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "socket path too long: %s\n", path);
+        return 1;
+    }
+
+    int soc = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (soc < 0) {
+        perror("socket");
+        return 1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    if (connect(soc, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("connect");
+        close(soc);
+        return 1;
+    }
+
+    char buf[4096];
+    ssize_t n;
+    while ((n = read(soc, buf, sizeof(buf))) > 0) {
+        fwrite(buf, 1, n, stdout);
+    }
+    close(soc);
+    return 0;
+}
+
+/**
+ * @brief Main function
+ * @param argc Argument count
+ * @param argv Argument values
+ * @return Exit code
+ */
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        Usage(argv[0]);
+        return 1;
+    }
+
+    signal(SIGINT, StopHandler);
+    signal(SIGTERM, StopHandler);
+
+    // Options follow the subcommand
+    std::string command = argv[1];
+    argv[1] = argv[0];
+    if (command == "send") {
+        return RunSend(argc - 1, argv + 1);
+    } else if (command == "recv") {
+        return RunRecv(argc - 1, argv + 1);
+    } else if (command == "stats" && argc == 3) {
+        return RunStats(argv[2]);
+    }
+
+    Usage(argv[0]);
+    return 1;
+}
@@ -0,0 +1,102 @@
+#!/bin/sh
+# End-to-end throughput test of ./router between two network namespaces:
+#
+#   lg-tx: tx0 (10.0.1.2) --- r0 [lg-rt: ./router] r1 --- rx0 (10.0.2.2) :lg-rx
+#
+# loadgen send blasts UDP frames from lg-tx to 10.9.0.0/16, which the
+# router forwards to its default gateway 10.0.2.2; loadgen recv counts them
+# in lg-rx (whose kernel drops them, as it does not forward). Run as root
+# from the repository root:
+#
+#   tools/loadtest.sh [-m read|ring|batch] [-q queues] [-l size] [-f flows]
+#                     [-t ttl1_percent] [-r seconds] [-p pps] [-- router options]
+
+set -e
+
+MODE=batch
+QUEUES=1
+SIZE=64
+FLOWS=64
+TTL1=0
+SECONDS_RUN=5
+PPS=0
+while getopts "m:q:l:f:t:r:p:" opt; do
+    case $opt in
+    m) MODE=$OPTARG ;;
+    q) QUEUES=$OPTARG ;;
+    l) SIZE=$OPTARG ;;
+    f) FLOWS=$OPTARG ;;
+    t) TTL1=$OPTARG ;;
+    r) SECONDS_RUN=$OPTARG ;;
+    p) PPS=$OPTARG ;;
+    *) sed -n '2,12s/^# \{0,1\}//p' "$0" >&2; exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+[ "$1" = "--" ] && shift
+
+WORK=$(mktemp -d)
+STATS=$WORK/router.stats
+
+cleanup() {
+    [ -n "$ROUTER_PID" ] && kill "$ROUTER_PID" 2>/dev/null && wait "$ROUTER_PID" 2>/dev/null
+    for ns in lg-tx lg-rt lg-rx; do
+        ip netns del $ns 2>/dev/null || true
+    done
+    rm -rf "$WORK"
+}
+trap cleanup EXIT INT TERM
+
+make -s router loadgen
+
+# Namespaces and veth pairs; one queue per router worker
+for ns in lg-tx lg-rt lg-rx; do
+    ip netns del $ns 2>/dev/null || true
+    ip netns add $ns
+    ip -n $ns link set lo up
+done
+ip link add tx0 numtxqueues "$QUEUES" numrxqueues "$QUEUES" netns lg-tx type veth \
+    peer name r0 numtxqueues "$QUEUES" numrxqueues "$QUEUES" netns lg-rt
+ip link add rx0 numtxqueues "$QUEUES" numrxqueues "$QUEUES" netns lg-rx type veth \
+    peer name r1 numtxqueues "$QUEUES" numrxqueues "$QUEUES" netns lg-rt
+ip -n lg-tx addr add 10.0.1.2/24 dev tx0
+ip -n lg-rt addr add 10.0.1.1/24 dev r0
+ip -n lg-rt addr add 10.0.2.1/24 dev r1
+ip -n lg-rx addr add 10.0.2.2/24 dev rx0
+for pair in lg-tx:tx0 lg-rt:r0 lg-rt:r1 lg-rx:rx0; do
+    ns=${pair%%:*}
+    dev=${pair#*:}
+    ip -n "$ns" link set "$dev" up
+    # Real checksums on the wire; the router does not fix up partial ones
+    ip netns exec "$ns" ethtool -K "$dev" tx off >/dev/null 2>&1 || true
+done
+
+ip netns exec lg-rt ./router -m "$MODE" -q "$QUEUES" -s "$STATS" "$@" r0 r1 10.0.2.2 \
+    > "$WORK/router.log" 2>&1 &
+ROUTER_PID=$!
+sleep 1
+
+# Have the router learn the gateway before the run, so the first frames are
+# not queued behind ARP
+ip netns exec lg-rx ping -c 1 -W 1 10.0.2.1 > /dev/null 2>&1 || true
+
+ip netns exec lg-rx ./loadgen recv -i rx0 -r $((SECONDS_RUN + 2)) > "$WORK/recv" &
+RECV_PID=$!
+sleep 0.5
+ip netns exec lg-tx ./loadgen send -i tx0 -m "$(ip netns exec lg-rt cat /sys/class/net/r0/address)" \
+    -s 10.0.1.2 -d 10.9.0.0 -l "$SIZE" -f "$FLOWS" -t "$TTL1" -r "$SECONDS_RUN" -p "$PPS" > "$WORK/send"
+wait $RECV_PID
+
+echo "mode=$MODE queues=$QUEUES size=$SIZE flows=$FLOWS ttl1_percent=$TTL1"
+echo "tx: $(cat "$WORK/send")"
+echo "rx: $(cat "$WORK/recv")"
+
+# Frames that should have come out, less those that did
+sent=$(sed -n 's/.*sent=\([0-9]*\) ttl1_sent=\([0-9]*\).*/\1 \2/p' "$WORK/send")
+received=$(sed -n 's/^received=\([0-9]*\).*/\1/p' "$WORK/recv")
+set -- $sent
+expected=$(($1 - $2))
+echo "lost=$((expected - received)) of $expected"
+
+echo "router counters (non-zero):"
+ip netns exec lg-rt ./loadgen stats "$STATS" | grep -v ' 0$' | sed 's/^/  /'